@@ -16,8 +16,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <errno.h>
-#include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include <sys/apparmor.h>
 #include <sys/apparmor_private.h>
@@ -207,114 +208,315 @@ static int filter_profiles(struct profile *profiles,
 	return ret;
 }
 
+/*
+ * Scanning /proc
+ *
+ * Hosts can run tens of thousands of processes, so the pid entries are
+ * read in one go and each process is then looked at with a single read
+ * of its label and a readlink of its exe, relative to a /proc dirfd.
+ * Unconfined executables are looked up in a hash set of the profile
+ * names, and many processes are split between a few threads.
+ */
+
+/* long enough for any pid, a longer name is not a pid */
+#define PID_NAME_SIZE 16
+#define PIDS_PER_THREAD 2048
+#define MAX_SCAN_THREADS 8
+#define LABEL_BUF_SIZE 4096
+
+struct profile_set {
+	const char **names;	/* open addressing, a power of 2 slots */
+	size_t size;
+};
+
+static size_t hash_name(const char *name)
+{
+	size_t hash = 5381;
+
+	while (*name)
+		hash = hash * 33 ^ (unsigned char) *name++;
+	return hash;
+}
+
+static int profile_set_init(struct profile_set *set, struct profile *profiles,
+			    size_t n)
+{
+	size_t i, j;
+
+	set->size = 16;
+	while (set->size < n * 2)
+		set->size <<= 1;
+	set->names = calloc(set->size, sizeof(*set->names));
+	if (set->names == NULL)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		for (j = hash_name(profiles[i].name) & (set->size - 1);
+		     set->names[j] != NULL;
+		     j = (j + 1) & (set->size - 1)) {
+			if (strcmp(set->names[j], profiles[i].name) == 0)
+				break;
+		}
+		set->names[j] = profiles[i].name;
+	}
+	return 0;
+}
+
+static int profile_set_contains(const struct profile_set *set,
+				const char *name)
+{
+	size_t i;
+
+	for (i = hash_name(name) & (set->size - 1); set->names[i] != NULL;
+	     i = (i + 1) & (set->size - 1)) {
+		if (strcmp(set->names[i], name) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+struct process_list {
+	struct process *processes;
+	size_t n;
+	size_t size;
+};
+
+static int add_process(struct process_list *list, const char *pid,
+		       const char *profile, const char *exe, const char *mode)
+{
+	struct process *process;
+
+	if (list->n == list->size) {
+		size_t size = list->size ? list->size * 2 : 64;
+		struct process *_processes = realloc(list->processes,
+						     size * sizeof(*list->processes));
+		if (_processes == NULL)
+			return -1;
+		list->processes = _processes;
+		list->size = size;
+	}
+	process = &list->processes[list->n];
+	process->pid = strdup(pid);
+	process->profile = strdup(profile);
+	process->exe = strdup(exe);
+	process->mode = strdup(mode);
+	list->n++;
+	if (!process->pid || !process->profile || !process->exe ||
+	    !process->mode)
+		return -1;
+	return 0;
+}
+
+struct scan {
+	int procfd;
+	const char *attr;	/* the current label, relative to the pid dir */
+	struct profile_set profiles;
+};
+
+/* returns -1 if out of memory, processes that can't be read are skipped */
+static int scan_process(const struct scan *scan, const char *pid,
+			struct process_list *list)
+{
+	char path[PID_NAME_SIZE + 32];
+	char buf[LABEL_BUF_SIZE];
+	char exe[PATH_MAX + 1];
+	autofree char *label = NULL;
+	char *profile, *mode = NULL;
+	ssize_t size;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", pid, scan->attr);
+	fd = openat(scan->procfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		/* fail to access */
+		return 0;
+	}
+	size = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (size == -1) {
+		return 0;
+	} else if (size == sizeof(buf) - 1) {
+		/* a long label, let libapparmor size the buffer */
+		if (aa_getprocattr(atoi(pid), "current", &label, &mode) == -1)
+			return errno == ENOMEM ? -1 : 0;
+		profile = label;
+	} else {
+		buf[size] = '\0';
+		profile = buf;
+		if (size > 0 && buf[size - 1] != '\0') {
+			profile = aa_splitcon(buf, &mode);
+			if (profile == NULL)
+				return 0;
+		}
+	}
+
+	// the kernel reports the canonical path of the executable, so
+	// unlike realpath() this needs no lookups of its own
+	snprintf(path, sizeof(path), "%s/exe", pid);
+	size = readlinkat(scan->procfd, path, exe, PATH_MAX);
+	if (size == -1) {
+		return 0;
+	}
+	exe[size] = '\0';
+
+	if (mode == NULL) {
+		// is unconfined so keep only if this has a
+		// matching profile. TODO: fix to use attachment
+		if (!profile_set_contains(&scan->profiles, exe))
+			return 0;
+		profile = exe;
+		mode = "unconfined";
+	}
+	return add_process(list, pid, profile, exe, mode);
+}
+
+struct scan_job {
+	const struct scan *scan;
+	char (*pids)[PID_NAME_SIZE];
+	size_t npids;
+	struct process_list list;
+	int ret;
+};
+
+static void *scan_processes(void *data)
+{
+	struct scan_job *job = data;
+	size_t i;
+
+	for (i = 0; i < job->npids; i++) {
+		if (scan_process(job->scan, job->pids[i], &job->list) == -1) {
+			job->ret = -1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static size_t scan_threads(size_t npids)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t threads = npids / PIDS_PER_THREAD;
+
+	if (cpus > 0 && threads > (size_t) cpus)
+		threads = cpus;
+	if (threads > MAX_SCAN_THREADS)
+		threads = MAX_SCAN_THREADS;
+	return threads ? threads : 1;
+}
+
+static int read_pids(DIR *dir, char (**pids)[PID_NAME_SIZE], size_t *npids)
+{
+	struct dirent *entry;
+	size_t size = 0;
+
+	*pids = NULL;
+	*npids = 0;
+	while ((entry = readdir(dir)) != NULL) {
+		size_t len = strspn(entry->d_name, "0123456789");
+
+		// ignore non-pid entries
+		if (len == 0 || entry->d_name[len] != '\0' ||
+		    len >= PID_NAME_SIZE) {
+			continue;
+		}
+		if (*npids == size) {
+			char (*_pids)[PID_NAME_SIZE];
+
+			size = size ? size * 2 : 1024;
+			_pids = realloc(*pids, size * sizeof(**pids));
+			if (_pids == NULL) {
+				free(*pids);
+				*pids = NULL;
+				*npids = 0;
+				return -1;
+			}
+			*pids = _pids;
+		}
+		memcpy((*pids)[*npids], entry->d_name, len + 1);
+		*npids = *npids + 1;
+	}
+	return 0;
+}
+
 static int get_processes(struct profile *profiles,
 			 size_t n,
 			 struct process **processes,
 			 size_t *nprocesses)
 {
+	struct scan_job jobs[MAX_SCAN_THREADS];
+	pthread_t threads[MAX_SCAN_THREADS];
+	int started[MAX_SCAN_THREADS];
+	char (*pids)[PID_NAME_SIZE] = NULL;
+	struct scan scan;
 	DIR *dir = NULL;
-	struct dirent *entry = NULL;
+	size_t npids, nthreads, total = 0, i;
 	int ret = 0;
 
 	*processes = NULL;
 	*nprocesses = 0;
+	memset(&scan, 0, sizeof(scan));
+	memset(jobs, 0, sizeof(jobs));
 
 	dir = opendir("/proc");
 	if (dir == NULL) {
 		ret = AA_EXIT_INTERNAL_ERROR;
 		goto exit;
-        }
-	while ((entry = readdir(dir)) != NULL) {
-		size_t i;
-		int rc;
-		int ispid = 1;
-		autofree char *profile = NULL;
-		autofree char *mode = NULL; /* be careful */
-		autofree char *exe = NULL;
-		autofree char *real_exe = NULL;
-		autofclose FILE *fp = NULL;
-		autofree char *line = NULL;
-
-		// ignore non-pid entries
-		for (i = 0; ispid && i < strlen(entry->d_name); i++) {
-			ispid = (isdigit(entry->d_name[i]) ? 1 : 0);
-		}
-		if (!ispid) {
-			continue;
-		}
+	}
+	scan.procfd = dirfd(dir);
+	if (faccessat(scan.procfd, "self/attr/apparmor", F_OK, 0) == 0 ||
+	    errno == EACCES) {
+		scan.attr = "attr/apparmor/current";
+	} else {
+		scan.attr = "attr/current";
+	}
+	if (read_pids(dir, &pids, &npids) == -1 ||
+	    profile_set_init(&scan.profiles, profiles, n) == -1) {
+		fprintf(stderr, "ERROR: Failed to allocate memory\n");
+		ret = AA_EXIT_INTERNAL_ERROR;
+		goto exit;
+	}
 
-		rc = aa_getprocattr(atoi(entry->d_name), "current", &profile, &mode);
-		if (rc == -1 && errno != ENOMEM) {
-			/* fail to access */
-			continue;
-		} else if (rc == -1 ||
-			   asprintf(&exe, "/proc/%s/exe", entry->d_name) == -1) {
-			fprintf(stderr, "ERROR: Failed to allocate memory\n");
+	// contiguous ranges of pids, so the processes stay in /proc order
+	nthreads = scan_threads(npids);
+	for (i = 0; i < nthreads; i++) {
+		jobs[i].scan = &scan;
+		jobs[i].pids = pids + npids * i / nthreads;
+		jobs[i].npids = npids * (i + 1) / nthreads - npids * i / nthreads;
+		// the last range is scanned by this thread
+		started[i] = i + 1 < nthreads &&
+			pthread_create(&threads[i], NULL, scan_processes,
+				       &jobs[i]) == 0;
+		if (!started[i])
+			scan_processes(&jobs[i]);
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		if (jobs[i].ret == -1)
 			ret = AA_EXIT_INTERNAL_ERROR;
-			goto exit;
-		} else if (mode) {
-			/* TODO: make this not needed. Mode can now be autofreed */
-			mode = strdup(mode);
-		}
-		// get executable - readpath can allocate for us but seems
-		// to fail in some cases with errno 2 - no such file or
-		// directory - whereas readlink() can succeed in these
-		// cases - and readpath() seems to have the same behaviour
-		// as in python with better canonicalized results so try it
-		// first and fallack to readlink if it fails
-		// coverity[toctou]
-		real_exe = realpath(exe, NULL);
-		if (real_exe == NULL) {
-			int res;
-			// ensure enough space for NUL terminator
-			real_exe = calloc(PATH_MAX + 1, sizeof(char));
-			if (real_exe == NULL) {
-				fprintf(stderr, "ERROR: Failed to allocate memory\n");
-				ret = AA_EXIT_INTERNAL_ERROR;
-				goto exit;
-			}
-			res = readlink(exe, real_exe, PATH_MAX);
-			if (res == -1) {
-				continue;
-			}
-			real_exe[res] = '\0';
-		}
-
-
-		if (mode == NULL) {
-			// is unconfined so keep only if this has a
-			// matching profile. TODO: fix to use attachment
-			for (i = 0; i < n; i++) {
-				if (strcmp(profiles[i].name, real_exe) == 0) {
-					profile = strdup(real_exe);
-					mode = strdup("unconfined");
-					break;
-				}
-			}
-		}
-		if (profile != NULL && mode != NULL) {
-			struct process *_processes = realloc(*processes,
-							     (*nprocesses + 1) * sizeof(**processes));
-			if (_processes == NULL) {
-				free_processes(*processes, *nprocesses);
-				*processes = NULL;
-				*nprocesses = 0;
-				ret = AA_EXIT_INTERNAL_ERROR;
-				goto exit;
-			}
-			_processes[*nprocesses].pid = strdup(entry->d_name);
-			_processes[*nprocesses].profile = profile;
-			_processes[*nprocesses].exe = strdup(real_exe);
-			_processes[*nprocesses].mode = mode;
-			*processes = _processes;
-			*nprocesses = *nprocesses + 1;
-			profile = NULL;
-			mode = NULL;
-			ret = AA_EXIT_ENABLED;
-		}
+		total += jobs[i].list.n;
+	}
+	if (ret == 0 && total > 0) {
+		*processes = malloc(total * sizeof(**processes));
+		if (*processes == NULL)
+			ret = AA_EXIT_INTERNAL_ERROR;
+	}
+	if (ret != 0) {
+		fprintf(stderr, "ERROR: Failed to allocate memory\n");
+		for (i = 0; i < nthreads; i++)
+			free_processes(jobs[i].list.processes, jobs[i].list.n);
+		goto exit;
+	}
+	for (i = 0; i < nthreads; i++) {
+		memcpy(*processes + *nprocesses, jobs[i].list.processes,
+		       jobs[i].list.n * sizeof(**processes));
+		*nprocesses += jobs[i].list.n;
+		free(jobs[i].list.processes);
 	}
 
 exit:
+	free(scan.profiles.names);
+	free(pids);
 	if (dir != NULL) {
 		closedir(dir);
 	}
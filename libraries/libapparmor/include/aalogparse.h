@@ -19,6 +19,9 @@
 #ifndef __LIBAALOGPARSE_H_
 #define __LIBAALOGPARSE_H_
 
+#include <stddef.h>
+#include <sys/types.h>
+
 #define AA_RECORD_EXEC_MMAP	1
 #define AA_RECORD_READ		2
 #define AA_RECORD_WRITE		4
@@ -178,5 +181,224 @@ parse_record(char *str);
 void
 free_record(aa_log_record *record);
 
+/**
+ * Reusable scanner state for parse_record_r().  A state may only be
+ * used by one thread at a time.
+ */
+typedef struct aa_log_parse_state aa_log_parse_state;
+
+/**
+ * Allocates scanner state to parse records with.
+ * @return New state, or NULL with errno set on error.
+ */
+aa_log_parse_state *
+aa_log_parse_state_new(void);
+
+/**
+ * Frees scanner state allocated by aa_log_parse_state_new().
+ * @param[in] State to free, may be NULL.
+ */
+void
+aa_log_parse_state_free(aa_log_parse_state *state);
+
+/**
+ * Parses a single log record string into a caller provided record,
+ * without allocating memory for its fields.  The strings of the record
+ * are stored in buf and remain valid as long as it does; the record must
+ * not be passed to free_record().  A buffer as large as the string is
+ * enough for most records.  Safe to call from several threads, as long
+ * as they do not share a state.
+ * @param[in] Scanner state to reuse, or NULL to use a temporary one.
+ * @param[in] Record to parse.
+ * @param[out] Parsed data.
+ * @param[in] Buffer to hold the strings of the parsed data.
+ * @param[in] Size of the buffer.
+ * @return 0 on success, -1 with errno set to ERANGE if the buffer is too
+ * small, or to another value on error.  An unparseable string is not an
+ * error, it is returned as an AA_RECORD_INVALID event.
+ */
+int
+parse_record_r(aa_log_parse_state *state, const char *str,
+	       aa_log_record *record, char *buf, size_t buflen);
+
+/**
+ * Called with a batch of records parsed by aa_log_parse_stream().  The
+ * records and their strings are only valid until the callback returns.
+ * @param[in] Parsed records.
+ * @param[in] Number of records.
+ * @param[in] Data passed to aa_log_parse_stream().
+ * @return 0 to carry on parsing, anything else to stop.
+ */
+typedef int (*aa_log_stream_callback)(aa_log_record *records, size_t count,
+				      void *data);
+
+/**
+ * Parses the AppArmor records in a log, such as an audit log, a syslog
+ * file or /dev/kmsg, until the end of the log, or until no more can be
+ * read if the file descriptor is non blocking.  Lines that are not
+ * AppArmor records are skipped without being parsed, and records that
+ * can not be parsed are left out.
+ * @param[in] File descriptor to read the log from.
+ * @param[in] Function to call with each batch of records.
+ * @param[in] Data to pass to the callback.
+ * @return 0 at the end of the log, -1 with errno set on error, or what
+ * the callback returned if it stopped parsing.
+ */
+int
+aa_log_parse_stream(int fd, aa_log_stream_callback callback, void *data);
+
+/**
+ * An event and the number of times it was logged, as counted by an
+ * aa_log_aggregate.
+ */
+typedef struct
+{
+	const char *profile;
+	const char *operation;
+	const char *name;
+	const char *requested_mask;
+	unsigned long count;
+} aa_log_event_count;
+
+/**
+ * Counts of the events logged, keyed on profile, operation, name and
+ * requested_mask.  An aggregate may only be used by one thread at a time.
+ */
+typedef struct aa_log_aggregate aa_log_aggregate;
+
+/**
+ * Creates an empty aggregate.
+ * @param[out] New aggregate.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int
+aa_log_aggregate_new(aa_log_aggregate **aggregate);
+
+/**
+ * Frees an aggregate and the strings of its events.
+ * @param[in] Aggregate to free, may be NULL.
+ */
+void
+aa_log_aggregate_free(aa_log_aggregate *aggregate);
+
+/**
+ * Counts the event of a parsed record.
+ * @param[in] Aggregate to count the event in.
+ * @param[in] Parsed record.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int
+aa_log_aggregate_add_record(aa_log_aggregate *aggregate,
+			    const aa_log_record *record);
+
+/**
+ * Counts the events in a log, read from the current offset of the file
+ * descriptor.  Regular files are split at line boundaries and parsed by
+ * several threads at once, up to their size at the time of the call;
+ * other files are read until their end by the calling thread.
+ * @param[in] Aggregate to count the events in.
+ * @param[in] File descriptor to read the log from.
+ * @param[in] Number of threads to use, 0 for one per online cpu.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int
+aa_log_aggregate_add_file(aa_log_aggregate *aggregate, int fd, int threads);
+
+/**
+ * Gets the events counted so far, most frequent first.
+ * @param[in] Aggregate to get the events of.
+ * @param[out] Array of the events, which must be freed with free().  The
+ * strings of the events are valid until the aggregate is freed.
+ * @return Number of events, or -1 with errno set on error.
+ */
+ssize_t
+aa_log_aggregate_get_counts(aa_log_aggregate *aggregate,
+			    aa_log_event_count **counts);
+
+/**
+ * Writes records to a file in a compact, versioned binary format, which
+ * can be read back without parsing the log again.
+ */
+typedef struct aa_log_writer aa_log_writer;
+
+/**
+ * Reads back records written by an aa_log_writer.
+ */
+typedef struct aa_log_reader aa_log_reader;
+
+/**
+ * Creates a writer, which writes the header of the format right away.
+ * @param[out] New writer.
+ * @param[in] File descriptor to write to, such as a new file or a pipe.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int
+aa_log_writer_new(aa_log_writer **writer, int fd);
+
+/**
+ * Adds a record.  Records are buffered until the buffer is full or the
+ * writer is flushed.
+ * @param[in] Writer to add the record to.
+ * @param[in] Record, as returned by parse_record.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int
+aa_log_writer_add(aa_log_writer *writer, const aa_log_record *record);
+
+/**
+ * Adds the records of a text log, as parsed by aa_log_parse_stream.
+ * @param[in] Writer to add the records to.
+ * @param[in] File descriptor to read the log from.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int
+aa_log_writer_add_log(aa_log_writer *writer, int fd);
+
+/**
+ * Writes out the buffered records.
+ * @param[in] Writer to flush.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int
+aa_log_writer_flush(aa_log_writer *writer);
+
+/**
+ * Flushes and frees a writer.  The file descriptor is left open.
+ * @param[in] Writer to free, may be NULL.
+ * @return 0 on success, -1 with errno set if records could not be written.
+ */
+int
+aa_log_writer_free(aa_log_writer *writer);
+
+/**
+ * Creates a reader, which maps the file.
+ * @param[out] New reader.
+ * @param[in] File descriptor of a regular file to read.
+ * @return 0 on success, -1 with errno set on error, to EBADMSG if the
+ * file is not in the format and to EPROTONOSUPPORT if it is in a newer
+ * version of it.
+ */
+int
+aa_log_reader_new(aa_log_reader **reader, int fd);
+
+/**
+ * Reads the next record.  The strings of the record point into the
+ * mapped file and are valid until the reader is freed; the record must
+ * not be passed to free_record().
+ * @param[in] Reader to read from.
+ * @param[out] Record read.
+ * @return 1 if a record was read, 0 at the end of the file, or -1 with
+ * errno set on error, to EBADMSG if the file is corrupt.
+ */
+int
+aa_log_reader_next(aa_log_reader *reader, aa_log_record *record);
+
+/**
+ * Unmaps the file and frees a reader.
+ * @param[in] Reader to free, may be NULL.
+ */
+void
+aa_log_reader_free(aa_log_reader *reader);
+
 #endif
 
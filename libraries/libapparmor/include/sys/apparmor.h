@@ -119,6 +119,23 @@ extern int aa_query_link_path_len(const char *label, size_t label_len,
 extern int aa_query_link_path(const char *label, const char *target,
 			      const char *link, int *allowed, int *audited);
 
+typedef struct aa_query_ctx aa_query_ctx;
+typedef struct aa_label_query {
+	uint32_t mask;		/* permission bits to query */
+	char *query;		/* as for aa_query_label */
+	size_t size;
+	int allowed;		/* results */
+	int audited;
+	int error;		/* 0, or errno if the query failed */
+} aa_label_query;
+extern int aa_query_ctx_new(aa_query_ctx **ctx);
+extern aa_query_ctx *aa_query_ctx_ref(aa_query_ctx *ctx);
+extern void aa_query_ctx_unref(aa_query_ctx *ctx);
+extern int aa_query_ctx_label(aa_query_ctx *ctx, uint32_t mask, char *query,
+			      size_t size, int *allowed, int *audited);
+extern int aa_query_ctx_labels(aa_query_ctx *ctx, aa_label_query *queries,
+			       size_t count);
+
 #define __macroarg_counter(Y...) __macroarg_count1 ( , ##Y)
 #define __macroarg_count1(Y...) __macroarg_count2 (Y, 16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0)
 #define __macroarg_count2(_,x0,x1,x2,x3,x4,x5,x6,x7,x8,x9,x10,x11,x12,x13,x14,x15,n,Y...) n
@@ -182,6 +199,12 @@ extern int aa_kernel_interface_replace_policy_from_file(aa_kernel_interface *ker
 							const char *path);
 extern int aa_kernel_interface_replace_policy_from_fd(aa_kernel_interface *kernel_interface,
 						      int fd);
+extern int aa_kernel_interface_load_policy_from_fds(aa_kernel_interface *kernel_interface,
+						    const int *fds,
+						    size_t count);
+extern int aa_kernel_interface_replace_policy_from_fds(aa_kernel_interface *kernel_interface,
+						       const int *fds,
+						       size_t count);
 extern int aa_kernel_interface_remove_policy(aa_kernel_interface *kernel_interface,
 					     const char *fqname);
 extern int aa_kernel_interface_write_policy(int fd, const char *buffer,
@@ -209,6 +232,30 @@ extern char *aa_policy_cache_filename(aa_policy_cache *policy_cache, const char
 extern char *aa_policy_cache_dir_path_preview(aa_features *kernel_features,
 					      int dirfd, const char *path);
 
+typedef struct aa_perms {
+	uint32_t allow;
+	uint32_t deny;
+	uint32_t audit;
+	uint32_t quiet;
+} aa_perms;
+
+typedef struct aa_compiled_policy aa_compiled_policy;
+extern int aa_compiled_policy_new(aa_compiled_policy **policy, int dirfd,
+				  const char *path);
+extern int aa_compiled_policy_new_from_fd(aa_compiled_policy **policy, int fd);
+extern int aa_compiled_policy_new_from_data(aa_compiled_policy **policy,
+					    const void *data, size_t size);
+extern aa_compiled_policy *aa_compiled_policy_ref(aa_compiled_policy *policy);
+extern void aa_compiled_policy_unref(aa_compiled_policy *policy);
+
+extern int aa_compiled_policy_query(aa_compiled_policy *policy,
+				    const char *label, const char *query,
+				    size_t size, aa_perms *perms);
+extern int aa_compiled_policy_query_file_path(aa_compiled_policy *policy,
+					      uint32_t mask, const char *label,
+					      const char *path, int *allowed,
+					      int *audited);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,207 @@
+/*
+ *   Copyright (c) 2026
+ *   Canonical, Ltd. (All rights reserved)
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of version 2 of the GNU General Public
+ *   License published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, contact Canonical Ltd.
+ */
+
+/*
+ * Throughput benchmark of log parsing, not run by make check.
+ *
+ *   make bench_parse_record && ./bench_parse_record [iterations [logfile]]
+ *
+ * Parses the lines of logfile, or a few sample records, iterations times
+ * with parse_record(), with parse_record_r() using a temporary scanner
+ * state, and with parse_record_r() reusing one scanner state.  Given a
+ * logfile, it is also parsed with aa_log_parse_stream(), which skips the
+ * lines that are not AppArmor records.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <aalogparse.h>
+
+static char *samples[] = {
+	"type=AVC msg=audit(1279948288.415:39): apparmor=\"DENIED\" operation=\"open\" parent=12332 profile=\"/usr/sbin/cupsd\" name=\"/home/user/.ssh/\" pid=12333 comm=\"ls\" requested_mask=\"r\" denied_mask=\"r\" fsuid=0 ouid=1000",
+	"Jul 31 17:10:35 dbusdev-saucy-amd64 dbus[1692]: apparmor=\"DENIED\" operation=\"dbus_method_call\"  bus=\"session\" name=\"org.freedesktop.DBus\" path=\"/org/freedesktop/DBus\" interface=\"org.freedesktop.DBus\" member=\"Hello\" mask=\"send\" pid=2922 profile=\"/tmp/apparmor-2.8.0/tests/regression/apparmor/dbus_service\" peer_profile=\"unconfined\"",
+	"type=AVC msg=audit(1409438250.564:201): apparmor=\"DENIED\" operation=\"sendmsg\" profile=\"/usr/bin/nc\" pid=8385 comm=\"nc\" laddr=127.0.0.1 lport=57634 faddr=127.0.0.1 fport=4444 family=\"inet\" sock_type=\"stream\" protocol=6 requested_mask=\"send\" denied_mask=\"send\"",
+	"[ 4584.703379] audit: type=1400 audit(1459371218.613:110): apparmor=\"ALLOWED\" operation=\"exec\" profile=\"/usr/bin/foo\" name=2F746D702F646F6573206E6F74206578697374 pid=4815 comm=\"foo\" requested_mask=\"x\" denied_mask=\"x\" fsuid=0 ouid=0 target=\"/usr/bin/foo//null-/bin/true\"",
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, long n, size_t bytes, double start)
+{
+	double elapsed = now() - start;
+
+	printf("%-28s %10ld in %8.3fs  %10.0f/s  %8.1f MB/s\n", name, n,
+	       elapsed, n / elapsed, bytes / elapsed / 1e6);
+}
+
+static int count_records(aa_log_record *records, size_t count, void *data)
+{
+	*(long *) data += count;
+	return 0;
+}
+
+static void bench_stream(const char *path, long iterations, size_t lines,
+			 size_t bytes)
+{
+	long records = 0, j;
+	double start;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return;
+	}
+
+	start = now();
+	for (j = 0; j < iterations; j++) {
+		lseek(fd, 0, SEEK_SET);
+		if (aa_log_parse_stream(fd, count_records, &records) == -1) {
+			perror("aa_log_parse_stream");
+			break;
+		}
+	}
+	report("aa_log_parse_stream", j * lines, bytes, start);
+	printf("%ld AppArmor records per pass\n", j ? records / j : 0);
+
+	close(fd);
+}
+
+static char **read_lines(const char *path, size_t *count)
+{
+	char **lines = NULL, *line = NULL;
+	size_t n = 0, alloc = 0, len = 0;
+	ssize_t rsize;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return NULL;
+	while ((rsize = getline(&line, &len, f)) != -1) {
+		if (rsize && line[rsize - 1] == '\n')
+			line[rsize - 1] = '\0';
+		if (n == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			lines = realloc(lines, alloc * sizeof(*lines));
+			if (!lines)
+				exit(1);
+		}
+		lines[n++] = line;
+		line = NULL;
+	}
+	free(line);
+	fclose(f);
+
+	*count = n;
+	return lines;
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 100000;
+	char **lines = samples;
+	size_t i, count = sizeof(samples) / sizeof(*samples);
+	size_t bytes = 0, buflen = 4096;
+	aa_log_parse_state *state;
+	aa_log_record record;
+	long denied = 0, n = 0, j;
+	double start;
+	char *buf;
+
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations [logfile]]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2) {
+		lines = read_lines(argv[2], &count);
+		if (!lines || !count) {
+			fprintf(stderr, "%s: no lines to parse\n", argv[2]);
+			return 1;
+		}
+		iterations = (iterations + count - 1) / count;
+	}
+	for (i = 0; i < count; i++) {
+		bytes += strlen(lines[i]) + 1;
+		if (strlen(lines[i]) + 1 > buflen)
+			buflen = strlen(lines[i]) + 1;
+	}
+	bytes *= iterations;
+	buf = malloc(buflen);
+	state = aa_log_parse_state_new();
+	if (!buf || !state) {
+		perror("allocating parse state");
+		return 1;
+	}
+
+	start = now();
+	for (j = 0; j < iterations; j++) {
+		for (i = 0; i < count; i++) {
+			aa_log_record *r = parse_record(lines[i]);
+
+			denied += r->event == AA_RECORD_DENIED;
+			free_record(r);
+			n++;
+		}
+	}
+	report("parse_record", n, bytes, start);
+
+	start = now();
+	for (j = 0, n = 0; j < iterations; j++) {
+		for (i = 0; i < count; i++) {
+			if (parse_record_r(NULL, lines[i], &record, buf,
+					   buflen) == -1 && errno != ERANGE) {
+				perror("parse_record_r");
+				return 1;
+			}
+			denied -= record.event == AA_RECORD_DENIED;
+			n++;
+		}
+	}
+	report("parse_record_r", n, bytes, start);
+
+	start = now();
+	for (j = 0, n = 0; j < iterations; j++) {
+		for (i = 0; i < count; i++) {
+			parse_record_r(state, lines[i], &record, buf, buflen);
+			n++;
+		}
+	}
+	report("parse_record_r, reused state", n, bytes, start);
+
+	if (argc > 2)
+		bench_stream(argv[2], iterations, count, bytes);
+
+	if (denied)
+		printf("parse_record and parse_record_r disagree\n");
+
+	aa_log_parse_state_free(state);
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ *   Copyright (c) 2026
+ *   Canonical, Ltd. (All rights reserved)
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of version 2 of the GNU General Public
+ *   License published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, contact Canonical Ltd.
+ */
+
+/*
+ * Microbenchmark of label queries, not run by make check.
+ *
+ *   make bench_query_label && ./bench_query_label [iterations]
+ *
+ * Compares parsing the kernel's reply with sscanf() and by hand, and, if
+ * the kernel's query interface is available, querying the caller's own
+ * label with aa_query_label, with a query context, and with batches of
+ * queries on a query context.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "kernel.c"
+
+#define BATCH_SIZE	64
+
+static const char reply[] =
+	"allow 0x0000006e\ndeny 0x00000000\naudit 0x00000000\nquiet 0x00000000\n";
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, long n, double start)
+{
+	double elapsed = now() - start;
+
+	printf("%-24s %10ld in %8.3fs  %10.0f/s  %8.1f ns each\n", name, n,
+	       elapsed, n / elapsed, elapsed * 1e9 / n);
+}
+
+static int parse_sscanf(const char *buf, uint32_t mask, int *allowed,
+			int *audited)
+{
+	uint32_t allow, deny, audit, quiet;
+
+	if (sscanf(buf, "allow 0x%8" SCNx32 "\n"
+			"deny 0x%8"  SCNx32 "\n"
+			"audit 0x%8" SCNx32 "\n"
+			"quiet 0x%8" SCNx32 "\n",
+		   &allow, &deny, &audit, &quiet) != 4)
+		return -1;
+
+	*allowed = mask & ~(allow & ~deny) ? 0 : 1;
+	if (!(*allowed))
+		audit = 0xFFFFFFFF;
+	*audited = mask & ~(audit & ~quiet) ? 0 : 1;
+
+	return 0;
+}
+
+static void bench_parse(long n)
+{
+	int allowed, audited, sum = 0;
+	double start;
+	long i;
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		parse_sscanf(reply, AA_MAY_READ, &allowed, &audited);
+		sum += allowed;
+	}
+	report("parse sscanf", n, start);
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		parse_query_reply(reply, QUERY_LABEL_REPLY_LEN, AA_MAY_READ,
+				  &allowed, &audited);
+		sum += allowed;
+	}
+	report("parse by hand", n, start);
+
+	if (sum != 2 * n)
+		printf("unexpected results\n");
+}
+
+static void bench_query(long n)
+{
+	aa_label_query queries[BATCH_SIZE];
+	aa_query_ctx *ctx;
+	char query[4096];
+	char *label;
+	size_t size;
+	int allowed, audited;
+	double start;
+	long i;
+	int j;
+
+	if (aa_getcon(&label, NULL) == -1) {
+		printf("query: skipped, aa_getcon failed: %m\n");
+		return;
+	}
+
+	/* file query for "/" by the caller's own label */
+	size = snprintf(query + AA_QUERY_CMD_LABEL_SIZE,
+			sizeof(query) - AA_QUERY_CMD_LABEL_SIZE, "%s%c%c/",
+			label, 0, AA_CLASS_FILE);
+	size += AA_QUERY_CMD_LABEL_SIZE;
+	free(label);
+
+	if (aa_query_ctx_new(&ctx) == -1) {
+		printf("query: skipped, no query interface: %m\n");
+		return;
+	}
+	if (aa_query_label(AA_MAY_READ, query, size, &allowed,
+			   &audited) == -1) {
+		printf("query: skipped, query failed: %m\n");
+		aa_query_ctx_unref(ctx);
+		return;
+	}
+
+	start = now();
+	for (i = 0; i < n; i++)
+		aa_query_label(AA_MAY_READ, query, size, &allowed, &audited);
+	report("aa_query_label", n, start);
+
+	start = now();
+	for (i = 0; i < n; i++)
+		aa_query_ctx_label(ctx, AA_MAY_READ, query, size, &allowed,
+				   &audited);
+	report("aa_query_ctx_label", n, start);
+
+	for (j = 0; j < BATCH_SIZE; j++) {
+		queries[j].mask = AA_MAY_READ;
+		queries[j].query = query;
+		queries[j].size = size;
+	}
+	start = now();
+	for (i = 0; i < n; i += BATCH_SIZE)
+		aa_query_ctx_labels(ctx, queries, BATCH_SIZE);
+	report("aa_query_ctx_labels", (n + BATCH_SIZE - 1) / BATCH_SIZE *
+	       BATCH_SIZE, start);
+
+	aa_query_ctx_unref(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : 100000;
+
+	if (n <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	bench_parse(n * 10);
+	bench_query(n);
+
+	return 0;
+}
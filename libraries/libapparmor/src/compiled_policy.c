@@ -0,0 +1,935 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Answer policy queries in userspace from compiled policy, as written by
+ * the parser to a cache file or to stdout with -S.  The profiles are
+ * unpacked the way the kernel unpacks them (security/apparmor/
+ * policy_unpack.c) and queries follow the semantics of the kernel's
+ * .access label query, so the results match aa_query_label() against the
+ * same policy loaded into the kernel.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/apparmor.h>
+
+#include "private.h"
+#include "match.h"
+
+/* element type codes of the serialized policy, see parser_interface.c */
+enum sd_code {
+	SD_U8,
+	SD_U16,
+	SD_U32,
+	SD_U64,
+	SD_NAME,
+	SD_STRING,
+	SD_BLOB,
+	SD_STRUCT,
+	SD_STRUCTEND,
+	SD_LIST,
+	SD_LISTEND,
+	SD_ARRAY,
+	SD_ARRAYEND,
+	SD_OFFSET
+};
+
+/* nesting of the policy format is shallow, anything deeper is garbage */
+#define MAX_SKIP_DEPTH		16
+
+/* packed profile modes */
+#define PACKED_MODE_ENFORCE	0
+#define PACKED_MODE_COMPLAIN	1
+#define PACKED_MODE_KILL	2
+#define PACKED_MODE_UNCONFINED	3
+
+#define ALL_PERMS_MASK		0xffffffff
+
+#define UNCONFINED		"unconfined"
+#define STACK_SEP		"//&"
+
+struct aa_ext {
+	const unsigned char *start;
+	const unsigned char *end;
+	const unsigned char *pos;
+};
+
+struct compiled_profile {
+	char *ns;		/* "" for the root namespace */
+	char *name;
+	size_t order;		/* load order, later profiles replace earlier */
+	uint32_t mode;
+	bool audit;
+	struct aa_dfa *policydb;
+	struct aa_dfa *file;
+	/* state file queries start in, in ->file if present, otherwise in
+	 * the file class of ->policydb.  DFA_NOMATCH if neither mediates
+	 * files.
+	 */
+	unsigned int file_start;
+};
+
+struct aa_compiled_policy {
+	unsigned int ref_count;
+	struct compiled_profile *profiles;
+	size_t count;
+};
+
+static inline bool inbounds(struct aa_ext *e, size_t size)
+{
+	return size <= (size_t) (e->end - e->pos);
+}
+
+static inline uint16_t get_le16(const unsigned char *p)
+{
+	return (uint16_t) p[0] | ((uint16_t) p[1] << 8);
+}
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+		((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static bool unpack_X(struct aa_ext *e, enum sd_code code)
+{
+	if (!inbounds(e, 1) || *e->pos != code)
+		return false;
+	e->pos++;
+	return true;
+}
+
+/* u16 length prefixed chunk, used by names and strings */
+static size_t unpack_u16_chunk(struct aa_ext *e, const char **chunk)
+{
+	size_t size;
+
+	if (!inbounds(e, 2))
+		return 0;
+	size = get_le16(e->pos);
+	if (!inbounds(e, 2 + size))
+		return 0;
+	*chunk = (const char *) e->pos + 2;
+	e->pos += 2 + size;
+	return size;
+}
+
+/**
+ * unpack_nameX - check for an optional name followed by a type code
+ * @e: serialized data extent
+ * @code: type code expected
+ * @name: name to match, or NULL to accept any name or none
+ *
+ * Returns: true with @e advanced past the name and type code on a match,
+ *          else false with @e unchanged
+ */
+static bool unpack_nameX(struct aa_ext *e, enum sd_code code, const char *name)
+{
+	const unsigned char *pos = e->pos;
+
+	if (unpack_X(e, SD_NAME)) {
+		const char *tag;
+		size_t size = unpack_u16_chunk(e, &tag);
+
+		/* if a name is specified it must match, otherwise skip tag */
+		if (name && (!size || tag[size - 1] != '\0' ||
+			     strcmp(name, tag) != 0))
+			goto fail;
+	} else if (name) {
+		goto fail;
+	}
+
+	if (unpack_X(e, code))
+		return true;
+
+fail:
+	e->pos = pos;
+	return false;
+}
+
+static bool unpack_u32(struct aa_ext *e, uint32_t *data, const char *name)
+{
+	const unsigned char *pos = e->pos;
+
+	if (!unpack_nameX(e, SD_U32, name))
+		return false;
+	if (!inbounds(e, 4)) {
+		e->pos = pos;
+		return false;
+	}
+	*data = get_le32(e->pos);
+	e->pos += 4;
+	return true;
+}
+
+static bool unpack_str(struct aa_ext *e, const char **str, const char *name)
+{
+	const unsigned char *pos = e->pos;
+	size_t size;
+
+	if (!unpack_nameX(e, SD_STRING, name))
+		return false;
+	size = unpack_u16_chunk(e, str);
+	if (!size || (*str)[size - 1] != '\0') {
+		e->pos = pos;
+		return false;
+	}
+	return true;
+}
+
+static bool unpack_blob(struct aa_ext *e, const unsigned char **blob,
+			size_t *size, const char *name)
+{
+	const unsigned char *pos = e->pos;
+
+	if (!unpack_nameX(e, SD_BLOB, name))
+		return false;
+	if (!inbounds(e, 4))
+		goto fail;
+	*size = get_le32(e->pos);
+	e->pos += 4;
+	if (!inbounds(e, *size))
+		goto fail;
+	*blob = e->pos;
+	e->pos += *size;
+	return true;
+
+fail:
+	e->pos = pos;
+	return false;
+}
+
+/**
+ * skip_element - step over the next (optionally named) element
+ * @e: serialized data extent
+ * @depth: current nesting depth
+ *
+ * Used to step over the parts of a profile that do not affect queries,
+ * which keeps the loader working as new entries are added to the format.
+ *
+ * Returns: true on success, false if the element is malformed
+ */
+static bool skip_element(struct aa_ext *e, int depth)
+{
+	const char *tag;
+	size_t size;
+
+	if (depth > MAX_SKIP_DEPTH)
+		return false;
+
+	if (unpack_X(e, SD_NAME) && !unpack_u16_chunk(e, &tag))
+		return false;
+	if (!inbounds(e, 1))
+		return false;
+
+	switch (*e->pos++) {
+	case SD_U8:
+		size = 1;
+		break;
+	case SD_U16:
+		size = 2;
+		break;
+	case SD_U32:
+		size = 4;
+		break;
+	case SD_U64:
+		size = 8;
+		break;
+	case SD_STRING:
+		return unpack_u16_chunk(e, &tag) != 0;
+	case SD_BLOB:
+		if (!inbounds(e, 4))
+			return false;
+		size = 4 + get_le32(e->pos);
+		break;
+	case SD_STRUCT:
+		while (!unpack_X(e, SD_STRUCTEND)) {
+			if (!skip_element(e, depth + 1))
+				return false;
+		}
+		return true;
+	case SD_LIST:
+		while (!unpack_X(e, SD_LISTEND)) {
+			if (!skip_element(e, depth + 1))
+				return false;
+		}
+		return true;
+	case SD_ARRAY:
+		if (!inbounds(e, 2))
+			return false;
+		e->pos += 2;
+		while (!unpack_X(e, SD_ARRAYEND)) {
+			if (!skip_element(e, depth + 1))
+				return false;
+		}
+		return true;
+	default:
+		return false;
+	}
+
+	if (!inbounds(e, size))
+		return false;
+	e->pos += size;
+	return true;
+}
+
+/* dfa blobs are padded so the tables are 8 byte aligned in the stream,
+ * the padding is zeros and the table set magic is not
+ */
+static struct aa_dfa *unpack_dfa(struct aa_ext *e)
+{
+	const unsigned char *blob;
+	size_t size;
+	int pad;
+
+	if (!unpack_blob(e, &blob, &size, "aadfa"))
+		return NULL;
+	for (pad = 0; pad < 7 && size && *blob == 0; pad++) {
+		blob++;
+		size--;
+	}
+
+	return aa_dfa_unpack(blob, size);
+}
+
+static bool unpack_policydb(struct aa_ext *e, struct compiled_profile *p)
+{
+	while (!unpack_X(e, SD_STRUCTEND)) {
+		const unsigned char *pos = e->pos;
+
+		if (!p->policydb && unpack_nameX(e, SD_BLOB, "aadfa")) {
+			e->pos = pos;
+			p->policydb = unpack_dfa(e);
+			if (!p->policydb)
+				return false;
+		} else if (!skip_element(e, 1)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void free_profile(struct compiled_profile *p)
+{
+	free(p->ns);
+	free(p->name);
+	aa_dfa_free(p->policydb);
+	aa_dfa_free(p->file);
+}
+
+/**
+ * unpack_profile - unpack the parts of a profile needed to answer queries
+ * @e: serialized data extent, positioned after the "profile" struct code
+ * @ns: namespace from the header or NULL
+ * @p: profile to fill in
+ *
+ * Returns: true on success, else false with errno set
+ */
+static bool unpack_profile(struct aa_ext *e, const char *ns,
+			   struct compiled_profile *p)
+{
+	const unsigned char *pos;
+	const char *name;
+	bool seen_flags = false;
+	uint32_t tmp;
+
+	if (!unpack_str(e, &name, NULL))
+		goto proto;
+
+	/* the name may carry its own namespace, ":ns:name" */
+	if (*name == ':') {
+		const char *split = strchr(name + 1, ':');
+
+		if (!split)
+			goto proto;
+		p->ns = strndup(name + 1, split - name - 1);
+		name = split + 1;
+	} else {
+		p->ns = strdup(ns ? ns : "");
+	}
+	p->name = strdup(name);
+	if (!p->ns || !p->name)
+		return false;
+
+	while (!unpack_X(e, SD_STRUCTEND)) {
+		pos = e->pos;
+		if (!seen_flags && unpack_nameX(e, SD_STRUCT, "flags")) {
+			if (!unpack_u32(e, &tmp, NULL) ||
+			    !unpack_u32(e, &p->mode, NULL) ||
+			    !unpack_u32(e, &tmp, NULL))
+				goto proto;
+			p->audit = tmp != 0;
+			while (!unpack_X(e, SD_STRUCTEND)) {
+				if (!skip_element(e, 1))
+					goto proto;
+			}
+			seen_flags = true;
+		} else if (unpack_nameX(e, SD_STRUCT, "policydb")) {
+			if (!unpack_policydb(e, p))
+				goto proto;
+		} else if (unpack_nameX(e, SD_BLOB, "aadfa")) {
+			e->pos = pos;
+			/* the dfa before the flags is the attachment dfa,
+			 * which queries do not use
+			 */
+			if (!seen_flags) {
+				if (!skip_element(e, 0))
+					goto proto;
+				continue;
+			}
+			if (p->file)
+				goto proto;
+			p->file = unpack_dfa(e);
+			if (!p->file)
+				goto proto;
+			p->file_start = DFA_START;
+		} else if (p->file && unpack_u32(e, &tmp, "dfa_start")) {
+			if (tmp >= aa_dfa_state_count(p->file))
+				goto proto;
+			p->file_start = tmp;
+		} else if (!skip_element(e, 0)) {
+			goto proto;
+		}
+	}
+
+	if (!seen_flags)
+		goto proto;
+	if (!p->file && p->policydb)
+		p->file_start = aa_dfa_next(p->policydb, DFA_START,
+					    AA_CLASS_FILE);
+
+	return true;
+
+proto:
+	errno = EPROTO;
+	return false;
+}
+
+static int cmp_profile(const void *a, const void *b)
+{
+	const struct compiled_profile *pa = a, *pb = b;
+	int res = strcmp(pa->ns, pb->ns);
+
+	if (res)
+		return res;
+	res = strcmp(pa->name, pb->name);
+	if (res)
+		return res;
+	return pa->order < pb->order ? -1 : pa->order > pb->order;
+}
+
+/* sort for lookup, and drop profiles replaced by a later one of the same
+ * name the way the kernel would on load
+ */
+static void sort_profiles(aa_compiled_policy *policy)
+{
+	size_t i, count = 0;
+
+	qsort(policy->profiles, policy->count, sizeof(*policy->profiles),
+	      cmp_profile);
+	for (i = 0; i < policy->count; i++) {
+		struct compiled_profile *p = &policy->profiles[i];
+
+		if (i + 1 < policy->count &&
+		    strcmp(p->ns, p[1].ns) == 0 &&
+		    strcmp(p->name, p[1].name) == 0) {
+			free_profile(p);
+			continue;
+		}
+		policy->profiles[count++] = *p;
+	}
+	policy->count = count;
+}
+
+static int unpack_policy(aa_compiled_policy *policy, const void *data,
+			 size_t size)
+{
+	struct aa_ext e = {
+		.start = data,
+		.end = (const unsigned char *) data + size,
+		.pos = data,
+	};
+	size_t alloced = 0;
+
+	while (e.pos < e.end) {
+		struct compiled_profile *p;
+		const char *ns = NULL;
+		uint32_t version;
+
+		if (!unpack_u32(&e, &version, "version")) {
+			errno = EPROTO;
+			return -1;
+		}
+		/* the namespace is optional */
+		unpack_str(&e, &ns, "namespace");
+		if (!unpack_nameX(&e, SD_STRUCT, "profile")) {
+			errno = EPROTO;
+			return -1;
+		}
+
+		if (policy->count == alloced) {
+			size_t n = alloced ? alloced * 2 : 16;
+
+			p = realloc(policy->profiles, n * sizeof(*p));
+			if (!p) {
+				errno = ENOMEM;
+				return -1;
+			}
+			policy->profiles = p;
+			alloced = n;
+		}
+		p = &policy->profiles[policy->count];
+		memset(p, 0, sizeof(*p));
+		p->order = policy->count++;
+		if (!unpack_profile(&e, ns, p))
+			return -1;
+	}
+
+	if (!policy->count) {
+		errno = EPROTO;
+		return -1;
+	}
+	sort_profiles(policy);
+
+	return 0;
+}
+
+static ssize_t read_whole_fd(int fd, char **buffer)
+{
+	char *buf = NULL;
+	size_t size = 0, len = 0;
+	ssize_t rc;
+
+	do {
+		if (len == size) {
+			char *tmp;
+
+			size = size ? size * 2 : 64 * 1024;
+			tmp = realloc(buf, size);
+			if (!tmp) {
+				free(buf);
+				errno = ENOMEM;
+				return -1;
+			}
+			buf = tmp;
+		}
+		rc = read(fd, buf + len, size - len);
+		if (rc > 0)
+			len += rc;
+	} while (rc > 0 || (rc == -1 && errno == EINTR));
+
+	if (rc == -1) {
+		int save = errno;
+
+		free(buf);
+		errno = save;
+		return -1;
+	}
+
+	*buffer = buf;
+	return len;
+}
+
+/**
+ * aa_compiled_policy_new_from_data - create a new aa_compiled_policy object from compiled policy in memory
+ * @policy: will point to the address of an allocated and initialized
+ *          aa_compiled_policy object upon success
+ * @data: one or more profiles as written by the parser
+ * @size: the size of @data
+ *
+ * @data is not referenced after this function returns.
+ *
+ * Returns: 0 on success, -1 on error with errno set and *@policy pointing to
+ *          NULL
+ */
+int aa_compiled_policy_new_from_data(aa_compiled_policy **policy,
+				     const void *data, size_t size)
+{
+	aa_compiled_policy *pol;
+
+	*policy = NULL;
+
+	pol = calloc(1, sizeof(*pol));
+	if (!pol) {
+		errno = ENOMEM;
+		return -1;
+	}
+	aa_compiled_policy_ref(pol);
+
+	if (unpack_policy(pol, data, size) == -1) {
+		aa_compiled_policy_unref(pol);
+		return -1;
+	}
+
+	*policy = pol;
+
+	return 0;
+}
+
+/**
+ * aa_compiled_policy_new_from_fd - create a new aa_compiled_policy object from an open file
+ * @policy: will point to the address of an allocated and initialized
+ *          aa_compiled_policy object upon success
+ * @fd: a pre-opened, readable file descriptor at the correct offset
+ *
+ * Returns: 0 on success, -1 on error with errno set and *@policy pointing to
+ *          NULL
+ */
+int aa_compiled_policy_new_from_fd(aa_compiled_policy **policy, int fd)
+{
+	autofree char *buffer = NULL;
+	ssize_t size;
+
+	*policy = NULL;
+
+	size = read_whole_fd(fd, &buffer);
+	if (size == -1)
+		return -1;
+
+	return aa_compiled_policy_new_from_data(policy, buffer, size);
+}
+
+/**
+ * aa_compiled_policy_new - create a new aa_compiled_policy object from a file
+ * @policy: will point to the address of an allocated and initialized
+ *          aa_compiled_policy object upon success
+ * @dirfd: directory file descriptor or AT_FDCWD (see openat(2))
+ * @path: path to a policy binary, such as a cache file
+ *
+ * Returns: 0 on success, -1 on error with errno set and *@policy pointing to
+ *          NULL
+ */
+int aa_compiled_policy_new(aa_compiled_policy **policy, int dirfd,
+			   const char *path)
+{
+	autoclose int fd = -1;
+
+	*policy = NULL;
+
+	fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	return aa_compiled_policy_new_from_fd(policy, fd);
+}
+
+/**
+ * aa_compiled_policy_ref - increments the ref count of an aa_compiled_policy object
+ * @policy: the policy
+ *
+ * Returns: the policy
+ */
+aa_compiled_policy *aa_compiled_policy_ref(aa_compiled_policy *policy)
+{
+	atomic_inc(&policy->ref_count);
+	return policy;
+}
+
+/**
+ * aa_compiled_policy_unref - decrements the ref count and frees the aa_compiled_policy object when 0
+ * @policy: the policy (can be NULL)
+ */
+void aa_compiled_policy_unref(aa_compiled_policy *policy)
+{
+	int save = errno;
+
+	if (policy && atomic_dec_and_test(&policy->ref_count)) {
+		size_t i;
+
+		for (i = 0; i < policy->count; i++)
+			free_profile(&policy->profiles[i]);
+		free(policy->profiles);
+		free(policy);
+	}
+
+	errno = save;
+}
+
+static struct compiled_profile *find_profile(aa_compiled_policy *policy,
+					     const char *ns, size_t ns_len,
+					     const char *name, size_t name_len)
+{
+	size_t lo = 0, hi = policy->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		struct compiled_profile *p = &policy->profiles[mid];
+		int res = strncmp(ns, p->ns, ns_len);
+
+		if (res == 0 && p->ns[ns_len])
+			res = -1;
+		if (res == 0) {
+			res = strncmp(name, p->name, name_len);
+			if (res == 0 && p->name[name_len])
+				res = -1;
+		}
+		if (res == 0)
+			return p;
+		if (res < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+/* old style file permissions, the layout of the file dfa's accept tables */
+#define OLD_MAY_EXEC		0x01
+#define OLD_MAY_WRITE		0x02
+#define OLD_MAY_READ		0x04
+#define OLD_MAY_APPEND		0x08
+#define OLD_MAY_LINK		0x10
+#define OLD_MAY_LOCK		0x20
+#define OLD_EXEC_MMAP		0x40
+#define OLD_OTHER_SHIFT		14
+#define OLD_CHANGE_PROFILE	0x80000000
+#define OLD_ONEXEC		0x40000000
+
+#define user_perms(X)	((X) & 0x7f)
+#define other_perms(X)	(((X) >> OLD_OTHER_SHIFT) & 0x7f)
+/* accept2 holds the audit and quiet masks packed as oq:oa:uq:ua */
+#define user_audit(X)	((X) & 0x7f)
+#define user_quiet(X)	(((X) >> 7) & 0x7f)
+#define other_audit(X)	(((X) >> 14) & 0x7f)
+#define other_quiet(X)	(((X) >> 21) & 0x7f)
+
+static uint32_t map_old_perms(uint32_t old)
+{
+	uint32_t perms = old & (OLD_MAY_EXEC | OLD_MAY_WRITE | OLD_MAY_READ |
+				OLD_MAY_APPEND);
+
+	if (old & OLD_MAY_READ)
+		perms |= AA_MAY_GETATTR | AA_MAY_OPEN;
+	if (old & OLD_MAY_WRITE)
+		perms |= AA_MAY_SETATTR | AA_MAY_CREATE | AA_MAY_DELETE |
+			AA_MAY_CHMOD | AA_MAY_CHOWN | AA_MAY_OPEN;
+	if (old & OLD_MAY_LINK)
+		perms |= AA_MAY_LINK;
+	if (old & OLD_MAY_LOCK)
+		perms |= AA_MAY_LOCK;
+	if (old & OLD_EXEC_MMAP)
+		perms |= AA_EXEC_MMAP;
+
+	return perms;
+}
+
+/* policydb permissions beyond the first 7 bits are stored in the other
+ * half of the accept tables
+ */
+static uint32_t map_other(uint32_t x)
+{
+	return ((x & 0x3) << 8) |	/* SETATTR/GETATTR */
+		((x & 0x1c) << 18) |	/* ACCEPT/BIND/LISTEN */
+		((x & 0x60) << 19);	/* SETOPT/GETOPT */
+}
+
+/* file permissions for @state, queries are answered as for the owner of
+ * the file which is what the kernel does for a query made by root
+ */
+static void compute_fperms(struct aa_dfa *dfa, unsigned int state,
+			   aa_perms *perms)
+{
+	uint32_t accept = aa_dfa_accept(dfa, state);
+	uint32_t accept2 = aa_dfa_accept2(dfa, state);
+
+	perms->allow = map_old_perms(user_perms(accept)) | AA_MAY_GETATTR;
+	perms->audit = map_old_perms(user_audit(accept2));
+	perms->quiet = map_old_perms(user_quiet(accept2));
+	if (accept & OLD_CHANGE_PROFILE)
+		perms->allow |= AA_MAY_CHANGE_PROFILE;
+	if (accept & OLD_ONEXEC)
+		perms->allow |= AA_MAY_ONEXEC;
+}
+
+static void compute_perms(struct aa_dfa *dfa, unsigned int state,
+			  aa_perms *perms)
+{
+	uint32_t accept = aa_dfa_accept(dfa, state);
+	uint32_t accept2 = aa_dfa_accept2(dfa, state);
+
+	perms->allow = user_perms(accept) | map_other(other_perms(accept));
+	perms->audit = user_audit(accept2) | map_other(other_audit(accept2));
+	perms->quiet = user_quiet(accept2) | map_other(other_quiet(accept2));
+}
+
+/**
+ * profile_query - accumulate the permissions a single profile grants
+ * @p: profile to query
+ * @query: class byte followed by the class specific query data
+ * @size: size of @query
+ * @perms: permissions accumulated so far
+ */
+static void profile_query(struct compiled_profile *p, const char *query,
+			  size_t size, aa_perms *perms)
+{
+	aa_perms tmp = { 0, 0, 0, 0 };
+	unsigned int state;
+
+	if (p->mode == PACKED_MODE_UNCONFINED)
+		return;
+
+	if ((unsigned char) *query == AA_CLASS_FILE) {
+		struct aa_dfa *dfa = p->file ? p->file : p->policydb;
+
+		if (dfa && p->file_start != DFA_NOMATCH) {
+			state = aa_dfa_match_len(dfa, p->file_start,
+						 query + 1, size - 1);
+			if (state != DFA_NOMATCH)
+				compute_fperms(dfa, state, &tmp);
+		}
+	} else if (p->policydb) {
+		/* no change to the perms if the class is not mediated */
+		if (aa_dfa_next(p->policydb, DFA_START, *query) == DFA_NOMATCH)
+			return;
+		state = aa_dfa_match_len(p->policydb, DFA_START, query, size);
+		if (state != DFA_NOMATCH)
+			compute_perms(p->policydb, state, &tmp);
+	}
+
+	/* apply the profile's audit mode */
+	if (p->audit) {
+		tmp.audit = ALL_PERMS_MASK;
+		tmp.quiet = 0;
+	}
+
+	perms->deny |= tmp.deny;
+	perms->allow &= tmp.allow & ~tmp.deny;
+	perms->audit |= tmp.audit & tmp.allow;
+	perms->quiet &= tmp.quiet & ~tmp.allow;
+}
+
+/**
+ * aa_compiled_policy_query - query the permissions a label is granted by compiled policy
+ * @policy: the policy
+ * @label: NUL terminated label, a profile name or a stack of them
+ * @query: binary query string, the class byte followed by the class
+ *         specific data, as in the query passed to aa_query_label() after
+ *         the label
+ * @size: size of @query
+ * @perms: upon successful return, the permissions granted
+ *
+ * Returns: 0 on success else -1 and sets errno. If -1 is returned and errno is
+ *          ENOENT, a profile in @label is not in @policy.
+ */
+int aa_compiled_policy_query(aa_compiled_policy *policy, const char *label,
+			     const char *query, size_t size, aa_perms *perms)
+{
+	const char *pos, *next;
+
+	if (!size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	perms->allow = ALL_PERMS_MASK;
+	perms->deny = 0;
+	perms->audit = 0;
+	perms->quiet = ALL_PERMS_MASK;
+
+	for (pos = label; pos; pos = next) {
+		struct compiled_profile *p;
+		const char *ns = "", *name = pos;
+		size_t ns_len = 0, len;
+
+		next = strstr(pos, STACK_SEP);
+		len = next ? (size_t) (next - pos) : strlen(pos);
+		if (next)
+			next += strlen(STACK_SEP);
+
+		if (*pos == ':') {
+			const char *split = memchr(pos + 1, ':', len - 1);
+
+			if (!split) {
+				errno = EINVAL;
+				return -1;
+			}
+			ns = pos + 1;
+			ns_len = split - ns;
+			name = split + 1;
+			len -= name - pos;
+		}
+
+		p = find_profile(policy, ns, ns_len, name, len);
+		if (!p) {
+			if (len == strlen(UNCONFINED) &&
+			    strncmp(name, UNCONFINED, len) == 0)
+				continue;
+			errno = ENOENT;
+			return -1;
+		}
+		profile_query(p, query, size, perms);
+	}
+
+	return 0;
+}
+
+/**
+ * aa_compiled_policy_query_file_path - query access permissions for a file @path
+ * @policy: the policy
+ * @mask: permission bits to query
+ * @label: NUL terminated label, a profile name or a stack of them
+ * @path: NUL terminated path to query permissions for
+ * @allowed: upon successful return, will be 1 if query is allowed and 0 if not
+ * @audited: upon successful return, will be 1 if query should be audited and 0
+ *           if not
+ *
+ * The userspace equivalent of aa_query_file_path().
+ *
+ * Returns: 0 on success else -1 and sets errno. If -1 is returned and errno is
+ *          ENOENT, a profile in @label is not in @policy.
+ */
+int aa_compiled_policy_query_file_path(aa_compiled_policy *policy,
+				       uint32_t mask, const char *label,
+				       const char *path, int *allowed,
+				       int *audited)
+{
+	size_t path_len = strlen(path);
+	autofree char *query = NULL;
+	uint32_t audit;
+	aa_perms perms;
+
+	if (!mask) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	query = malloc(path_len + 1);
+	if (!query) {
+		errno = ENOMEM;
+		return -1;
+	}
+	query[0] = AA_CLASS_FILE;
+	memcpy(query + 1, path, path_len);
+
+	if (aa_compiled_policy_query(policy, label, query, path_len + 1,
+				     &perms) == -1)
+		return -1;
+
+	*allowed = mask & ~(perms.allow & ~perms.deny) ? 0 : 1;
+	audit = *allowed ? perms.audit : ALL_PERMS_MASK;
+	*audited = mask & ~(audit & ~perms.quiet) ? 0 : 1;
+
+	return 0;
+}
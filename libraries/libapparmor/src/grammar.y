@@ -26,6 +26,8 @@
  *   parse.trace
  */
 #define YYDEBUG 0
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <aalogparse.h>
 #include "parser.h"
@@ -41,12 +43,31 @@
 #define no_debug_unused_ unused_
 #endif
 
-aa_log_record *ret_record;
+/* everything about the record being parsed hangs off the scanner, so
+ * records can be parsed by several threads at once
+ */
+#define PARSE_CTX	aalogparse_get_extra(scanner)
+#define ret_record	(PARSE_CTX->record)
+
+/* once a string could not be allocated, which for parse_record_r() means
+ * the caller's buffer is full, hand the grammar an error token in place
+ * of a token with a NULL value, so the parse stops there
+ */
+static int checked_lex(YYSTYPE *lvalp, void *scanner)
+{
+	int token = aalogparse_lex(lvalp, scanner);
+
+	if (PARSE_CTX->alloc_failed)
+		return TOK_ALLOC_FAILED;
+	return token;
+}
+#undef yylex
+#define yylex checked_lex
 
 /* Since we're a library, on any errors we don't want to print out any
  * error messages. We should probably add a debug interface that does
  * emit messages when asked for. */
-void aalogparse_error(unused_ void *scanner, no_debug_unused_ char const *s)
+void aalogparse_error(void *scanner, no_debug_unused_ char const *s)
 {
 #if (YYDEBUG != 0)
 	printf("ERROR: %s\n", s);
@@ -189,10 +210,13 @@ aa_record_event_type lookup_aa_event(unsigned int type)
 %token TOK_SYSLOG_KERNEL
 %token TOK_SYSLOG_USER
 
-%destructor { free($$); } TOK_QUOTED_STRING TOK_ID TOK_MODE TOK_DMESG_STAMP
-%destructor { free($$); } TOK_AUDIT_DIGITS TOK_DATE_MONTH TOK_DATE TOK_TIME
-%destructor { free($$); } TOK_HEXSTRING TOK_TYPE_OTHER TOK_MSG_REST
-%destructor { free($$); } TOK_IP_ADDR
+/* returned by checked_lex(), not matched by any rule */
+%token TOK_ALLOC_FAILED
+
+%destructor { _aa_log_free(PARSE_CTX, $$); } TOK_QUOTED_STRING TOK_ID TOK_MODE TOK_DMESG_STAMP
+%destructor { _aa_log_free(PARSE_CTX, $$); } TOK_AUDIT_DIGITS TOK_DATE_MONTH TOK_DATE TOK_TIME
+%destructor { _aa_log_free(PARSE_CTX, $$); } TOK_HEXSTRING TOK_TYPE_OTHER TOK_MSG_REST
+%destructor { _aa_log_free(PARSE_CTX, $$); } TOK_IP_ADDR
 
 %%
 
@@ -229,29 +253,29 @@ other_audit: TOK_TYPE_OTHER audit_msg TOK_MSG_REST
 	;
 
 dmesg_type: TOK_DMESG_STAMP TOK_AUDIT TOK_COLON key_type audit_id key_list
-	{ ret_record->version = AA_RECORD_SYNTAX_V2; free($1); }
+	{ ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $1); }
 	;
 
 syslog_type:
 	  syslog_date TOK_ID TOK_SYSLOG_KERNEL audit_id key_list
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); }
 	| syslog_date TOK_ID TOK_SYSLOG_KERNEL key_type audit_id key_list
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); }
 	| syslog_date TOK_ID TOK_SYSLOG_KERNEL TOK_DMESG_STAMP audit_id key_list
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); free($4); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); _aa_log_free(PARSE_CTX, $4); }
 	| syslog_date TOK_ID TOK_SYSLOG_KERNEL TOK_DMESG_STAMP key_type audit_id key_list
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); free($4); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); _aa_log_free(PARSE_CTX, $4); }
 	/* needs update: hard newline in handling mutiline log messages */
 	| syslog_date TOK_ID TOK_SYSLOG_KERNEL TOK_DMESG_STAMP TOK_AUDIT TOK_COLON key_type audit_id audit_user_msg_partial_tail
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); }
 	| syslog_date TOK_ID TOK_SYSLOG_KERNEL TOK_DMESG_STAMP TOK_AUDIT TOK_COLON key_type audit_id audit_user_msg_tail
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); }
 	| syslog_date TOK_ID TOK_SYSLOG_KERNEL TOK_DMESG_STAMP TOK_AUDIT TOK_COLON key_type audit_id key_list
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); free($4); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); _aa_log_free(PARSE_CTX, $4); }
 	| syslog_date TOK_ID TOK_SYSLOG_KERNEL TOK_AUDIT TOK_COLON key_type audit_id key_list
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); }
 	| syslog_date TOK_ID TOK_SYSLOG_USER key_list
-	  { ret_record->version = AA_RECORD_SYNTAX_V2; free($2); }
+	  { ret_record->version = AA_RECORD_SYNTAX_V2; _aa_log_free(PARSE_CTX, $2); }
 	;
 
 /* when audit dispatches a message it doesn't prepend the audit type string */
@@ -273,19 +297,23 @@ audit_user_msg: TOK_KEY_MSG TOK_EQUALS audit_id audit_user_msg_tail
 
 audit_id: TOK_AUDIT TOK_OPEN_PAREN TOK_AUDIT_DIGITS TOK_PERIOD TOK_AUDIT_DIGITS TOK_COLON TOK_AUDIT_DIGITS TOK_CLOSE_PAREN TOK_COLON
 	{
-		if (!asprintf(&ret_record->audit_id, "%s.%s:%s", $3, $5, $7))
+		ret_record->audit_id = _aa_log_printf(PARSE_CTX, "%s.%s:%s",
+						      $3, $5, $7);
+		if (!ret_record->audit_id) {
 			yyerror(scanner, YY_("Out of memory"));
+			YYABORT;
+		}
 		ret_record->epoch = atol($3);
 		ret_record->audit_sub_id = atoi($7);
-		free($3);
-		free($5);
-		free($7);
+		_aa_log_free(PARSE_CTX, $3);
+		_aa_log_free(PARSE_CTX, $5);
+		_aa_log_free(PARSE_CTX, $7);
 	} ;
 
 syslog_date: TOK_DATE_MONTH TOK_DIGITS TOK_TIME
-		{ free($1); free($3); /* do nothing */ }
+		{ _aa_log_free(PARSE_CTX, $1); _aa_log_free(PARSE_CTX, $3); /* do nothing */ }
 	| TOK_DATE TOK_TIME
-		{ free($1); free($2); /* do nothing */ }
+		{ _aa_log_free(PARSE_CTX, $1); _aa_log_free(PARSE_CTX, $2); /* do nothing */ }
 	;
 
 key_list: key
@@ -349,24 +377,24 @@ key: TOK_KEY_OPERATION TOK_EQUALS TOK_QUOTED_STRING
 	| TOK_KEY_SAUID TOK_EQUALS TOK_DIGITS
 	{ /* Ignore - Source audit ID from user AVC messages */ }
 	| TOK_KEY_HOSTNAME TOK_EQUALS safe_string
-	{ free($3); /* Ignore - hostname from user AVC messages */ }
+	{ _aa_log_free(PARSE_CTX, $3); /* Ignore - hostname from user AVC messages */ }
 	| TOK_KEY_HOSTNAME TOK_EQUALS TOK_QUESTION_MARK
 	| TOK_KEY_ADDR TOK_EQUALS TOK_QUESTION_MARK
 	| TOK_KEY_TERMINAL TOK_EQUALS TOK_QUESTION_MARK
 	| TOK_KEY_ADDR TOK_EQUALS safe_string
-	{ free($3); /* Ignore - IP address from user AVC messages */ }
+	{ _aa_log_free(PARSE_CTX, $3); /* Ignore - IP address from user AVC messages */ }
 	| TOK_KEY_TERMINAL TOK_EQUALS safe_string
-	{ free($3); /* Ignore - TTY from user AVC messages */ }
+	{ _aa_log_free(PARSE_CTX, $3); /* Ignore - TTY from user AVC messages */ }
 	| TOK_KEY_EXE TOK_EQUALS safe_string
 	{ /* Free existing arrays because exe= and comm= maps to the same
 	     aa_log_record member */
-	  free(ret_record->comm);
+	  _aa_log_free(PARSE_CTX, ret_record->comm);
 	  ret_record->comm = $3;
 	}
 	| TOK_KEY_COMM TOK_EQUALS safe_string
 	{ /* Free existing arrays because exe= and comm= maps to the same
 	     aa_log_record member */
-	  free(ret_record->comm);
+	  _aa_log_free(PARSE_CTX, ret_record->comm);
 	  ret_record->comm = $3;
 	}
 	| TOK_KEY_APPARMOR TOK_EQUALS apparmor_event
@@ -452,35 +480,129 @@ safe_string: TOK_QUOTED_STRING
 protocol: TOK_QUOTED_STRING
 	| TOK_DIGITS
 	{ /* FIXME: this should probably convert back to a string proto name */
-	  $$ = ipproto_to_string($1);
+	  $$ = _aa_log_ipproto_to_string(PARSE_CTX, $1);
+	  if (!$$) {
+		yyerror(scanner, YY_("Out of memory"));
+		YYABORT;
+	  }
 	}
 	;
 %%
 
-aa_log_record *
-_parse_yacc(char *str)
-{
-	/* yydebug = 1;  */
-	YY_BUFFER_STATE lex_buf;
+struct aa_log_parse_state {
 	yyscan_t scanner;
+	struct aa_log_parse_ctx ctx;
+};
 
-	ret_record = NULL;
-	ret_record = malloc(sizeof(aa_log_record));
-
-	_init_log_record(ret_record);
+static void parse_line(yyscan_t scanner, const char *str,
+		       aa_log_record *record)
+{
+	struct aa_log_parse_ctx *ctx = aalogparse_get_extra(scanner);
 
-	if (ret_record == NULL)
-		return NULL;
+	_init_log_record(record);
+	ctx->record = record;
+	ctx->input = str;
+	ctx->input_len = strlen(str);
+	ctx->input_pos = 0;
+	ctx->restart = true;
+	ctx->alloc_failed = false;
 
 #if (YYDEBUG != 0)
 	yydebug = 1;
 #endif
 
-	aalogparse_lex_init(&scanner);
-	lex_buf = aalogparse__scan_string(str, scanner);
+	aalogparse_restart(NULL, scanner);
 	/* Ignore return value to return an AA_RECORD_INVALID event */
 	(void)aalogparse_parse(scanner);
-	aalogparse__delete_buffer(lex_buf, scanner);
+}
+
+aa_log_record *
+_parse_yacc(char *str)
+{
+	/* yydebug = 1;  */
+	struct aa_log_parse_ctx ctx;
+	aa_log_record *record;
+	yyscan_t scanner;
+
+	record = malloc(sizeof(aa_log_record));
+	if (record == NULL)
+		return NULL;
+
+	memset(&ctx, 0, sizeof(ctx));
+	if (aalogparse_lex_init_extra(&ctx, &scanner)) {
+		free(record);
+		return NULL;
+	}
+	parse_line(scanner, str, record);
 	aalogparse_lex_destroy(scanner);
-	return ret_record;
+	free(ctx.string_buf);
+
+	return record;
+}
+
+aa_log_parse_state *
+_parse_state_new(void)
+{
+	aa_log_parse_state *state;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	if (aalogparse_lex_init_extra(&state->ctx, &state->scanner)) {
+		free(state);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return state;
+}
+
+void
+_parse_state_free(aa_log_parse_state *state)
+{
+	if (state == NULL)
+		return;
+
+	aalogparse_lex_destroy(state->scanner);
+	free(state->ctx.string_buf);
+	free(state);
+}
+
+int
+_parse_yacc_r(aa_log_parse_state *state, const char *str,
+	      aa_log_record *record, char *buf, size_t buflen, size_t *used)
+{
+	aa_log_parse_state *tmp = NULL;
+	struct aa_log_parse_ctx *ctx;
+	bool full;
+
+	if (state == NULL) {
+		state = tmp = _parse_state_new();
+		if (state == NULL)
+			return -1;
+	}
+
+	ctx = &state->ctx;
+	ctx->use_arena = true;
+	ctx->arena = buf;
+	ctx->arena_size = buflen;
+	ctx->arena_used = ctx->arena_last = 0;
+	ctx->arena_full = false;
+
+	parse_line(state->scanner, str, record);
+
+	full = ctx->arena_full;
+	if (used)
+		*used = ctx->arena_used;
+	ctx->use_arena = false;
+	ctx->arena = NULL;
+	_parse_state_free(tmp);
+
+	if (full) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	return 0;
 }
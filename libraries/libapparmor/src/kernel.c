@@ -1138,30 +1138,86 @@ static void aafs_access_init_once(void)
 /* "allow 0x00000000\ndeny 0x00000000\naudit 0x00000000\nquiet 0x00000000\n" */
 #define QUERY_LABEL_REPLY_LEN	67
 
+static inline int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;	/* lower case */
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* parse "@name 0x%08x\n" at *@pos, and move *@pos past it */
+static bool parse_reply_field(const char **pos, const char *end,
+			      const char *name, size_t name_len,
+			      uint32_t *value)
+{
+	const char *p = *pos;
+	uint32_t v = 0;
+	int i, digit;
+
+	if ((size_t) (end - p) < name_len + 12 ||
+	    memcmp(p, name, name_len) != 0)
+		return false;
+	p += name_len;
+	if (p[0] != ' ' || p[1] != '0' || p[2] != 'x')
+		return false;
+	p += 3;
+	for (i = 0; i < 8; i++) {
+		digit = hex_value(p[i]);
+		if (digit < 0)
+			return false;
+		v = (v << 4) | digit;
+	}
+	if (p[8] != '\n')
+		return false;
+
+	*value = v;
+	*pos = p + 9;
+	return true;
+}
+
 /**
- * aa_query_label - query the access(es) of a label
- * @mask: permission bits to query
- * @query: binary query string, must be offset by AA_QUERY_CMD_LABEL_SIZE
- * @size: size of the query string must include AA_QUERY_CMD_LABEL_SIZE
- * @allowed: upon successful return, will be 1 if query is allowed and 0 if not
- * @audited: upon successful return, will be 1 if query should be audited and 0
- *           if not
+ * parse_query_reply - parse the kernel's reply to a label query
+ * @buf: the reply
+ * @len: length of @buf
+ * @mask: permission bits that were queried
+ * @allowed: upon successful return, will be 1 if @mask is allowed and 0 if not
+ * @audited: upon successful return, will be 1 if @mask should be audited and
+ *           0 if not
  *
- * Returns: 0 on success else -1 and sets errno. If -1 is returned and errno is
- *          ENOENT, the subject label in the query string is unknown to the
- *          kernel.
+ * The reply is read for every query, so it is parsed by hand instead of
+ * with sscanf().
+ *
+ * Returns: 0 on success else -1 and sets errno
  */
-int query_label(uint32_t mask, char *query, size_t size, int *allowed,
-		int *audited)
+static int parse_query_reply(const char *buf, size_t len, uint32_t mask,
+			     int *allowed, int *audited)
 {
-	char buf[QUERY_LABEL_REPLY_LEN];
+	const char *pos = buf, *end = buf + len;
 	uint32_t allow, deny, audit, quiet;
-	int fd, ret, saved;
 
-	if (!mask || size <= AA_QUERY_CMD_LABEL_SIZE) {
-		errno = EINVAL;
+#define FIELD(NAME, VALUE) \
+	parse_reply_field(&pos, end, NAME, sizeof(NAME) - 1, VALUE)
+	if (!FIELD("allow", &allow) || !FIELD("deny", &deny) ||
+	    !FIELD("audit", &audit) || !FIELD("quiet", &quiet)) {
+		errno = EPROTONOSUPPORT;
 		return -1;
 	}
+#undef FIELD
+
+	*allowed = mask & ~(allow & ~deny) ? 0 : 1;
+	if (!(*allowed))
+		audit = 0xFFFFFFFF;
+	*audited = mask & ~(audit & ~quiet) ? 0 : 1;
+
+	return 0;
+}
+
+static int open_query_fd(void)
+{
+	int fd, ret;
 
 	ret = pthread_once(&aafs_access_control, aafs_access_init_once);
 	if (ret) {
@@ -1172,16 +1228,37 @@ int query_label(uint32_t mask, char *query, size_t size, int *allowed,
 		return -1;
 	}
 
-	fd = open(aafs_access, O_RDWR);
-	if (fd == -1) {
-		if (errno == ENOENT)
-			errno = EPROTONOSUPPORT;
+	fd = open(aafs_access, O_RDWR | O_CLOEXEC);
+	if (fd == -1 && errno == ENOENT)
+		errno = EPROTONOSUPPORT;
+
+	return fd;
+}
+
+/**
+ * query_fd - make a label query on an open .access file
+ * @fd: the .access file
+ *
+ * The rest of the arguments and the return value are those of query_label.
+ *
+ * The kernel keeps the reply to the last query written to the file, and
+ * only accepts queries written at the start of the file, so queries and
+ * replies are written and read at offset 0 to be able to reuse @fd.
+ */
+static int query_fd(int fd, uint32_t mask, char *query, size_t size,
+		    int *allowed, int *audited)
+{
+	char buf[QUERY_LABEL_REPLY_LEN];
+	int ret;
+
+	if (!mask || size <= AA_QUERY_CMD_LABEL_SIZE) {
+		errno = EINVAL;
 		return -1;
 	}
 
 	memcpy(query, AA_QUERY_CMD_LABEL, AA_QUERY_CMD_LABEL_SIZE);
 	errno = 0;
-	ret = write(fd, query, size);
+	ret = pwrite(fd, query, size, 0);
 	if (ret < 0 || ((size_t) ret != size)) {
 		if (ret >= 0)
 			errno = EPROTO;
@@ -1189,35 +1266,52 @@ int query_label(uint32_t mask, char *query, size_t size, int *allowed,
 		 * errno set to ENOENT. It indicates that the subject label
 		 * could not be found by the kernel.
 		 */
-		(void)close(fd);
 		return -1;
 	}
 
-	ret = read(fd, buf, QUERY_LABEL_REPLY_LEN);
-	saved = errno;
-	(void)close(fd);
-	errno = saved;
+	ret = pread(fd, buf, QUERY_LABEL_REPLY_LEN, 0);
 	if (ret != QUERY_LABEL_REPLY_LEN) {
 		errno = EPROTO;
 		return -1;
 	}
 
-	ret = sscanf(buf, "allow 0x%8" SCNx32 "\n"
-			  "deny 0x%8"  SCNx32 "\n"
-			  "audit 0x%8" SCNx32 "\n"
-			  "quiet 0x%8" SCNx32 "\n",
-		     &allow, &deny, &audit, &quiet);
-	if (ret != 4) {
-		errno = EPROTONOSUPPORT;
+	return parse_query_reply(buf, QUERY_LABEL_REPLY_LEN, mask, allowed,
+				 audited);
+}
+
+/**
+ * aa_query_label - query the access(es) of a label
+ * @mask: permission bits to query
+ * @query: binary query string, must be offset by AA_QUERY_CMD_LABEL_SIZE
+ * @size: size of the query string must include AA_QUERY_CMD_LABEL_SIZE
+ * @allowed: upon successful return, will be 1 if query is allowed and 0 if not
+ * @audited: upon successful return, will be 1 if query should be audited and 0
+ *           if not
+ *
+ * Returns: 0 on success else -1 and sets errno. If -1 is returned and errno is
+ *          ENOENT, the subject label in the query string is unknown to the
+ *          kernel.
+ */
+int query_label(uint32_t mask, char *query, size_t size, int *allowed,
+		int *audited)
+{
+	int fd, ret, saved;
+
+	if (!mask || size <= AA_QUERY_CMD_LABEL_SIZE) {
+		errno = EINVAL;
 		return -1;
 	}
 
-	*allowed = mask & ~(allow & ~deny) ? 0 : 1;
-	if (!(*allowed))
-		audit = 0xFFFFFFFF;
-	*audited = mask & ~(audit & ~quiet) ? 0 : 1;
+	fd = open_query_fd();
+	if (fd == -1)
+		return -1;
 
-	return 0;
+	ret = query_fd(fd, mask, query, size, allowed, audited);
+	saved = errno;
+	(void)close(fd);
+	errno = saved;
+
+	return ret;
 }
 
 /* export multiple aa_query_label symbols to compensate for downstream
@@ -1226,6 +1320,147 @@ extern typeof((query_label)) __aa_query_label __attribute__((alias ("query_label
 symbol_version(__aa_query_label, aa_query_label, APPARMOR_1.1);
 default_symbol_version(query_label, aa_query_label, APPARMOR_2.9);
 
+struct aa_query_ctx {
+	unsigned int ref_count;
+	pthread_mutex_t lock;	/* a query is a write and read of fd */
+	int fd;
+};
+
+/**
+ * aa_query_ctx_new - create a new aa_query_ctx object
+ * @ctx: will point to the address of an allocated and initialized
+ *       aa_query_ctx object upon success
+ *
+ * The context keeps the kernel's query interface open, so that queries
+ * made with it do not have to open and close it every time.
+ *
+ * Returns: 0 on success, -1 on error with errno set and *@ctx pointing to
+ *          NULL
+ */
+int aa_query_ctx_new(aa_query_ctx **ctx)
+{
+	aa_query_ctx *c;
+	int fd;
+
+	*ctx = NULL;
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	fd = open_query_fd();
+	if (fd == -1) {
+		int save = errno;
+
+		free(c);
+		errno = save;
+		return -1;
+	}
+
+	aa_query_ctx_ref(c);
+	pthread_mutex_init(&c->lock, NULL);
+	c->fd = fd;
+	*ctx = c;
+
+	return 0;
+}
+
+/**
+ * aa_query_ctx_ref - increments the ref count of an aa_query_ctx object
+ * @ctx: the query context
+ *
+ * Returns: the query context
+ */
+aa_query_ctx *aa_query_ctx_ref(aa_query_ctx *ctx)
+{
+	atomic_inc(&ctx->ref_count);
+	return ctx;
+}
+
+/**
+ * aa_query_ctx_unref - decrements the ref count and frees the aa_query_ctx object when 0
+ * @ctx: the query context (can be NULL)
+ */
+void aa_query_ctx_unref(aa_query_ctx *ctx)
+{
+	int save = errno;
+
+	if (ctx && atomic_dec_and_test(&ctx->ref_count)) {
+		close(ctx->fd);
+		pthread_mutex_destroy(&ctx->lock);
+		free(ctx);
+	}
+
+	errno = save;
+}
+
+/**
+ * aa_query_ctx_label - query the access(es) of a label through a context
+ * @ctx: the query context
+ *
+ * The rest of the arguments and the return value are those of
+ * aa_query_label.
+ *
+ * Queries on the same context are made one at a time, so threads making
+ * many queries should each use their own context.
+ */
+int aa_query_ctx_label(aa_query_ctx *ctx, uint32_t mask, char *query,
+		       size_t size, int *allowed, int *audited)
+{
+	int ret, saved;
+
+	pthread_mutex_lock(&ctx->lock);
+	ret = query_fd(ctx->fd, mask, query, size, allowed, audited);
+	saved = errno;
+	pthread_mutex_unlock(&ctx->lock);
+	errno = saved;
+
+	return ret;
+}
+
+/**
+ * aa_query_ctx_labels - make a number of label queries through a context
+ * @ctx: the query context
+ * @queries: the queries to make
+ * @count: the number of queries in @queries
+ *
+ * Every query is made, even if some fail. The result of each query is set
+ * in its allowed and audited members, or its error member is set to the
+ * errno the query failed with.
+ *
+ * Returns: 0 if all queries succeeded, else -1 with errno set to the error
+ *          of the first query that failed
+ */
+int aa_query_ctx_labels(aa_query_ctx *ctx, aa_label_query *queries,
+			size_t count)
+{
+	int error = 0;
+	size_t i;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (i = 0; i < count; i++) {
+		aa_label_query *q = &queries[i];
+
+		q->error = 0;
+		if (query_fd(ctx->fd, q->mask, q->query, q->size,
+			     &q->allowed, &q->audited) == -1) {
+			q->error = errno;
+			if (!error)
+				error = errno;
+		}
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
 
 /**
  * aa_query_file_path_len - query access permissions for a file @path
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -150,16 +151,57 @@ static int write_policy_buffer_to_iface(aa_kernel_interface *kernel_interface,
 				   buffer, size);
 }
 
-static int write_policy_fd_to_iface(aa_kernel_interface *kernel_interface,
-				    const char *iface_file, int fd)
+/**
+ * map_policy_fd - map the remainder of a policy file
+ * @fd: file positioned at the start of the policy
+ * @map: RETURNs: start of the mapping
+ * @map_size: RETURNs: size of the mapping
+ * @buffer: RETURNs: start of the policy within the mapping
+ * @size: RETURNs: size of the policy
+ *
+ * Writing straight from the page cache avoids reading the policy into a
+ * buffer first, the kernel copies it once when it is written.  The
+ * interface files only accept a profile (or set of profiles) in a single
+ * write, so splice() and sendfile(), which write a page at a time, can not
+ * be used.
+ *
+ * Returns: 0 on success, -1 if @fd can not be mapped
+ */
+static int map_policy_fd(int fd, void **map, size_t *map_size,
+			 const char **buffer, size_t *size)
 {
-	autofree char *buffer = NULL;
-	int size = 0, asize = 0, rsize;
+	struct stat st;
+	off_t pos, start;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+		return -1;
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos == -1 || pos >= st.st_size)
+		return -1;
+
+	/* the mapping has to start on a page boundary */
+	start = pos & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+	*map_size = st.st_size - start;
+	*map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+		    fd, start);
+	if (*map == MAP_FAILED)
+		return -1;
+	*buffer = (const char *) *map + (pos - start);
+	*size = st.st_size - pos;
+
+	return 0;
+}
+
+static int read_policy_fd(int fd, char **buffer, int *size)
+{
+	int asize = 0, rsize;
 	int chunksize = 1 << 14;
 
+	*buffer = NULL;
+	*size = 0;
 	do {
-		if (asize - size == 0) {
-			char *tmp = realloc(buffer, chunksize);
+		if (asize - *size == 0) {
+			char *tmp = realloc(*buffer, chunksize);
 
 			asize = chunksize;
 			chunksize <<= 1;
@@ -167,19 +209,95 @@ static int write_policy_fd_to_iface(aa_kernel_interface *kernel_interface,
 				errno = ENOMEM;
 				return -1;
 			}
-			buffer = tmp;
+			*buffer = tmp;
 		}
 
-		rsize = read(fd, buffer + size, asize - size);
+		rsize = read(fd, *buffer + *size, asize - *size);
 		if (rsize)
-			size += rsize;
+			*size += rsize;
 	} while (rsize > 0);
 
 	if (rsize == -1)
 		return -1;
 
-	return write_policy_buffer_to_iface(kernel_interface, iface_file,
-					    buffer, size);
+	return 0;
+}
+
+/**
+ * write_policy_fd - write the policy in a file to an interface file
+ * @iface_fd: open interface file to write to
+ * @atomic: whether to load all policy in the file atomically
+ * @fd: file positioned at the start of the policy
+ *
+ * Regular files are mapped and written without copying them into a
+ * buffer, anything else (pipes, or files that can not be mapped) is read
+ * into a buffer first.  Either way @fd is left at the end of the file.
+ *
+ * Returns: 0 on success, -1 on error with errno set
+ */
+static int write_policy_fd(int iface_fd, int atomic, int fd)
+{
+	autofree char *buffer = NULL;
+	const char *policy;
+	void *map;
+	size_t map_size, size;
+	int rc, rsize, save;
+
+	if (map_policy_fd(fd, &map, &map_size, &policy, &size) == 0) {
+		rc = write_policy_buffer(iface_fd, atomic, policy, size);
+		save = errno;
+		munmap(map, map_size);
+		lseek(fd, 0, SEEK_END);
+		errno = save;
+		return rc;
+	}
+
+	if (read_policy_fd(fd, &buffer, &rsize) == -1)
+		return -1;
+
+	return write_policy_buffer(iface_fd, atomic, buffer, rsize);
+}
+
+static int write_policy_fd_to_iface(aa_kernel_interface *kernel_interface,
+				    const char *iface_file, int fd)
+{
+	autoclose int iface_fd = -1;
+
+	iface_fd = openat(kernel_interface->dirfd, iface_file,
+			  O_WRONLY | O_CLOEXEC);
+	if (iface_fd == -1)
+		return -1;
+
+	return write_policy_fd(iface_fd, kernel_interface->supports_setload,
+			       fd);
+}
+
+static int write_policy_fds_to_iface(aa_kernel_interface *kernel_interface,
+				     const char *iface_file,
+				     const int *fds, size_t count)
+{
+	autoclose int iface_fd = -1;
+	int error = 0;
+	size_t i;
+
+	iface_fd = openat(kernel_interface->dirfd, iface_file,
+			  O_WRONLY | O_CLOEXEC);
+	if (iface_fd == -1)
+		return -1;
+
+	/* one bad policy file should not keep the rest from loading */
+	for (i = 0; i < count; i++) {
+		if (write_policy_fd(iface_fd, kernel_interface->supports_setload,
+				    fds[i]) == -1 && !error)
+			error = errno;
+	}
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
 }
 
 static int write_policy_file_to_iface(aa_kernel_interface *kernel_interface,
@@ -329,6 +447,24 @@ int aa_kernel_interface_load_policy_from_fd(aa_kernel_interface *kernel_interfac
 					fd);
 }
 
+/**
+ * aa_kernel_interface_load_policy_from_fds - load policies from a list of file descriptors into the kernel
+ * @kernel_interface: valid aa_kernel_interface
+ * @fds: pre-opened, readable file descriptors at the correct offset
+ * @count: the number of file descriptors in @fds
+ *
+ * All of the files are loaded, even if loading one of them fails.
+ *
+ * Returns: 0 on success, -1 on error with errno set to the error of the
+ *          first file that failed to load
+ */
+int aa_kernel_interface_load_policy_from_fds(aa_kernel_interface *kernel_interface,
+					     const int *fds, size_t count)
+{
+	return write_policy_fds_to_iface(kernel_interface, AA_IFACE_FILE_LOAD,
+					 fds, count);
+}
+
 /**
  * aa_kernel_interface_replace_policy - replace a policy in the kernel with a policy from a buffer
  * @kernel_interface: valid aa_kernel_interface
@@ -373,6 +509,24 @@ int aa_kernel_interface_replace_policy_from_fd(aa_kernel_interface *kernel_inter
 					fd);
 }
 
+/**
+ * aa_kernel_interface_replace_policy_from_fds - replace policies in the kernel with policies from a list of file descriptors
+ * @kernel_interface: valid aa_kernel_interface
+ * @fds: pre-opened, readable file descriptors at the correct offset
+ * @count: the number of file descriptors in @fds
+ *
+ * All of the files are replaced, even if replacing one of them fails.
+ *
+ * Returns: 0 on success, -1 on error with errno set to the error of the
+ *          first file that failed to be replaced
+ */
+int aa_kernel_interface_replace_policy_from_fds(aa_kernel_interface *kernel_interface,
+						const int *fds, size_t count)
+{
+	return write_policy_fds_to_iface(kernel_interface,
+					 AA_IFACE_FILE_REPLACE, fds, count);
+}
+
 /**
  * aa_kernel_interface_remove_policy - remove a policy from the kernel
  * @kernel_interface: valid aa_kernel_interface
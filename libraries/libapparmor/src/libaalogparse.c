@@ -27,6 +27,8 @@
  */
 
 
+#include <errno.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -43,6 +45,27 @@ aa_log_record *parse_record(char *str)
 	return _parse_yacc(str);
 }
 
+int parse_record_r(aa_log_parse_state *state, const char *str,
+		   aa_log_record *record, char *buf, size_t buflen)
+{
+	if (str == NULL || record == NULL || buf == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return _parse_yacc_r(state, str, record, buf, buflen, NULL);
+}
+
+aa_log_parse_state *aa_log_parse_state_new(void)
+{
+	return _parse_state_new();
+}
+
+void aa_log_parse_state_free(aa_log_parse_state *state)
+{
+	_parse_state_free(state);
+}
+
 void free_record(aa_log_record *record)
 {
 	if (record != NULL)
@@ -165,18 +188,25 @@ static struct ipproto_pairs ipproto_mappings[] = {
 	{0, NULL}
 };
 
-/* convert an ip protocol number to a string */
-char *ipproto_to_string(unsigned int proto)
+static const char *ipproto_name(unsigned int proto)
 {
-	char *ret = NULL;
 	struct ipproto_pairs *current = ipproto_mappings;
 
 	while (current->protocol != proto && current->protocol_name != NULL) {
 		current++;
 	}
 
-	if (current->protocol_name) {
-		ret = strdup(current->protocol_name);
+	return current->protocol_name;
+}
+
+/* convert an ip protocol number to a string */
+char *ipproto_to_string(unsigned int proto)
+{
+	char *ret = NULL;
+	const char *name = ipproto_name(proto);
+
+	if (name) {
+		ret = strdup(name);
 	} else {
 		if (!asprintf(&ret, "unknown(%u)", proto))
 			ret = NULL;
@@ -185,3 +215,136 @@ char *ipproto_to_string(unsigned int proto)
 	return ret;
 }
 
+/*
+ * Allocation of the strings of a record being parsed.  parse_record()
+ * malloc()s them, as free_record() expects, parse_record_r() carves them
+ * out of the caller's buffer in the order they are scanned.
+ */
+static char *ctx_alloc(struct aa_log_parse_ctx *ctx, size_t size)
+{
+	char *ret;
+
+	if (!ctx->use_arena) {
+		ret = malloc(size);
+		if (!ret)
+			ctx->alloc_failed = true;
+		return ret;
+	}
+
+	if (ctx->arena_size - ctx->arena_used < size) {
+		ctx->arena_full = ctx->alloc_failed = true;
+		return NULL;
+	}
+	ret = ctx->arena + ctx->arena_used;
+	ctx->arena_last = ctx->arena_used;
+	ctx->arena_used += size;
+
+	return ret;
+}
+
+char *_aa_log_strndup(struct aa_log_parse_ctx *ctx, const char *str,
+		      size_t len)
+{
+	char *ret = ctx_alloc(ctx, len + 1);
+
+	if (ret) {
+		memcpy(ret, str, len);
+		ret[len] = '\0';
+	}
+
+	return ret;
+}
+
+char *_aa_log_strdup(struct aa_log_parse_ctx *ctx, const char *str)
+{
+	return _aa_log_strndup(ctx, str, strlen(str));
+}
+
+char *_aa_log_printf(struct aa_log_parse_ctx *ctx, const char *fmt, ...)
+{
+	va_list args;
+	char *ret;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	if (len < 0)
+		return NULL;
+
+	ret = ctx_alloc(ctx, len + 1);
+	if (ret) {
+		va_start(args, fmt);
+		vsnprintf(ret, len + 1, fmt, args);
+		va_end(args);
+	}
+
+	return ret;
+}
+
+/* strings in the arena are only given back if nothing was carved out
+ * after them, which covers the tokens the grammar drops right away
+ */
+void _aa_log_free(struct aa_log_parse_ctx *ctx, char *str)
+{
+	if (!ctx->use_arena)
+		free(str);
+	else if (str && str == ctx->arena + ctx->arena_last)
+		ctx->arena_used = ctx->arena_last;
+}
+
+static unsigned char hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return 0;
+}
+
+char *_aa_log_hex_to_string(struct aa_log_parse_ctx *ctx,
+			    const char *hexstring, size_t len)
+{
+	char *ret;
+	size_t i;
+
+	len /= 2;
+	ret = ctx_alloc(ctx, len + 1);
+	if (!ret)
+		return NULL;
+
+	for (i = 0; i < len; i++)
+		ret[i] = hex_value(hexstring[2 * i]) << 4 |
+			 hex_value(hexstring[2 * i + 1]);
+	ret[len] = '\0';
+
+	return ret;
+}
+
+char *_aa_log_ipproto_to_string(struct aa_log_parse_ctx *ctx,
+				unsigned int proto)
+{
+	const char *name = ipproto_name(proto);
+
+	if (name)
+		return _aa_log_strdup(ctx, name);
+
+	return _aa_log_printf(ctx, "unknown(%u)", proto);
+}
+
+/* feed the scanner the line being parsed, in place of stdio */
+size_t _aa_log_input(struct aa_log_parse_ctx *ctx, char *buf,
+		     size_t max_size)
+{
+	size_t len = ctx->input_len - ctx->input_pos;
+
+	if (len > max_size)
+		len = max_size;
+	memcpy(buf, ctx->input + ctx->input_pos, len);
+	ctx->input_pos += len;
+
+	return len;
+}
+
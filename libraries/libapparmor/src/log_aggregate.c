@@ -0,0 +1,538 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Aggregation of logged events.
+ *
+ * Generating profiles from logs only needs to know which events were
+ * logged, not every time they were, and on a busy system the same
+ * denial is logged over and over. So events are counted in a hash table
+ * keyed on (profile, operation, name, requested_mask), and a record only
+ * costs a copy of its strings the first time its event is seen.
+ *
+ * Regular files are mapped and split at line boundaries into one chunk
+ * per thread. Each thread counts the events of its chunk in a table of
+ * its own, and the tables are merged once all threads are done, so the
+ * threads never share anything but the read only mapping.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <aalogparse.h>
+#include "parser.h"
+#include "PMurHash.h"
+
+/* do not bother starting a thread for less than this much of a log */
+#define LOG_CHUNK_MIN_SIZE	(1024 * 1024)
+
+struct event_entry {
+	aa_log_event_count event;
+	uint32_t hash;
+	/* the strings of the event follow */
+};
+
+struct event_table {
+	struct event_entry **slots;
+	size_t size;		/* number of slots, a power of 2 */
+	size_t used;
+};
+
+struct aa_log_aggregate {
+	struct event_table table;
+};
+
+struct log_chunk {
+	pthread_t thread;
+	bool started;
+	const char *buf;
+	size_t len;
+	struct event_table table;
+	int rc;
+	int error;
+};
+
+static void hash_string(uint32_t *hash, uint32_t *carry, uint32_t *len,
+			const char *str)
+{
+	/* with the NUL, so moving characters between fields changes it */
+	size_t size = str ? strlen(str) + 1 : 0;
+
+	PMurHash32_Process(hash, carry, str, size);
+	*len += size;
+}
+
+static uint32_t event_hash(const char *profile, const char *operation,
+			   const char *name, const char *requested_mask)
+{
+	uint32_t hash = 5381, carry = 0, len = 0;
+
+	hash_string(&hash, &carry, &len, profile);
+	hash_string(&hash, &carry, &len, operation);
+	hash_string(&hash, &carry, &len, name);
+	hash_string(&hash, &carry, &len, requested_mask);
+
+	return PMurHash32_Result(hash, carry, len);
+}
+
+static bool string_equal(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static bool event_equal(const aa_log_event_count *event, const char *profile,
+			const char *operation, const char *name,
+			const char *requested_mask)
+{
+	return string_equal(event->profile, profile) &&
+	       string_equal(event->operation, operation) &&
+	       string_equal(event->name, name) &&
+	       string_equal(event->requested_mask, requested_mask);
+}
+
+static const char *copy_string(char **pos, const char *str)
+{
+	size_t size;
+	char *ret;
+
+	if (!str)
+		return NULL;
+	size = strlen(str) + 1;
+	ret = memcpy(*pos, str, size);
+	*pos += size;
+
+	return ret;
+}
+
+static struct event_entry *event_entry_new(uint32_t hash, const char *profile,
+					   const char *operation,
+					   const char *name,
+					   const char *requested_mask)
+{
+	struct event_entry *entry;
+	size_t size = sizeof(*entry);
+	char *pos;
+
+	size += profile ? strlen(profile) + 1 : 0;
+	size += operation ? strlen(operation) + 1 : 0;
+	size += name ? strlen(name) + 1 : 0;
+	size += requested_mask ? strlen(requested_mask) + 1 : 0;
+	entry = malloc(size);
+	if (!entry)
+		return NULL;
+
+	pos = (char *) (entry + 1);
+	entry->event.profile = copy_string(&pos, profile);
+	entry->event.operation = copy_string(&pos, operation);
+	entry->event.name = copy_string(&pos, name);
+	entry->event.requested_mask = copy_string(&pos, requested_mask);
+	entry->event.count = 0;
+	entry->hash = hash;
+
+	return entry;
+}
+
+/* slot of the entry for an event, or of the empty slot it would go in */
+static struct event_entry **table_slot(struct event_table *table,
+				       uint32_t hash, const char *profile,
+				       const char *operation, const char *name,
+				       const char *requested_mask)
+{
+	size_t i = hash & (table->size - 1);
+
+	while (table->slots[i]) {
+		struct event_entry *entry = table->slots[i];
+
+		if (entry->hash == hash &&
+		    event_equal(&entry->event, profile, operation, name,
+				requested_mask))
+			break;
+		i = (i + 1) & (table->size - 1);
+	}
+
+	return &table->slots[i];
+}
+
+/* keep the table at most half full */
+static int table_reserve(struct event_table *table)
+{
+	struct event_entry **old = table->slots;
+	size_t i, old_size = table->size;
+
+	if ((table->used + 1) * 2 <= table->size)
+		return 0;
+
+	table->size = old_size ? old_size * 2 : 256;
+	table->slots = calloc(table->size, sizeof(*table->slots));
+	if (!table->slots) {
+		table->slots = old;
+		table->size = old_size;
+		return -1;
+	}
+
+	for (i = 0; i < old_size; i++) {
+		struct event_entry *entry = old[i];
+		size_t j;
+
+		if (!entry)
+			continue;
+		for (j = entry->hash & (table->size - 1); table->slots[j];
+		     j = (j + 1) & (table->size - 1))
+			;
+		table->slots[j] = entry;
+	}
+	free(old);
+
+	return 0;
+}
+
+static int table_add(struct event_table *table, const char *profile,
+		     const char *operation, const char *name,
+		     const char *requested_mask, unsigned long count)
+{
+	uint32_t hash = event_hash(profile, operation, name, requested_mask);
+	struct event_entry **slot;
+
+	if (table_reserve(table) == -1)
+		return -1;
+
+	slot = table_slot(table, hash, profile, operation, name,
+			  requested_mask);
+	if (!*slot) {
+		*slot = event_entry_new(hash, profile, operation, name,
+					requested_mask);
+		if (!*slot)
+			return -1;
+		table->used++;
+	}
+	(*slot)->event.count += count;
+
+	return 0;
+}
+
+/* move the entries of @from into @to, @from is left empty either way */
+static int table_merge(struct event_table *to, struct event_table *from)
+{
+	struct event_entry **slot;
+	size_t i;
+	int rc = 0;
+
+	for (i = 0; i < from->size; i++) {
+		struct event_entry *entry = from->slots[i];
+		aa_log_event_count *event;
+
+		if (!entry)
+			continue;
+		from->slots[i] = NULL;
+		if (rc || table_reserve(to) == -1) {
+			free(entry);
+			rc = -1;
+			continue;
+		}
+
+		event = &entry->event;
+		slot = table_slot(to, entry->hash, event->profile,
+				  event->operation, event->name,
+				  event->requested_mask);
+		if (*slot) {
+			(*slot)->event.count += event->count;
+			free(entry);
+		} else {
+			*slot = entry;
+			to->used++;
+		}
+	}
+	free(from->slots);
+	from->slots = NULL;
+	from->size = from->used = 0;
+
+	return rc;
+}
+
+static void table_free(struct event_table *table)
+{
+	size_t i;
+
+	for (i = 0; i < table->size; i++)
+		free(table->slots[i]);
+	free(table->slots);
+	table->slots = NULL;
+	table->size = table->used = 0;
+}
+
+static int table_add_record(struct event_table *table,
+			    const aa_log_record *record)
+{
+	return table_add(table, record->profile, record->operation,
+			 record->name, record->requested_mask, 1);
+}
+
+static int count_records(aa_log_record *records, size_t count, void *data)
+{
+	struct event_table *table = data;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (table_add_record(table, &records[i]) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void *aggregate_chunk(void *data)
+{
+	struct log_chunk *chunk = data;
+	struct log_stream *stream;
+
+	stream = _aa_log_stream_new(count_records, &chunk->table);
+	if (!stream) {
+		chunk->rc = -1;
+		chunk->error = errno;
+		return NULL;
+	}
+
+	chunk->rc = _aa_log_stream_parse_buffer(stream, chunk->buf, chunk->len);
+	if (!chunk->rc)
+		chunk->rc = _aa_log_stream_flush(stream);
+	chunk->error = errno;
+	_aa_log_stream_free(stream);
+
+	return NULL;
+}
+
+/* split @buf at line boundaries into @count chunks of about the same size */
+static void split_chunks(const char *buf, size_t len, struct log_chunk *chunks,
+			 int count)
+{
+	size_t start = 0, end;
+	const char *nl;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		end = i + 1 == count ? len : len / count * (i + 1);
+		if (end < start)
+			end = start;
+		if (end < len) {
+			nl = memchr(buf + end, '\n', len - end);
+			end = nl ? nl - buf + 1 : len;
+		}
+		chunks[i].buf = buf + start;
+		chunks[i].len = end - start;
+		start = end;
+	}
+}
+
+static int aggregate_buffer(aa_log_aggregate *aggregate, const char *buf,
+			    size_t len, int threads)
+{
+	struct log_chunk *chunks;
+	int i, rc = 0, error = 0;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if ((size_t) threads > len / LOG_CHUNK_MIN_SIZE)
+		threads = len / LOG_CHUNK_MIN_SIZE;
+	if (threads < 1)
+		threads = 1;
+
+	chunks = calloc(threads, sizeof(*chunks));
+	if (!chunks)
+		return -1;
+	split_chunks(buf, len, chunks, threads);
+
+	/* the calling thread takes the first chunk, and any chunk a thread
+	 * could not be started for
+	 */
+	for (i = 1; i < threads; i++)
+		chunks[i].started = pthread_create(&chunks[i].thread, NULL,
+						   aggregate_chunk,
+						   &chunks[i]) == 0;
+	for (i = 0; i < threads; i++) {
+		if (!chunks[i].started)
+			aggregate_chunk(&chunks[i]);
+	}
+
+	for (i = 0; i < threads; i++) {
+		if (chunks[i].started)
+			pthread_join(chunks[i].thread, NULL);
+		if (chunks[i].rc && !rc) {
+			rc = -1;
+			error = chunks[i].error;
+		}
+		if (table_merge(&aggregate->table, &chunks[i].table) == -1 &&
+		    !rc) {
+			rc = -1;
+			error = ENOMEM;
+		}
+	}
+	free(chunks);
+
+	errno = error;
+	return rc;
+}
+
+/**
+ * aa_log_aggregate_new - create an empty aggregate of logged events
+ * @aggregate: will point to the new aggregate
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int aa_log_aggregate_new(aa_log_aggregate **aggregate)
+{
+	*aggregate = calloc(1, sizeof(**aggregate));
+	if (!*aggregate)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * aa_log_aggregate_free - free an aggregate and the events it counted
+ * @aggregate: the aggregate (can be NULL)
+ */
+void aa_log_aggregate_free(aa_log_aggregate *aggregate)
+{
+	int save = errno;
+
+	if (!aggregate)
+		return;
+
+	table_free(&aggregate->table);
+	free(aggregate);
+	errno = save;
+}
+
+/**
+ * aa_log_aggregate_add_record - count the event of a parsed record
+ * @aggregate: the aggregate
+ * @record: the record
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int aa_log_aggregate_add_record(aa_log_aggregate *aggregate,
+				const aa_log_record *record)
+{
+	if (!aggregate || !record) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return table_add_record(&aggregate->table, record);
+}
+
+/**
+ * aa_log_aggregate_add_file - count the events logged in a log
+ * @aggregate: the aggregate
+ * @fd: file descriptor to read the log from, from its current offset
+ * @threads: number of threads to parse a regular file with, 0 for one per
+ *           online cpu
+ *
+ * Regular files are mapped and parsed in parallel, up to the end of the
+ * file at the time of the call, and the offset is moved to there.  Other
+ * files, such as pipes, are read until their end by the calling thread.
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int aa_log_aggregate_add_file(aa_log_aggregate *aggregate, int fd,
+			      int threads)
+{
+	struct stat st;
+	off_t offset;
+	char *buf;
+	int rc, error;
+
+	if (!aggregate || fd < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (fstat(fd, &st) == -1)
+		return -1;
+	offset = lseek(fd, 0, SEEK_CUR);
+	/* files in /proc and /sys claim to be empty */
+	if (!S_ISREG(st.st_mode) || st.st_size == 0 || offset == -1)
+		return aa_log_parse_stream(fd, count_records,
+					   &aggregate->table);
+	if (offset >= st.st_size)
+		return 0;
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED)
+		return aa_log_parse_stream(fd, count_records,
+					   &aggregate->table);
+
+	rc = aggregate_buffer(aggregate, buf + offset, st.st_size - offset,
+			      threads);
+	error = errno;
+	munmap(buf, st.st_size);
+	lseek(fd, st.st_size, SEEK_SET);
+	errno = error;
+
+	return rc;
+}
+
+static int compare_counts(const void *a, const void *b)
+{
+	const aa_log_event_count *x = a, *y = b;
+
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+	return 0;
+}
+
+/**
+ * aa_log_aggregate_get_counts - get the events counted so far
+ * @aggregate: the aggregate
+ * @counts: will point to an array of the events, most frequent first,
+ *          which the caller must free(). The strings of the events belong
+ *          to @aggregate and are valid until it is freed.
+ *
+ * Returns: the number of events, or -1 with errno set on error
+ */
+ssize_t aa_log_aggregate_get_counts(aa_log_aggregate *aggregate,
+				    aa_log_event_count **counts)
+{
+	struct event_table *table;
+	size_t i, n = 0;
+
+	if (!aggregate || !counts) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	table = &aggregate->table;
+	*counts = malloc((table->used ? table->used : 1) * sizeof(**counts));
+	if (!*counts)
+		return -1;
+
+	for (i = 0; i < table->size; i++) {
+		if (table->slots[i])
+			(*counts)[n++] = table->slots[i]->event;
+	}
+	qsort(*counts, n, sizeof(**counts), compare_counts);
+
+	return n;
+}
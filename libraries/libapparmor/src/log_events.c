@@ -0,0 +1,790 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Binary format for storing parsed records.
+ *
+ * Replaying stored events should not mean parsing text again, so records
+ * are stored field by field in a compact binary form that can be read
+ * back straight from a mapping of the file:
+ *
+ *   header:	"AAEV", version byte, 3 zero bytes
+ *   entries:	ENTRY_STRING len bytes NUL
+ *			defines the next string id, counting from 1
+ *		ENTRY_RECORD fields-present values...
+ *			values of the present fields, in event_fields order
+ *
+ * Integers are LEB128 varints, signed ones zigzag encoded. Fields with
+ * few distinct values, such as the profile, operation or comm, refer to
+ * a string defined by an earlier entry by its id. Other strings are
+ * stored in place. Either way strings are NUL terminated in the file, so
+ * the records read back point straight into the mapping.
+ *
+ * Fields left at the value parse_record gives them when they are not
+ * logged are not stored. New fields may only be added at the end of
+ * event_fields, along with a new version.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <aalogparse.h>
+#include "parser.h"
+#include "PMurHash.h"
+
+#define EVENTS_MAGIC		"AAEV"
+#define EVENTS_VERSION		1
+#define EVENTS_HEADER_SIZE	8
+
+#define ENTRY_STRING		1
+#define ENTRY_RECORD		2
+
+#define WRITER_BUF_SIZE		(64 * 1024)
+#define VARINT_MAX_SIZE		10
+
+enum field_type {
+	FIELD_INT,		/* int, or an enum */
+	FIELD_UINT,
+	FIELD_LONG,
+	FIELD_ULONG,
+	FIELD_STRING,		/* stored in place */
+	FIELD_ATOM,		/* interned */
+};
+
+struct event_field {
+	enum field_type type;
+	size_t offset;
+};
+
+#define FIELD(type, member) { type, offsetof(aa_log_record, member) }
+
+static const struct event_field event_fields[] = {
+	FIELD(FIELD_INT, version),
+	FIELD(FIELD_INT, event),
+	FIELD(FIELD_ULONG, pid),
+	FIELD(FIELD_ULONG, peer_pid),
+	FIELD(FIELD_ULONG, task),
+	FIELD(FIELD_ULONG, magic_token),
+	FIELD(FIELD_LONG, epoch),
+	FIELD(FIELD_UINT, audit_sub_id),
+	FIELD(FIELD_INT, bitmask),
+	FIELD(FIELD_STRING, audit_id),
+	FIELD(FIELD_ATOM, operation),
+	FIELD(FIELD_ATOM, denied_mask),
+	FIELD(FIELD_ATOM, requested_mask),
+	FIELD(FIELD_ULONG, fsuid),
+	FIELD(FIELD_ULONG, ouid),
+	FIELD(FIELD_ATOM, profile),
+	FIELD(FIELD_ATOM, peer_profile),
+	FIELD(FIELD_ATOM, comm),
+	FIELD(FIELD_STRING, name),
+	FIELD(FIELD_STRING, name2),
+	FIELD(FIELD_ATOM, namespace),
+	FIELD(FIELD_ATOM, attribute),
+	FIELD(FIELD_ULONG, parent),
+	FIELD(FIELD_ATOM, info),
+	FIELD(FIELD_STRING, peer_info),
+	FIELD(FIELD_INT, error_code),
+	FIELD(FIELD_ATOM, active_hat),
+	FIELD(FIELD_ATOM, net_family),
+	FIELD(FIELD_ATOM, net_protocol),
+	FIELD(FIELD_ATOM, net_sock_type),
+	FIELD(FIELD_STRING, net_local_addr),
+	FIELD(FIELD_ULONG, net_local_port),
+	FIELD(FIELD_STRING, net_foreign_addr),
+	FIELD(FIELD_ULONG, net_foreign_port),
+	FIELD(FIELD_ATOM, dbus_bus),
+	FIELD(FIELD_STRING, dbus_path),
+	FIELD(FIELD_ATOM, dbus_interface),
+	FIELD(FIELD_ATOM, dbus_member),
+	FIELD(FIELD_ATOM, signal),
+	FIELD(FIELD_ATOM, peer),
+	FIELD(FIELD_ATOM, fs_type),
+	FIELD(FIELD_ATOM, flags),
+	FIELD(FIELD_STRING, src_name),
+};
+
+#define NUM_EVENT_FIELDS (sizeof(event_fields) / sizeof(*event_fields))
+
+struct atom {
+	uint32_t hash;
+	uint32_t id;
+	char *str;
+};
+
+struct aa_log_writer {
+	int fd;
+	char *buf;
+	size_t size;
+	size_t used;
+	int error;		/* of a write that failed, sticky */
+
+	struct atom *atoms;	/* open addressing, a power of 2 slots */
+	size_t atoms_size;
+	uint32_t atoms_used;	/* also the id of the last string */
+};
+
+struct aa_log_reader {
+	char *map;
+	size_t size;
+	size_t pos;
+
+	const char **atoms;	/* by id, 0 is NULL */
+	size_t atoms_size;
+	size_t atoms_used;
+};
+
+static aa_log_record default_record;
+static pthread_once_t default_record_once = PTHREAD_ONCE_INIT;
+
+static void init_default_record(void)
+{
+	_init_log_record(&default_record);
+}
+
+static void *field_ptr(const aa_log_record *record, size_t i)
+{
+	return (char *) record + event_fields[i].offset;
+}
+
+static size_t field_size(size_t i)
+{
+	switch (event_fields[i].type) {
+	case FIELD_INT:
+		return sizeof(int);
+	case FIELD_UINT:
+		return sizeof(unsigned int);
+	case FIELD_LONG:
+		return sizeof(long);
+	case FIELD_ULONG:
+		return sizeof(unsigned long);
+	default:
+		return sizeof(char *);
+	}
+}
+
+/* the value of a numeric field, zigzag encoded if it is signed */
+static uint64_t field_value(const aa_log_record *record, size_t i)
+{
+	void *ptr = field_ptr(record, i);
+	int64_t value;
+
+	switch (event_fields[i].type) {
+	case FIELD_INT:
+		value = *(int *) ptr;
+		break;
+	case FIELD_LONG:
+		value = *(long *) ptr;
+		break;
+	case FIELD_UINT:
+		return *(unsigned int *) ptr;
+	default:
+		return *(unsigned long *) ptr;
+	}
+
+	return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static void set_field_value(aa_log_record *record, size_t i, uint64_t value)
+{
+	void *ptr = field_ptr(record, i);
+	int64_t svalue = (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+
+	switch (event_fields[i].type) {
+	case FIELD_INT:
+		*(int *) ptr = svalue;
+		break;
+	case FIELD_LONG:
+		*(long *) ptr = svalue;
+		break;
+	case FIELD_UINT:
+		*(unsigned int *) ptr = value;
+		break;
+	default:
+		*(unsigned long *) ptr = value;
+		break;
+	}
+}
+
+static size_t put_varint(char *buf, uint64_t value)
+{
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (char) (value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (char) value;
+
+	return len;
+}
+
+static int get_varint(const char *buf, size_t size, size_t *pos,
+		      uint64_t *value)
+{
+	unsigned int shift = 0;
+	unsigned char c;
+
+	*value = 0;
+	do {
+		if (*pos >= size || shift > 63)
+			return -1;
+		c = buf[(*pos)++];
+		*value |= (uint64_t) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+static int writer_write(aa_log_writer *writer)
+{
+	size_t pos = 0;
+	ssize_t wsize;
+
+	if (writer->error) {
+		errno = writer->error;
+		return -1;
+	}
+
+	while (pos < writer->used) {
+		wsize = write(writer->fd, writer->buf + pos,
+			      writer->used - pos);
+		if (wsize == -1) {
+			if (errno == EINTR)
+				continue;
+			writer->error = errno;
+			return -1;
+		}
+		pos += wsize;
+	}
+	writer->used = 0;
+
+	return 0;
+}
+
+/* make room for @size more bytes in the buffer */
+static int writer_reserve(aa_log_writer *writer, size_t size)
+{
+	char *tmp;
+
+	if (writer->size - writer->used >= size)
+		return 0;
+	if (writer_write(writer) == -1)
+		return -1;
+	if (writer->size >= size)
+		return 0;
+
+	tmp = realloc(writer->buf, size);
+	if (!tmp)
+		return -1;
+	writer->buf = tmp;
+	writer->size = size;
+
+	return 0;
+}
+
+/* entries are only put in the buffer once there is room for all of
+ * them, so a failed write never leaves half an entry behind
+ */
+static void writer_put_varint(aa_log_writer *writer, uint64_t value)
+{
+	writer->used += put_varint(writer->buf + writer->used, value);
+}
+
+/* @str with its NUL, after its length */
+static void writer_put_string(aa_log_writer *writer, const char *str,
+			      size_t len)
+{
+	writer_put_varint(writer, len);
+	memcpy(writer->buf + writer->used, str, len + 1);
+	writer->used += len + 1;
+}
+
+static int writer_grow_atoms(aa_log_writer *writer)
+{
+	struct atom *old = writer->atoms;
+	size_t i, j, old_size = writer->atoms_size;
+
+	writer->atoms_size = old_size ? old_size * 2 : 256;
+	writer->atoms = calloc(writer->atoms_size, sizeof(*writer->atoms));
+	if (!writer->atoms) {
+		writer->atoms = old;
+		writer->atoms_size = old_size;
+		return -1;
+	}
+
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].str)
+			continue;
+		for (j = old[i].hash & (writer->atoms_size - 1);
+		     writer->atoms[j].str;
+		     j = (j + 1) & (writer->atoms_size - 1))
+			;
+		writer->atoms[j] = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+/* the id of @str, which is written out the first time it is seen */
+static int writer_atom(aa_log_writer *writer, const char *str, uint32_t *id)
+{
+	size_t i, len = strlen(str);
+	uint32_t hash = 5381, carry = 0;
+	struct atom *atom;
+
+	PMurHash32_Process(&hash, &carry, str, len);
+	hash = PMurHash32_Result(hash, carry, len);
+
+	if ((writer->atoms_used + 1) * 2 > writer->atoms_size &&
+	    writer_grow_atoms(writer) == -1)
+		return -1;
+
+	for (i = hash & (writer->atoms_size - 1); writer->atoms[i].str;
+	     i = (i + 1) & (writer->atoms_size - 1)) {
+		atom = &writer->atoms[i];
+		if (atom->hash == hash && strcmp(atom->str, str) == 0) {
+			*id = atom->id;
+			return 0;
+		}
+	}
+
+	atom = &writer->atoms[i];
+	atom->str = strdup(str);
+	if (!atom->str)
+		return -1;
+	if (writer_reserve(writer, 1 + VARINT_MAX_SIZE + len + 1) == -1) {
+		free(atom->str);
+		atom->str = NULL;
+		return -1;
+	}
+	writer->buf[writer->used++] = ENTRY_STRING;
+	writer_put_string(writer, str, len);
+	atom->hash = hash;
+	atom->id = ++writer->atoms_used;
+	*id = atom->id;
+
+	return 0;
+}
+
+/**
+ * aa_log_writer_new - start writing records in the binary event format
+ * @writer: will point to the new writer
+ * @fd: file to write to, such as a new file or a pipe
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int aa_log_writer_new(aa_log_writer **writer, int fd)
+{
+	aa_log_writer *w;
+
+	if (fd < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -1;
+	w->fd = fd;
+	w->size = WRITER_BUF_SIZE;
+	w->buf = malloc(w->size);
+	if (!w->buf) {
+		free(w);
+		return -1;
+	}
+
+	memcpy(w->buf, EVENTS_MAGIC, 4);
+	w->buf[4] = EVENTS_VERSION;
+	memset(w->buf + 5, 0, EVENTS_HEADER_SIZE - 5);
+	w->used = EVENTS_HEADER_SIZE;
+
+	*writer = w;
+	return 0;
+}
+
+/**
+ * aa_log_writer_add - add a record
+ * @writer: the writer
+ * @record: the record, as returned by parse_record
+ *
+ * Records are buffered, use aa_log_writer_flush to write them out.
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int aa_log_writer_add(aa_log_writer *writer, const aa_log_record *record)
+{
+	uint32_t atoms[NUM_EVENT_FIELDS];
+	size_t lens[NUM_EVENT_FIELDS];
+	size_t i, size = 1 + VARINT_MAX_SIZE;
+	uint64_t present = 0;
+
+	if (!writer || !record) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (writer->error) {
+		errno = writer->error;
+		return -1;
+	}
+
+	pthread_once(&default_record_once, init_default_record);
+
+	/* strings first, so they are defined before the record */
+	for (i = 0; i < NUM_EVENT_FIELDS; i++) {
+		const char *str = NULL;
+
+		if (event_fields[i].type == FIELD_STRING ||
+		    event_fields[i].type == FIELD_ATOM)
+			str = *(char **) field_ptr(record, i);
+
+		switch (event_fields[i].type) {
+		case FIELD_STRING:
+			if (!str)
+				break;
+			lens[i] = strlen(str);
+			size += VARINT_MAX_SIZE + lens[i] + 1;
+			present |= 1ULL << i;
+			break;
+		case FIELD_ATOM:
+			if (!str)
+				break;
+			if (writer_atom(writer, str, &atoms[i]) == -1)
+				return -1;
+			size += VARINT_MAX_SIZE;
+			present |= 1ULL << i;
+			break;
+		default:
+			if (memcmp(field_ptr(record, i),
+				   field_ptr(&default_record, i),
+				   field_size(i)) == 0)
+				break;
+			size += VARINT_MAX_SIZE;
+			present |= 1ULL << i;
+			break;
+		}
+	}
+
+	if (writer_reserve(writer, size) == -1)
+		return -1;
+	writer->buf[writer->used++] = ENTRY_RECORD;
+	writer_put_varint(writer, present);
+	for (i = 0; i < NUM_EVENT_FIELDS; i++) {
+		if (!(present & (1ULL << i)))
+			continue;
+
+		switch (event_fields[i].type) {
+		case FIELD_STRING:
+			writer_put_string(writer,
+					  *(char **) field_ptr(record, i),
+					  lens[i]);
+			break;
+		case FIELD_ATOM:
+			writer_put_varint(writer, atoms[i]);
+			break;
+		default:
+			writer_put_varint(writer, field_value(record, i));
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int add_records(aa_log_record *records, size_t count, void *data)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (aa_log_writer_add(data, &records[i]) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * aa_log_writer_add_log - add the records of a log
+ * @writer: the writer
+ * @fd: file descriptor to read the log from, see aa_log_parse_stream
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int aa_log_writer_add_log(aa_log_writer *writer, int fd)
+{
+	if (!writer) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return aa_log_parse_stream(fd, add_records, writer);
+}
+
+/**
+ * aa_log_writer_flush - write out the buffered records
+ * @writer: the writer
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int aa_log_writer_flush(aa_log_writer *writer)
+{
+	if (!writer) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return writer_write(writer);
+}
+
+/**
+ * aa_log_writer_free - flush and free a writer
+ * @writer: the writer (can be NULL)
+ *
+ * The file descriptor is left open.
+ *
+ * Returns: 0 on success, -1 with errno set if the records could not all
+ *          be written
+ */
+int aa_log_writer_free(aa_log_writer *writer)
+{
+	int rc, error;
+	size_t i;
+
+	if (!writer)
+		return 0;
+
+	rc = writer_write(writer);
+	error = errno;
+	for (i = 0; i < writer->atoms_size; i++)
+		free(writer->atoms[i].str);
+	free(writer->atoms);
+	free(writer->buf);
+	free(writer);
+	errno = error;
+
+	return rc;
+}
+
+/**
+ * aa_log_reader_new - read records stored in the binary event format
+ * @reader: will point to the new reader
+ * @fd: regular file to read, which is mapped
+ *
+ * Returns: 0 on success, -1 with errno set on error, to EPROTONOSUPPORT
+ *          if the file is of a newer version of the format
+ */
+int aa_log_reader_new(aa_log_reader **reader, int fd)
+{
+	aa_log_reader *r;
+	struct stat st;
+	char *map;
+
+	if (fstat(fd, &st) == -1)
+		return -1;
+	if (!S_ISREG(st.st_mode)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (st.st_size < EVENTS_HEADER_SIZE) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	/* private and writable, so records read back can be modified
+	 * like the ones parse_record returns, without touching the file
+	 */
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+		   0);
+	if (map == MAP_FAILED)
+		return -1;
+	if (memcmp(map, EVENTS_MAGIC, 4) != 0) {
+		munmap(map, st.st_size);
+		errno = EBADMSG;
+		return -1;
+	}
+	if (map[4] != EVENTS_VERSION) {
+		munmap(map, st.st_size);
+		errno = EPROTONOSUPPORT;
+		return -1;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	r->map = map;
+	r->size = st.st_size;
+	r->pos = EVENTS_HEADER_SIZE;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	*reader = r;
+	return 0;
+}
+
+/* a NUL terminated string in the mapping */
+static int reader_get_string(aa_log_reader *reader, char **str)
+{
+	uint64_t len;
+
+	if (get_varint(reader->map, reader->size, &reader->pos, &len) == -1 ||
+	    len >= reader->size - reader->pos ||
+	    reader->map[reader->pos + len] != '\0')
+		return -1;
+	*str = reader->map + reader->pos;
+	reader->pos += len + 1;
+
+	return 0;
+}
+
+static int reader_add_atom(aa_log_reader *reader)
+{
+	const char **tmp;
+	char *str;
+
+	if (reader_get_string(reader, &str) == -1)
+		return -1;
+
+	if (reader->atoms_used + 1 >= reader->atoms_size) {
+		size_t size = reader->atoms_size ? reader->atoms_size * 2 : 256;
+
+		tmp = realloc(reader->atoms, size * sizeof(*tmp));
+		if (!tmp)
+			return -2;
+		reader->atoms = tmp;
+		reader->atoms_size = size;
+		reader->atoms[0] = NULL;
+	}
+	reader->atoms[++reader->atoms_used] = str;
+
+	return 0;
+}
+
+static int reader_get_record(aa_log_reader *reader, aa_log_record *record)
+{
+	uint64_t present, value;
+	char *str;
+	size_t i;
+
+	if (get_varint(reader->map, reader->size, &reader->pos,
+		       &present) == -1 ||
+	    present >> NUM_EVENT_FIELDS)
+		return -1;
+
+	_init_log_record(record);
+	for (i = 0; i < NUM_EVENT_FIELDS; i++) {
+		if (!(present & (1ULL << i)))
+			continue;
+
+		switch (event_fields[i].type) {
+		case FIELD_STRING:
+			if (reader_get_string(reader, &str) == -1)
+				return -1;
+			*(char **) field_ptr(record, i) = str;
+			break;
+		case FIELD_ATOM:
+			if (get_varint(reader->map, reader->size, &reader->pos,
+				       &value) == -1 ||
+			    value == 0 || value > reader->atoms_used)
+				return -1;
+			*(const char **) field_ptr(record, i) =
+				reader->atoms[value];
+			break;
+		default:
+			if (get_varint(reader->map, reader->size, &reader->pos,
+				       &value) == -1)
+				return -1;
+			set_field_value(record, i, value);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * aa_log_reader_next - read the next record
+ * @reader: the reader
+ * @record: the record read
+ *
+ * The strings of @record point into the mapped file and are valid until
+ * the reader is freed. @record must not be passed to free_record.
+ *
+ * Returns: 1 if a record was read, 0 at the end of the file, -1 with
+ *          errno set on error, to EBADMSG if the file is corrupt
+ */
+int aa_log_reader_next(aa_log_reader *reader, aa_log_record *record)
+{
+	int rc;
+
+	if (!reader || !record) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (reader->pos < reader->size) {
+		switch (reader->map[reader->pos++]) {
+		case ENTRY_STRING:
+			rc = reader_add_atom(reader);
+			if (rc == -2)
+				return -1;
+			if (rc == -1)
+				goto corrupt;
+			break;
+		case ENTRY_RECORD:
+			if (reader_get_record(reader, record) == -1)
+				goto corrupt;
+			return 1;
+		default:
+			goto corrupt;
+		}
+	}
+
+	return 0;
+
+corrupt:
+	/* do not read on past the bad entry */
+	reader->pos = reader->size;
+	errno = EBADMSG;
+	return -1;
+}
+
+/**
+ * aa_log_reader_free - unmap the file and free a reader
+ * @reader: the reader (can be NULL)
+ */
+void aa_log_reader_free(aa_log_reader *reader)
+{
+	int save = errno;
+
+	if (!reader)
+		return;
+
+	munmap(reader->map, reader->size);
+	free(reader->atoms);
+	free(reader);
+	errno = save;
+}
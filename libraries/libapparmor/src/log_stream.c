@@ -0,0 +1,395 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Parsing of whole logs.
+ *
+ * Most lines of an audit log or the kernel log are not AppArmor records,
+ * and running each of them through the grammar only to find out costs
+ * far more than looking for the keys AppArmor records carry. So logs are
+ * read in large blocks, lines without any of those keys are skipped, and
+ * only the others are parsed, into a shared buffer so the records can be
+ * handed to the caller a batch at a time without allocating anything per
+ * record.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <aalogparse.h>
+#include "parser.h"
+
+#define LOG_BLOCK_SIZE		(64 * 1024)
+#define LOG_BATCH_SIZE		64
+#define LOG_ARENA_SIZE		(LOG_BATCH_SIZE * 512)
+
+struct log_stream {
+	aa_log_parse_state *state;
+	aa_log_stream_callback callback;
+	void *data;
+
+	aa_log_record records[LOG_BATCH_SIZE];
+	size_t count;
+	char *arena;		/* strings of the records in the batch */
+	size_t arena_size;
+	size_t arena_used;
+
+	char *line;		/* kernel log record rewritten for the grammar */
+	size_t line_size;
+};
+
+/**
+ * is_candidate - check whether a line may be an AppArmor record
+ * @line: the line
+ * @len: length of @line
+ *
+ * Current records carry an apparmor= key, which also tells AppArmor's
+ * type=1400 (AVC) records apart from those of other LSMs. Records from
+ * before that key was added are of type APPARMOR, or of one of the
+ * AppArmor audit types 1500 to 1599.
+ *
+ * Returns: true if the line should be parsed
+ */
+static bool is_candidate(const char *line, size_t len)
+{
+	const char *end = line + len;
+	const char *p;
+
+	if (memmem(line, len, "apparmor=", 9))
+		return true;
+
+	for (p = line; (p = memmem(p, end - p, "type=", 5)); p += 5) {
+		size_t rest = end - p - 5;
+
+		if (rest >= 8 && memcmp(p + 5, "APPARMOR", 8) == 0)
+			return true;
+		if (rest >= 4 && p[5] == '1' && p[6] == '5' &&
+		    isdigit((unsigned char) p[7]) &&
+		    isdigit((unsigned char) p[8]))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * kmsg_to_dmesg - rewrite a record read from /dev/kmsg
+ * @line: the line, "priority,sequence,usecs,flags;message"
+ * @len: length of @line
+ * @buf: buffer to hold the rewritten record
+ * @size: size of @buf
+ *
+ * The grammar knows the kernel log as dmesg prints it, so the header of
+ * the record is turned into dmesg's timestamp, "[seconds.usecs] message".
+ *
+ * Returns: length of the rewritten record, which did not fit in @buf if it
+ *          is @size or more, or -1 if @line is not a /dev/kmsg record
+ */
+static ssize_t kmsg_to_dmesg(const char *line, size_t len, char *buf,
+			     size_t size)
+{
+	const char *p = line, *end = line + len;
+	unsigned long long value = 0;
+	int field;
+
+	/* priority, sequence number and timestamp, maybe followed by flags */
+	for (field = 0; field < 3; field++) {
+		if (p == end || !isdigit((unsigned char) *p))
+			return -1;
+		for (value = 0; p < end && isdigit((unsigned char) *p); p++)
+			value = value * 10 + *p - '0';
+		if (p == end || (*p != ',' && (field < 2 || *p != ';')))
+			return -1;
+		p++;
+	}
+	if (p[-1] != ';') {
+		p = memchr(p, ';', end - p);
+		if (!p)
+			return -1;
+		p++;
+	}
+
+	return snprintf(buf, size, "[%5llu.%06llu] %.*s", value / 1000000,
+			value % 1000000, (int) (end - p), p);
+}
+
+/* hand the records in the batch to the caller */
+static int stream_flush(struct log_stream *stream)
+{
+	int rc = 0;
+
+	if (stream->count)
+		rc = stream->callback(stream->records, stream->count,
+				      stream->data);
+	stream->count = 0;
+	stream->arena_used = 0;
+
+	return rc;
+}
+
+static int stream_grow_arena(struct log_stream *stream)
+{
+	char *tmp;
+
+	tmp = realloc(stream->arena, stream->arena_size * 2);
+	if (!tmp)
+		return -1;
+	stream->arena = tmp;
+	stream->arena_size *= 2;
+
+	return 0;
+}
+
+/* parse a NUL terminated line into the batch, if it is a record */
+static int stream_parse(struct log_stream *stream, const char *line)
+{
+	aa_log_record *record = &stream->records[stream->count];
+	size_t used;
+	int rc;
+
+	while (_parse_yacc_r(stream->state, line, record,
+			     stream->arena + stream->arena_used,
+			     stream->arena_size - stream->arena_used,
+			     &used) == -1) {
+		if (errno != ERANGE)
+			return -1;
+		/* make room by handing over the batch, and if that is not
+		 * enough by growing the buffer
+		 */
+		if (stream->count) {
+			rc = stream_flush(stream);
+			if (rc)
+				return rc;
+			record = &stream->records[0];
+		} else if (stream_grow_arena(stream) == -1) {
+			return -1;
+		}
+	}
+
+	if (record->event == AA_RECORD_INVALID)
+		return 0;
+	stream->arena_used += used;
+	if (++stream->count == LOG_BATCH_SIZE)
+		return stream_flush(stream);
+
+	return 0;
+}
+
+/* @line is parsed in place if it is NUL terminated at @len, else a
+ * candidate is copied to be terminated
+ */
+static int stream_line(struct log_stream *stream, const char *line,
+		       size_t len, bool terminated)
+{
+	ssize_t n;
+
+	if (!is_candidate(line, len))
+		return 0;
+
+	n = kmsg_to_dmesg(line, len, stream->line, stream->line_size);
+	if (n == -1 && terminated)
+		return stream_parse(stream, line);
+
+	if ((size_t) (n == -1 ? len : n) >= stream->line_size) {
+		size_t size = (n == -1 ? len : n) + 1;
+		char *tmp = realloc(stream->line, size);
+
+		if (!tmp)
+			return -1;
+		stream->line = tmp;
+		stream->line_size = size;
+		if (n != -1)
+			kmsg_to_dmesg(line, len, stream->line,
+				      stream->line_size);
+	}
+	if (n == -1) {
+		memcpy(stream->line, line, len);
+		stream->line[len] = '\0';
+	}
+
+	return stream_parse(stream, stream->line);
+}
+
+static int stream_read(struct log_stream *stream, int fd)
+{
+	size_t size = LOG_BLOCK_SIZE, start = 0, end = 0;
+	char *buf, *nl, *tmp;
+	ssize_t rsize;
+	int rc = 0;
+
+	/* one more byte than is read, to terminate the last line */
+	buf = malloc(size + 1);
+	if (!buf)
+		return -1;
+
+	for (;;) {
+		if (start) {
+			memmove(buf, buf + start, end - start);
+			end -= start;
+			start = 0;
+		}
+		if (end == size) {
+			/* the line does not fit in the buffer */
+			tmp = realloc(buf, size * 2 + 1);
+			if (!tmp) {
+				rc = -1;
+				break;
+			}
+			buf = tmp;
+			size *= 2;
+		}
+
+		rsize = read(fd, buf + end, size - end);
+		if (rsize == -1) {
+			/* /dev/kmsg: records were overwritten before they
+			 * were read, carry on with the ones that are left
+			 */
+			if (errno == EINTR || errno == EPIPE)
+				continue;
+			/* non blocking, nothing more to read for now */
+			if (errno == EAGAIN)
+				rsize = 0;
+			else {
+				rc = -1;
+				break;
+			}
+		}
+		if (rsize == 0) {
+			/* last line without a newline */
+			if (end > start) {
+				buf[end] = '\0';
+				rc = stream_line(stream, buf + start,
+						 end - start, true);
+			}
+			break;
+		}
+		end += rsize;
+
+		while ((nl = memchr(buf + start, '\n', end - start))) {
+			*nl = '\0';
+			rc = stream_line(stream, buf + start,
+					 nl - (buf + start), true);
+			if (rc)
+				goto out;
+			start = nl + 1 - buf;
+		}
+	}
+
+out:
+	free(buf);
+	return rc;
+}
+
+struct log_stream *_aa_log_stream_new(aa_log_stream_callback callback,
+				      void *data)
+{
+	struct log_stream *stream;
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return NULL;
+
+	stream->callback = callback;
+	stream->data = data;
+	stream->arena_size = LOG_ARENA_SIZE;
+	stream->arena = malloc(stream->arena_size);
+	stream->state = _parse_state_new();
+	if (!stream->arena || !stream->state) {
+		_aa_log_stream_free(stream);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return stream;
+}
+
+void _aa_log_stream_free(struct log_stream *stream)
+{
+	int error = errno;
+
+	if (!stream)
+		return;
+
+	_parse_state_free(stream->state);
+	free(stream->arena);
+	free(stream->line);
+	free(stream);
+	errno = error;
+}
+
+/**
+ * _aa_log_stream_parse_buffer - parse the records in a log held in memory
+ * @stream: stream to parse the records with
+ * @buf: lines of the log, the last one need not end in a newline
+ * @len: length of @buf
+ *
+ * @buf is not modified, so it may be a read only mapping of the log.
+ * Records may be kept back for the next batch until _aa_log_stream_flush.
+ *
+ * Returns: 0 on success, -1 with errno set on error, or what the callback
+ *          returned if it stopped parsing
+ */
+int _aa_log_stream_parse_buffer(struct log_stream *stream, const char *buf,
+				size_t len)
+{
+	const char *end = buf + len, *nl;
+	int rc;
+
+	while (buf < end) {
+		nl = memchr(buf, '\n', end - buf);
+		if (!nl)
+			nl = end;
+		rc = stream_line(stream, buf, nl - buf, false);
+		if (rc)
+			return rc;
+		buf = nl + 1;
+	}
+
+	return 0;
+}
+
+/* hand the records kept back for the next batch to the callback */
+int _aa_log_stream_flush(struct log_stream *stream)
+{
+	return stream_flush(stream);
+}
+
+int aa_log_parse_stream(int fd, aa_log_stream_callback callback, void *data)
+{
+	struct log_stream *stream;
+	int rc;
+
+	if (fd < 0 || !callback) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	stream = _aa_log_stream_new(callback, data);
+	if (!stream)
+		return -1;
+
+	rc = stream_read(stream, fd);
+	if (!rc)
+		rc = stream_flush(stream);
+	_aa_log_stream_free(stream);
+
+	return rc;
+}
@@ -0,0 +1,437 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Unpack and match against the dfa tables generated by the parser, with
+ * the same semantics as the kernel (security/apparmor/match.c).
+ *
+ * The state tables may have been written with 16 bit or 32 bit entries,
+ * the width of each table is recorded in its header.  All tables are
+ * widened to 32 bit on unpack so matching does not care which was used.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+#include "match.h"
+
+#define YYTH_REGEX_MAGIC	0x1B5E783D
+#define YYTH_FLAG_DIFF_ENCODE	1
+#define YYTH_FLAG_OOB_TRANS	2
+
+#define YYTD_ID_ACCEPT	1
+#define YYTD_ID_BASE	2
+#define YYTD_ID_CHK	3
+#define YYTD_ID_DEF	4
+#define YYTD_ID_EC	5
+#define YYTD_ID_META	6
+#define YYTD_ID_ACCEPT2	7
+#define YYTD_ID_NXT	8
+#define YYTD_ID_MAX	8
+
+#define YYTD_DATA8	1
+#define YYTD_DATA16	2
+#define YYTD_DATA32	4
+
+/* sizes of the packed on disk headers */
+#define TABLE_SET_HEADER_SIZE	14
+#define TABLE_HEADER_SIZE	12
+
+#define MATCH_FLAG_DIFF_ENCODE		0x80000000
+#define MATCH_FLAG_OOB_TRANSITION	0x20000000
+#define base_idx(X)	((X) & 0xffffff)
+
+struct aa_dfa {
+	uint16_t flags;
+	size_t state_count;
+	size_t trans_count;
+	/* indexed by YYTD_ID_*, NULL if the table is not present */
+	uint32_t *tables[YYTD_ID_MAX + 1];
+	size_t lens[YYTD_ID_MAX + 1];
+};
+
+#define ACCEPT_TABLE(dfa)	((dfa)->tables[YYTD_ID_ACCEPT])
+#define ACCEPT_TABLE2(dfa)	((dfa)->tables[YYTD_ID_ACCEPT2])
+#define BASE_TABLE(dfa)		((dfa)->tables[YYTD_ID_BASE])
+#define DEFAULT_TABLE(dfa)	((dfa)->tables[YYTD_ID_DEF])
+#define NEXT_TABLE(dfa)		((dfa)->tables[YYTD_ID_NXT])
+#define CHECK_TABLE(dfa)	((dfa)->tables[YYTD_ID_CHK])
+#define EQUIV_TABLE(dfa)	((dfa)->tables[YYTD_ID_EC])
+
+static inline uint32_t get_be(const unsigned char *p, size_t width)
+{
+	switch (width) {
+	case 4:
+		return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+			((uint32_t) p[2] << 8) | p[3];
+	case 2:
+		return ((uint32_t) p[0] << 8) | p[1];
+	default:
+		return p[0];
+	}
+}
+
+static inline size_t pad64(size_t i)
+{
+	return (i + 7) & ~(size_t) 7;
+}
+
+/**
+ * unpack_table - unpack a single table, widening its entries to 32 bits
+ * @dfa: dfa to store the table in
+ * @blob: start of the table header
+ * @size: bytes remaining in the blob
+ *
+ * Returns: bytes consumed or 0 on error
+ */
+static size_t unpack_table(struct aa_dfa *dfa, const unsigned char *blob,
+			   size_t size)
+{
+	uint16_t id, width;
+	size_t len, tsize, i;
+	uint32_t *table;
+
+	if (size < TABLE_HEADER_SIZE)
+		return 0;
+	id = get_be(blob, 2);
+	width = get_be(blob + 2, 2);
+	len = get_be(blob + 8, 4);
+
+	if (id == 0 || id > YYTD_ID_MAX || id == YYTD_ID_META ||
+	    dfa->tables[id])
+		return 0;
+	if (width != YYTD_DATA8 && width != YYTD_DATA16 &&
+	    width != YYTD_DATA32)
+		return 0;
+	/* accept and base tables carry 32 bit values, the state tables may
+	 * be either 16 or 32 bit, and the equivalence classes are bytes
+	 */
+	if ((id == YYTD_ID_ACCEPT || id == YYTD_ID_ACCEPT2 ||
+	     id == YYTD_ID_BASE) && width != YYTD_DATA32)
+		return 0;
+	if (id == YYTD_ID_EC && (width != YYTD_DATA8 || len != 256))
+		return 0;
+	if (len > (size - TABLE_HEADER_SIZE) / width)
+		return 0;
+	tsize = pad64(TABLE_HEADER_SIZE + len * width);
+	if (tsize > size)
+		tsize = size;
+
+	table = malloc(len ? len * sizeof(*table) : sizeof(*table));
+	if (!table)
+		return 0;
+	blob += TABLE_HEADER_SIZE;
+	for (i = 0; i < len; i++, blob += width)
+		table[i] = get_be(blob, width);
+
+	dfa->tables[id] = table;
+	dfa->lens[id] = len;
+
+	return tsize;
+}
+
+/**
+ * verify_dfa - check that the tables are consistent
+ *
+ * Every state and transition index must be in range so that matching
+ * never has to bounds check, and differential encoding chains must not
+ * loop.  Mirrors the checks the kernel does when policy is loaded.
+ */
+static bool verify_dfa(struct aa_dfa *dfa)
+{
+	size_t i, state_count, trans_count;
+	unsigned char *mark = NULL;
+
+	if (!ACCEPT_TABLE(dfa) || !BASE_TABLE(dfa) || !DEFAULT_TABLE(dfa) ||
+	    !NEXT_TABLE(dfa) || !CHECK_TABLE(dfa))
+		return false;
+
+	state_count = dfa->lens[YYTD_ID_BASE];
+	trans_count = dfa->lens[YYTD_ID_NXT];
+	if (state_count <= DFA_START ||
+	    dfa->lens[YYTD_ID_DEF] != state_count ||
+	    dfa->lens[YYTD_ID_ACCEPT] != state_count ||
+	    (ACCEPT_TABLE2(dfa) && dfa->lens[YYTD_ID_ACCEPT2] != state_count) ||
+	    dfa->lens[YYTD_ID_CHK] != trans_count)
+		return false;
+
+	for (i = 0; i < state_count; i++) {
+		uint32_t base = BASE_TABLE(dfa)[i];
+
+		if (DEFAULT_TABLE(dfa)[i] >= state_count)
+			return false;
+		if (base_idx(base) + 255 >= trans_count)
+			return false;
+		if ((base & MATCH_FLAG_OOB_TRANSITION) &&
+		    (!(dfa->flags & YYTH_FLAG_OOB_TRANS) || base_idx(base) < 1))
+			return false;
+		if ((base & MATCH_FLAG_DIFF_ENCODE) &&
+		    !(dfa->flags & YYTH_FLAG_DIFF_ENCODE))
+			return false;
+	}
+	for (i = 0; i < trans_count; i++) {
+		if (NEXT_TABLE(dfa)[i] >= state_count ||
+		    CHECK_TABLE(dfa)[i] >= state_count)
+			return false;
+	}
+
+	if (!(dfa->flags & YYTH_FLAG_DIFF_ENCODE))
+		goto out;
+
+	/* walk each diff encode chain once, 1 = on the current walk,
+	 * 2 = already known to terminate
+	 */
+	mark = calloc(state_count, 1);
+	if (!mark)
+		return false;
+	for (i = 0; i < state_count; i++) {
+		size_t j;
+
+		for (j = i; !mark[j] &&
+			     (BASE_TABLE(dfa)[j] & MATCH_FLAG_DIFF_ENCODE);
+		     j = DEFAULT_TABLE(dfa)[j])
+			mark[j] = 1;
+		if (mark[j] == 1 &&
+		    (BASE_TABLE(dfa)[j] & MATCH_FLAG_DIFF_ENCODE)) {
+			free(mark);
+			return false;
+		}
+		for (j = i; mark[j] == 1; j = DEFAULT_TABLE(dfa)[j])
+			mark[j] = 2;
+	}
+	free(mark);
+
+out:
+	dfa->state_count = state_count;
+	dfa->trans_count = trans_count;
+	return true;
+}
+
+void aa_dfa_free(struct aa_dfa *dfa)
+{
+	int i;
+
+	if (!dfa)
+		return;
+	for (i = 0; i <= YYTD_ID_MAX; i++)
+		free(dfa->tables[i]);
+	free(dfa);
+}
+
+/**
+ * aa_dfa_unpack - unpack the dfa tables written by the parser
+ * @blob: the tables, starting with the table set header
+ * @size: size of @blob
+ *
+ * Returns: the dfa or NULL with errno set on error
+ */
+struct aa_dfa *aa_dfa_unpack(const void *blob, size_t size)
+{
+	const unsigned char *pos = blob;
+	struct aa_dfa *dfa;
+	size_t hsize, ssize;
+
+	if (size < TABLE_SET_HEADER_SIZE ||
+	    get_be(pos, 4) != YYTH_REGEX_MAGIC) {
+		errno = EPROTO;
+		return NULL;
+	}
+	hsize = get_be(pos + 4, 4);
+	ssize = get_be(pos + 8, 4);
+	if (hsize < TABLE_SET_HEADER_SIZE || hsize > ssize || ssize > size) {
+		errno = EPROTO;
+		return NULL;
+	}
+
+	dfa = calloc(1, sizeof(*dfa));
+	if (!dfa)
+		return NULL;
+	dfa->flags = get_be(pos + 12, 2);
+
+	size = ssize - hsize;
+	pos += hsize;
+	while (size) {
+		size_t used = unpack_table(dfa, pos, size);
+
+		if (!used)
+			goto fail;
+		pos += used;
+		size -= used;
+	}
+
+	if (!verify_dfa(dfa))
+		goto fail;
+
+	return dfa;
+
+fail:
+	aa_dfa_free(dfa);
+	errno = EPROTO;
+	return NULL;
+}
+
+size_t aa_dfa_state_count(struct aa_dfa *dfa)
+{
+	return dfa->state_count;
+}
+
+uint32_t aa_dfa_accept(struct aa_dfa *dfa, unsigned int state)
+{
+	return ACCEPT_TABLE(dfa)[state];
+}
+
+uint32_t aa_dfa_accept2(struct aa_dfa *dfa, unsigned int state)
+{
+	if (!ACCEPT_TABLE2(dfa))
+		return 0;
+	return ACCEPT_TABLE2(dfa)[state];
+}
+
+/* follow the transition for @c out of @state, walking the differential
+ * encoding chain if needed
+ */
+static inline unsigned int match_char(struct aa_dfa *dfa, unsigned int state,
+				      unsigned int c)
+{
+	uint32_t *def = DEFAULT_TABLE(dfa);
+	uint32_t *base = BASE_TABLE(dfa);
+	uint32_t *next = NEXT_TABLE(dfa);
+	uint32_t *check = CHECK_TABLE(dfa);
+
+	for (;;) {
+		uint32_t b = base[state];
+		size_t pos = base_idx(b) + c;
+
+		if (check[pos] == state)
+			return next[pos];
+		state = def[state];
+		if (!(b & MATCH_FLAG_DIFF_ENCODE))
+			return state;
+	}
+}
+
+/**
+ * aa_dfa_match_len - traverse @dfa to find state @str stops at
+ * @dfa: the dfa to match @str against
+ * @state: the state to start matching in
+ * @str: the string of bytes to match against the dfa
+ * @len: length of the string of bytes to match
+ *
+ * Unlike aa_dfa_match(), @str may contain NUL bytes.
+ *
+ * Returns: final state reached after input is consumed
+ */
+unsigned int aa_dfa_match_len(struct aa_dfa *dfa, unsigned int state,
+			      const char *str, size_t len)
+{
+	uint32_t *equiv = EQUIV_TABLE(dfa);
+
+	if (state == DFA_NOMATCH)
+		return DFA_NOMATCH;
+
+	if (equiv) {
+		for (; len; len--)
+			state = match_char(dfa, state,
+					   equiv[(unsigned char) *str++]);
+	} else {
+		for (; len; len--)
+			state = match_char(dfa, state, (unsigned char) *str++);
+	}
+
+	return state;
+}
+
+/**
+ * aa_dfa_match - traverse @dfa to find state @str stops at
+ * @dfa: the dfa to match @str against
+ * @state: the state to start matching in
+ * @str: the NUL terminated string of bytes to match against the dfa
+ *
+ * Returns: final state reached after input is consumed
+ */
+unsigned int aa_dfa_match(struct aa_dfa *dfa, unsigned int state,
+			  const char *str)
+{
+	uint32_t *equiv = EQUIV_TABLE(dfa);
+
+	if (state == DFA_NOMATCH)
+		return DFA_NOMATCH;
+
+	if (equiv) {
+		while (*str)
+			state = match_char(dfa, state,
+					   equiv[(unsigned char) *str++]);
+	} else {
+		while (*str)
+			state = match_char(dfa, state, (unsigned char) *str++);
+	}
+
+	return state;
+}
+
+/**
+ * aa_dfa_next - step one character to the next state in the dfa
+ * @dfa: the dfa to traverse
+ * @state: the state to start in
+ * @c: the input character to transition on
+ *
+ * Returns: state reached after the input character
+ */
+unsigned int aa_dfa_next(struct aa_dfa *dfa, unsigned int state, char c)
+{
+	uint32_t *equiv = EQUIV_TABLE(dfa);
+
+	if (equiv)
+		return match_char(dfa, state, equiv[(unsigned char) c]);
+	return match_char(dfa, state, (unsigned char) c);
+}
+
+/**
+ * aa_dfa_outofband_transition - step the out of band transition
+ * @dfa: the dfa to traverse
+ * @state: the state to start in
+ *
+ * Out of band transitions are not remapped by the equivalence classes.
+ *
+ * Returns: state reached, or DFA_NOMATCH if @state has no out of band
+ *          transition
+ */
+unsigned int aa_dfa_outofband_transition(struct aa_dfa *dfa,
+					 unsigned int state)
+{
+	uint32_t *def = DEFAULT_TABLE(dfa);
+	uint32_t *base = BASE_TABLE(dfa);
+	uint32_t *next = NEXT_TABLE(dfa);
+	uint32_t *check = CHECK_TABLE(dfa);
+
+	if (!(base[state] & MATCH_FLAG_OOB_TRANSITION))
+		return DFA_NOMATCH;
+
+	for (;;) {
+		uint32_t b = base[state];
+
+		/* the oob entry sits just below base, states without one
+		 * may have a base of 0
+		 */
+		if (base_idx(b) > 0 && check[base_idx(b) - 1] == state)
+			return next[base_idx(b) - 1];
+		state = def[state];
+		if (!(b & MATCH_FLAG_DIFF_ENCODE))
+			return state;
+	}
+}
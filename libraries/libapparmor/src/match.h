@@ -0,0 +1,47 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _AA_MATCH_H
+#define _AA_MATCH_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Userspace version of the kernel's dfa matching engine, operating on the
+ * tables written by the parser (libapparmor_re/chfa.cc).
+ */
+
+#define DFA_NOMATCH	0
+#define DFA_START	1
+
+struct aa_dfa;
+
+struct aa_dfa *aa_dfa_unpack(const void *blob, size_t size);
+void aa_dfa_free(struct aa_dfa *dfa);
+
+size_t aa_dfa_state_count(struct aa_dfa *dfa);
+uint32_t aa_dfa_accept(struct aa_dfa *dfa, unsigned int state);
+uint32_t aa_dfa_accept2(struct aa_dfa *dfa, unsigned int state);
+
+unsigned int aa_dfa_match_len(struct aa_dfa *dfa, unsigned int state,
+			      const char *str, size_t len);
+unsigned int aa_dfa_match(struct aa_dfa *dfa, unsigned int state,
+			  const char *str);
+unsigned int aa_dfa_next(struct aa_dfa *dfa, unsigned int state, char c);
+unsigned int aa_dfa_outofband_transition(struct aa_dfa *dfa,
+					 unsigned int state);
+
+#endif /* _AA_MATCH_H */
@@ -19,11 +19,67 @@
 #ifndef __AA_LOG_PARSER_H__
 #define __AA_LOG_PARSER_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
+/* state of parsing one record, shared by the scanner and the grammar */
+struct aa_log_parse_ctx {
+	aa_log_record *record;
+
+	/* the strings of the record are carved out of the caller's
+	 * arena if use_arena is set, else they are malloc()ed
+	 */
+	bool use_arena;
+	char *arena;
+	size_t arena_size;
+	size_t arena_used;
+	size_t arena_last;	/* offset of the last string carved out */
+	bool arena_full;
+	bool alloc_failed;	/* a string of the record is missing */
+
+	/* the line being parsed */
+	const char *input;
+	size_t input_len;
+	size_t input_pos;
+	bool restart;		/* scanner state left by the last line */
+
+	/* quoted string being scanned, kept between lines */
+	char *string_buf;
+	unsigned int string_buf_alloc;
+	unsigned int string_buf_len;
+};
+
 extern void _init_log_record(aa_log_record *record);
 extern aa_log_record *_parse_yacc(char *str);
+extern aa_log_parse_state *_parse_state_new(void);
+extern void _parse_state_free(aa_log_parse_state *state);
+extern int _parse_yacc_r(aa_log_parse_state *state, const char *str,
+			 aa_log_record *record, char *buf, size_t buflen,
+			 size_t *used);
 extern char *hex_to_string(char *str);
 extern char *ipproto_to_string(unsigned int proto);
 
+extern char *_aa_log_strndup(struct aa_log_parse_ctx *ctx, const char *str,
+			     size_t len);
+extern char *_aa_log_strdup(struct aa_log_parse_ctx *ctx, const char *str);
+extern char *_aa_log_printf(struct aa_log_parse_ctx *ctx, const char *fmt,
+			    ...) __attribute__((format(printf, 2, 3)));
+extern void _aa_log_free(struct aa_log_parse_ctx *ctx, char *str);
+extern char *_aa_log_hex_to_string(struct aa_log_parse_ctx *ctx,
+				   const char *hexstring, size_t len);
+extern char *_aa_log_ipproto_to_string(struct aa_log_parse_ctx *ctx,
+				       unsigned int proto);
+extern size_t _aa_log_input(struct aa_log_parse_ctx *ctx, char *buf,
+			    size_t max_size);
+
+struct log_stream;
+extern struct log_stream *_aa_log_stream_new(aa_log_stream_callback callback,
+					     void *data);
+extern void _aa_log_stream_free(struct log_stream *stream);
+extern int _aa_log_stream_parse_buffer(struct log_stream *stream,
+				       const char *buf, size_t len);
+extern int _aa_log_stream_flush(struct log_stream *stream);
+
 /* FIXME: this ought to be pulled from <linux/audit.h> but there's no
  * guarantee these will exist there. */
 #define AUDIT_APPARMOR_AUDIT    1501    /* AppArmor audited grants */
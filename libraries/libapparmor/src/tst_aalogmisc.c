@@ -15,6 +15,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -22,6 +23,102 @@
 #include "parser.h"
 #include "private.h"
 
+static int test_arena(void)
+{
+	struct aa_log_parse_ctx ctx;
+	char arena[16];
+	char *a, *b;
+	int rc = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.use_arena = true;
+	ctx.arena = arena;
+	ctx.arena_size = sizeof(arena);
+
+	a = _aa_log_strndup(&ctx, "abcdef", 3);
+	MY_TEST(a == arena && strcmp(a, "abc") == 0, "arena strndup");
+	b = _aa_log_hex_to_string(&ctx, "2F746D70", 8);
+	MY_TEST(b == arena + 4 && strcmp(b, "/tmp") == 0, "arena dehex");
+	MY_TEST(ctx.arena_used == 9, "arena used");
+
+	_aa_log_free(&ctx, a);
+	MY_TEST(ctx.arena_used == 9, "arena keeps string in use");
+	_aa_log_free(&ctx, b);
+	MY_TEST(ctx.arena_used == 4, "arena gives back last string");
+
+	b = _aa_log_ipproto_to_string(&ctx, 99999);
+	MY_TEST(!b && ctx.arena_full && ctx.alloc_failed, "arena full");
+	MY_TEST(strcmp(a, "abc") == 0, "arena full keeps strings");
+
+	ctx.arena_full = ctx.alloc_failed = false;
+	b = _aa_log_ipproto_to_string(&ctx, 6);
+	MY_TEST(b && strcmp(b, "tcp") == 0 && !ctx.arena_full,
+		"arena ipproto");
+
+	return rc;
+}
+
+#define AUDIT_LINE "type=AVC msg=audit(1279948288.415:39): apparmor=\"DENIED\" operation=\"open\" parent=12332 profile=\"/usr/sbin/cupsd\" name=\"/home/user/.ssh/\" pid=12333 comm=\"ls\" requested_mask=\"r\" denied_mask=\"r\" fsuid=0 ouid=1000"
+
+static int test_parse_record_r(void)
+{
+	aa_log_parse_state *state;
+	aa_log_record record;
+	size_t len;
+	char *buf;
+	int ret = -1, rc = 0;
+
+	MY_TEST(parse_record_r(NULL, AUDIT_LINE, &record, NULL, 0) == -1 &&
+		errno == EINVAL, "parse_record_r NULL buffer");
+
+	state = aa_log_parse_state_new();
+	if (!state)
+		return 1;
+
+	/* every buffer short of the size needed fails cleanly, each one
+	 * running out in a different place of the record
+	 */
+	for (len = 0; len <= sizeof(AUDIT_LINE); len++) {
+		buf = malloc(len ? len : 1);
+		if (!buf)
+			break;
+		ret = parse_record_r(state, AUDIT_LINE, &record, buf, len);
+		if (ret == 0) {
+			MY_TEST(record.event == AA_RECORD_DENIED &&
+				record.epoch == 1279948288 &&
+				record.audit_sub_id == 39 &&
+				strcmp(record.audit_id, "1279948288.415:39") == 0 &&
+				strcmp(record.profile, "/usr/sbin/cupsd") == 0 &&
+				strcmp(record.name, "/home/user/.ssh/") == 0 &&
+				strcmp(record.denied_mask, "r") == 0,
+				"parse_record_r fields");
+		} else {
+			MY_TEST(errno == ERANGE, "parse_record_r short buffer");
+		}
+		free(buf);
+		if (ret == 0)
+			break;
+	}
+	MY_TEST(ret == 0 && len > 0, "parse_record_r buffer large enough");
+
+	/* and without a state to reuse */
+	buf = malloc(len);
+	if (buf) {
+		MY_TEST(parse_record_r(NULL, AUDIT_LINE, &record, buf,
+				       len - 1) == -1 && errno == ERANGE,
+			"parse_record_r short buffer, temporary state");
+		MY_TEST(parse_record_r(NULL, AUDIT_LINE, &record, buf,
+				       len) == 0 &&
+			strcmp(record.comm, "ls") == 0,
+			"parse_record_r temporary state");
+		free(buf);
+	}
+
+	aa_log_parse_state_free(state);
+
+	return rc;
+}
+
 int main(void)
 {
 	int rc = 0;
@@ -53,6 +150,12 @@ int main(void)
 	MY_TEST(strcmp(retstr, "tcp") == 0, "protocol=tcp");
 	free(retstr);
 
+	if (test_arena())
+		rc = 1;
+
+	if (test_parse_record_r())
+		rc = 1;
+
 	return rc;
 }
 
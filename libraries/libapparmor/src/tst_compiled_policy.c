@@ -0,0 +1,431 @@
+/*
+ *   Copyright (c) 2026
+ *   Canonical, Ltd. (All rights reserved)
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of version 2 of the GNU General Public
+ *   License published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, contact Novell, Inc. or Canonical
+ *   Ltd.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "private.h"
+
+#include "compiled_policy.c"
+
+#define BUF_SIZE	(64 * 1024)
+#define TABLE_MAX	4096
+
+/* mirrors the dfa table format written by libapparmor_re/chfa.cc */
+#define YYTH_REGEX_MAGIC	0x1B5E783D
+#define YYTD_ID_ACCEPT		1
+#define YYTD_ID_BASE		2
+#define YYTD_ID_CHK		3
+#define YYTD_ID_DEF		4
+#define YYTD_ID_ACCEPT2		7
+#define YYTD_ID_NXT		8
+
+struct buf {
+	unsigned char data[BUF_SIZE];
+	size_t pos;
+};
+
+static void put_bytes(struct buf *b, const void *data, size_t len)
+{
+	memcpy(b->data + b->pos, data, len);
+	b->pos += len;
+}
+
+static void put_le(struct buf *b, uint32_t v, size_t width)
+{
+	size_t i;
+
+	for (i = 0; i < width; i++)
+		b->data[b->pos++] = v >> (8 * i);
+}
+
+static void put_be(struct buf *b, uint32_t v, size_t width)
+{
+	size_t i;
+
+	for (i = 0; i < width; i++)
+		b->data[b->pos++] = v >> (8 * (width - 1 - i));
+}
+
+static void put_pad(struct buf *b)
+{
+	while (b->pos & 7)
+		b->data[b->pos++] = 0;
+}
+
+static void put_table(struct buf *b, uint16_t id, const uint32_t *data,
+		      size_t len)
+{
+	size_t i, width = (id == YYTD_ID_ACCEPT || id == YYTD_ID_ACCEPT2 ||
+			   id == YYTD_ID_BASE) ? 4 : 2;
+
+	put_be(b, id, 2);
+	put_be(b, width, 2);
+	put_be(b, 0, 4);
+	put_be(b, len, 4);
+	for (i = 0; i < len; i++)
+		put_be(b, data[i], width);
+	put_pad(b);
+}
+
+/**
+ * build_dfa - build the tables for a dfa matching exactly @str
+ * @b: buffer to build the tables in, starting at offset 0
+ * @str: string matched
+ * @len: length of @str
+ * @accept: accept table entry of the final state
+ * @accept2: accept2 table entry of the final state
+ */
+static void build_dfa(struct buf *b, const char *str, size_t len,
+		      uint32_t accept, uint32_t accept2)
+{
+	static uint32_t acc[TABLE_MAX], acc2[TABLE_MAX], base[TABLE_MAX],
+		def[TABLE_MAX], next[TABLE_MAX], check[TABLE_MAX];
+	size_t states = len + 2, trans = states + 512, i;
+
+	memset(acc, 0, sizeof(acc));
+	memset(acc2, 0, sizeof(acc2));
+	memset(base, 0, sizeof(base));
+	memset(def, 0, sizeof(def));
+	memset(next, 0, sizeof(next));
+	memset(check, 0, sizeof(check));
+	/* state 0 is nomatch, state 1 is the start.  Each state has a single
+	 * transition, based so that it lands in slot state + 256.
+	 */
+	for (i = 0; i < len; i++) {
+		size_t s = i + 1;
+
+		base[s] = s + 256 - (unsigned char) str[i];
+		next[s + 256] = s + 1;
+		check[s + 256] = s;
+	}
+	acc[states - 1] = accept;
+	acc2[states - 1] = accept2;
+
+	b->pos = 0;
+	put_be(b, YYTH_REGEX_MAGIC, 4);
+	put_be(b, 16, 4);
+	put_be(b, 0, 4);
+	put_be(b, 0, 2);
+	put_pad(b);
+	put_table(b, YYTD_ID_ACCEPT, acc, states);
+	put_table(b, YYTD_ID_ACCEPT2, acc2, states);
+	put_table(b, YYTD_ID_BASE, base, states);
+	put_table(b, YYTD_ID_DEF, def, states);
+	put_table(b, YYTD_ID_NXT, next, trans);
+	put_table(b, YYTD_ID_CHK, check, trans);
+	/* fill in the table set size */
+	len = b->pos;
+	b->pos = 8;
+	put_be(b, len, 4);
+	b->pos = len;
+}
+
+/* the sd_write_* helpers of parser_interface.c */
+static void sd_name(struct buf *b, const char *name)
+{
+	if (name) {
+		put_le(b, SD_NAME, 1);
+		put_le(b, strlen(name) + 1, 2);
+		put_bytes(b, name, strlen(name) + 1);
+	}
+}
+
+static void sd_u32(struct buf *b, uint32_t v, const char *name)
+{
+	sd_name(b, name);
+	put_le(b, SD_U32, 1);
+	put_le(b, v, 4);
+}
+
+static void sd_string(struct buf *b, const char *str, const char *name)
+{
+	sd_name(b, name);
+	put_le(b, SD_STRING, 1);
+	put_le(b, strlen(str) + 1, 2);
+	put_bytes(b, str, strlen(str) + 1);
+}
+
+static void sd_struct(struct buf *b, const char *name)
+{
+	sd_name(b, name);
+	put_le(b, SD_STRUCT, 1);
+}
+
+static void sd_structend(struct buf *b)
+{
+	put_le(b, SD_STRUCTEND, 1);
+}
+
+static void sd_dfa(struct buf *b, struct buf *dfa)
+{
+	size_t pad;
+
+	sd_name(b, "aadfa");
+	pad = ((b->pos + 5 + 7) & ~(size_t) 7) - (b->pos + 5);
+	put_le(b, SD_BLOB, 1);
+	put_le(b, dfa->pos + pad, 4);
+	memset(b->data + b->pos, 0, pad);
+	b->pos += pad;
+	put_bytes(b, dfa->data, dfa->pos);
+}
+
+struct test_profile {
+	const char *ns;
+	const char *name;
+	uint32_t mode;
+	uint32_t audit;
+	struct buf *policydb;
+	struct buf *file;
+};
+
+static void sd_profile(struct buf *b, struct test_profile *p)
+{
+	static struct buf xmatch;
+
+	sd_u32(b, 0x5, "version");
+	if (p->ns)
+		sd_string(b, p->ns, "namespace");
+	sd_struct(b, "profile");
+	sd_string(b, p->name, NULL);
+	/* an attachment dfa, which must not be taken for the file dfa */
+	build_dfa(&xmatch, "/bin/true", 9, 1, 0);
+	sd_dfa(b, &xmatch);
+	sd_u32(b, 9, NULL);
+	sd_struct(b, "flags");
+	sd_u32(b, 0, NULL);
+	sd_u32(b, p->mode, NULL);
+	sd_u32(b, p->audit, NULL);
+	sd_structend(b);
+	sd_u32(b, 0, NULL);
+	sd_u32(b, 0, NULL);
+	sd_u32(b, 0, NULL);
+	sd_u32(b, 0, NULL);
+	if (p->policydb) {
+		sd_struct(b, "policydb");
+		sd_dfa(b, p->policydb);
+		sd_structend(b);
+	}
+	if (p->file)
+		sd_dfa(b, p->file);
+	sd_structend(b);
+}
+
+#define FILE_PATH		"/etc/passwd"
+#define DBUS_QUERY		"\x20" "send"
+
+static int test_query(void)
+{
+	static struct buf policy, file, policydb, fpolicydb;
+	struct test_profile profiles[] = {
+		{ NULL, "test", PACKED_MODE_ENFORCE, 0, &policydb, &file },
+		{ NULL, "audited", PACKED_MODE_ENFORCE, 1, NULL, &file },
+		{ NULL, "unconf", PACKED_MODE_UNCONFINED, 0, NULL, NULL },
+		{ NULL, "nofile", PACKED_MODE_ENFORCE, 0, NULL, NULL },
+		{ NULL, "fpolicydb", PACKED_MODE_ENFORCE, 0, &fpolicydb, NULL },
+		{ "ns", "test", PACKED_MODE_ENFORCE, 0, NULL, NULL },
+	};
+	aa_compiled_policy *pol;
+	aa_perms perms;
+	int allowed, audited;
+	size_t i;
+	int rc = 0;
+
+	/* owner read, audited, of /etc/passwd */
+	build_dfa(&file, FILE_PATH, strlen(FILE_PATH), AA_MAY_READ,
+		  AA_MAY_READ);
+	build_dfa(&policydb, DBUS_QUERY, strlen(DBUS_QUERY), AA_DBUS_SEND, 0);
+	build_dfa(&fpolicydb, "\x02" FILE_PATH, strlen(FILE_PATH) + 1,
+		  AA_MAY_READ | AA_MAY_WRITE, 0);
+
+	policy.pos = 0;
+	for (i = 0; i < sizeof(profiles) / sizeof(*profiles); i++)
+		sd_profile(&policy, &profiles[i]);
+
+	MY_TEST(aa_compiled_policy_new_from_data(&pol, policy.data,
+						 policy.pos) == 0,
+		"new from data");
+	if (!pol)
+		return 1;
+
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ, "test",
+						   FILE_PATH, &allowed,
+						   &audited) == 0 &&
+		allowed && audited, "file read");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_OPEN, "test",
+						   FILE_PATH, &allowed,
+						   &audited) == 0 &&
+		allowed, "file open implied by read");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_WRITE, "test",
+						   FILE_PATH, &allowed,
+						   &audited) == 0 &&
+		!allowed && audited, "file write");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ, "test",
+						   "/etc/shadow", &allowed,
+						   &audited) == 0 &&
+		!allowed, "file other path");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ, "test",
+						   "/bin/true", &allowed,
+						   &audited) == 0 &&
+		!allowed, "attachment not used for files");
+
+	MY_TEST(aa_compiled_policy_query(pol, "test", DBUS_QUERY,
+					 strlen(DBUS_QUERY), &perms) == 0 &&
+		perms.allow == AA_DBUS_SEND && perms.deny == 0,
+		"policydb query");
+	MY_TEST(aa_compiled_policy_query(pol, "test", "\x20" "recv", 5,
+					 &perms) == 0 && perms.allow == 0,
+		"policydb no match");
+	MY_TEST(aa_compiled_policy_query(pol, "test", "\x0a" "sig", 4,
+					 &perms) == 0 &&
+		perms.allow == ALL_PERMS_MASK, "class not mediated");
+
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ, "audited",
+						   FILE_PATH, &allowed,
+						   &audited) == 0 &&
+		allowed && audited, "audit mode");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_WRITE, "unconf",
+						   FILE_PATH, &allowed,
+						   &audited) == 0 &&
+		allowed, "unconfined mode");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ, "nofile",
+						   FILE_PATH, &allowed,
+						   &audited) == 0 &&
+		!allowed, "no file rules");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_WRITE,
+						   "fpolicydb", FILE_PATH,
+						   &allowed, &audited) == 0 &&
+		allowed && !audited, "file rules in the policydb");
+
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ,
+						   "test//&nofile", FILE_PATH,
+						   &allowed, &audited) == 0 &&
+		!allowed, "stacked label");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ,
+						   "test//&unconfined",
+						   FILE_PATH, &allowed,
+						   &audited) == 0 &&
+		allowed, "stacked with unconfined");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ,
+						   ":ns:test", FILE_PATH,
+						   &allowed, &audited) == 0 &&
+		!allowed, "namespaced profile");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ, "missing",
+						   FILE_PATH, &allowed,
+						   &audited) == -1 &&
+		errno == ENOENT, "unknown profile");
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ, ":ns:tes",
+						   FILE_PATH, &allowed,
+						   &audited) == -1 &&
+		errno == ENOENT, "unknown namespaced profile");
+
+	aa_compiled_policy_unref(pol);
+
+	return rc;
+}
+
+static int test_replace(void)
+{
+	static struct buf policy, file;
+	struct test_profile first = { NULL, "test", PACKED_MODE_ENFORCE, 0,
+				      NULL, NULL };
+	struct test_profile second = { NULL, "test", PACKED_MODE_ENFORCE, 0,
+				       NULL, &file };
+	aa_compiled_policy *pol;
+	int allowed, audited;
+	int fds[2];
+	int rc = 0;
+
+	build_dfa(&file, FILE_PATH, strlen(FILE_PATH), AA_MAY_READ, 0);
+	policy.pos = 0;
+	sd_profile(&policy, &first);
+	sd_profile(&policy, &second);
+
+	if (pipe(fds) == -1)
+		return 1;
+	MY_TEST(write(fds[1], policy.data, policy.pos) == (ssize_t) policy.pos,
+		"write policy");
+	close(fds[1]);
+	MY_TEST(aa_compiled_policy_new_from_fd(&pol, fds[0]) == 0,
+		"new from fd");
+	close(fds[0]);
+	if (!pol)
+		return 1;
+
+	MY_TEST(aa_compiled_policy_query_file_path(pol, AA_MAY_READ, "test",
+						   FILE_PATH, &allowed,
+						   &audited) == 0 &&
+		allowed, "later profile replaces earlier");
+	aa_compiled_policy_unref(pol);
+
+	return rc;
+}
+
+static int test_bad_policy(void)
+{
+	static struct buf policy, file;
+	struct test_profile p = { NULL, "test", PACKED_MODE_ENFORCE, 0,
+				  NULL, &file };
+	aa_compiled_policy *pol;
+	size_t i;
+	int rc = 0;
+
+	build_dfa(&file, FILE_PATH, strlen(FILE_PATH), AA_MAY_READ, 0);
+	policy.pos = 0;
+	sd_profile(&policy, &p);
+
+	MY_TEST(aa_compiled_policy_new_from_data(&pol, policy.data, 0) == -1 &&
+		!pol && errno == EPROTO, "empty");
+
+	/* every truncation must be rejected cleanly */
+	for (i = 1; i < policy.pos; i++) {
+		if (aa_compiled_policy_new_from_data(&pol, policy.data,
+						     i) == 0) {
+			aa_compiled_policy_unref(pol);
+			MY_TEST(false, "truncated");
+			break;
+		}
+	}
+
+	policy.data[0] = SD_U16;
+	MY_TEST(aa_compiled_policy_new_from_data(&pol, policy.data,
+						 policy.pos) == -1 &&
+		errno == EPROTO, "bad header");
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc = 0;
+	int retval;
+
+	retval = test_query();
+	if (retval != 0)
+		rc = retval;
+
+	retval = test_replace();
+	if (retval != 0)
+		rc = retval;
+
+	retval = test_bad_policy();
+	if (retval != 0)
+		rc = retval;
+
+	return rc;
+}
@@ -212,6 +212,70 @@ static int test_aa_splitcon(void)
 	return rc;
 }
 
+#define REPLY(ALLOW, DENY, AUDIT, QUIET) \
+	"allow 0x" ALLOW "\ndeny 0x" DENY "\naudit 0x" AUDIT "\nquiet 0x" QUIET "\n"
+
+static int do_test_parse_query_reply(const char *reply, uint32_t mask,
+				     int expected_rc, int expected_allowed,
+				     int expected_audited, const char *error)
+{
+	int allowed = -1, audited = -1;
+	int ret, rc = 0;
+
+	ret = parse_query_reply(reply, strlen(reply), mask, &allowed,
+				&audited);
+	if (ret != expected_rc) {
+		fprintf(stderr, "FAIL: %s: rc %d != %d\n", error, ret,
+			expected_rc);
+		return 1;
+	}
+	if (ret == 0 && (allowed != expected_allowed ||
+			 audited != expected_audited)) {
+		fprintf(stderr, "FAIL: %s: allowed %d audited %d != %d %d\n",
+			error, allowed, audited, expected_allowed,
+			expected_audited);
+		rc = 1;
+	}
+
+	return rc;
+}
+
+static int test_parse_query_reply(void)
+{
+	int rc = 0;
+
+#define TEST_PARSE(REPLY, MASK, RC, ALLOWED, AUDITED, ERR) \
+	if (do_test_parse_query_reply(REPLY, MASK, RC, ALLOWED, AUDITED, ERR)) \
+		rc = 1;
+
+	TEST_PARSE(REPLY("00000006", "00000000", "00000000", "00000000"),
+		   0x4, 0, 1, 0, "allowed");
+	TEST_PARSE(REPLY("00000006", "00000004", "00000000", "00000000"),
+		   0x4, 0, 0, 1, "denied is audited");
+	TEST_PARSE(REPLY("00000006", "00000004", "00000000", "00000004"),
+		   0x4, 0, 0, 0, "denied and quiet");
+	TEST_PARSE(REPLY("FFFFFFFF", "00000000", "fFfFfFfF", "00000000"),
+		   0xdeadbeef, 0, 1, 1, "mixed case audited");
+	TEST_PARSE(REPLY("a0000001", "00000000", "00000000", "00000000"),
+		   0xa0000001, 0, 1, 0, "high bits");
+
+	/* Negative tests */
+
+	TEST_PARSE("", 0x4, -1, 0, 0, "empty reply");
+	TEST_PARSE(REPLY("0000000g", "00000000", "00000000", "00000000"),
+		   0x4, -1, 0, 0, "bad hex digit");
+	TEST_PARSE(REPLY("0000006", "00000000", "00000000", "00000000"),
+		   0x4, -1, 0, 0, "short value");
+	TEST_PARSE("allow 0x00000006\ndeny 0x00000000\naudit 0x00000000\n",
+		   0x4, -1, 0, 0, "missing field");
+	TEST_PARSE("allow 0x00000006\naudit 0x00000000\ndeny 0x00000000\nquiet 0x00000000\n",
+		   0x4, -1, 0, 0, "fields out of order");
+	TEST_PARSE("allow 0x00000006 deny 0x00000000\naudit 0x00000000\nquiet 0x00000000\n",
+		   0x4, -1, 0, 0, "bad separator");
+
+	return rc;
+}
+
 int main(void)
 {
 	int retval, rc = 0;
@@ -224,5 +288,9 @@ int main(void)
 	if (retval)
 		rc = retval;
 
+	retval = test_parse_query_reply();
+	if (retval)
+		rc = retval;
+
 	return rc;
 }
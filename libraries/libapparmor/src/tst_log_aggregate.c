@@ -0,0 +1,189 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General
+ * Public License published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log_aggregate.c"
+#include "private.h"
+
+#define DENIED(profile, name) "type=AVC msg=audit(1279948288.415:39): apparmor=\"DENIED\" operation=\"open\" profile=\"" profile "\" name=\"" name "\" pid=12333 comm=\"ls\" requested_mask=\"r\" denied_mask=\"r\" fsuid=0 ouid=1000\n"
+#define SYSCALL "type=SYSCALL msg=audit(1279948288.415:39): arch=c000003e syscall=2 success=no exit=-13 a0=7f3d8c2c7f58 items=0 ppid=12332 pid=12333 comm=\"ls\" exe=\"/bin/ls\"\n"
+
+static unsigned long table_count(struct event_table *table,
+				 const char *profile, const char *operation,
+				 const char *name, const char *requested_mask)
+{
+	struct event_entry **slot;
+
+	slot = table_slot(table, event_hash(profile, operation, name,
+					    requested_mask),
+			  profile, operation, name, requested_mask);
+
+	return *slot ? (*slot)->event.count : 0;
+}
+
+static int test_table(void)
+{
+	struct event_table a, b;
+	char name[32];
+	int i, rc = 0;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+
+	MY_TEST(table_add(&a, "/bin/foo", "open", "/etc/passwd", "r", 1) == 0,
+		"table add");
+	MY_TEST(table_add(&a, "/bin/foo", "open", "/etc/passwd", "r", 2) == 0,
+		"table add again");
+	MY_TEST(table_add(&a, "/bin/foo", "open", NULL, "r", 1) == 0,
+		"table add NULL name");
+	MY_TEST(table_add(&a, "/bin/foo", "open", "", "r", 1) == 0,
+		"table add empty name");
+	MY_TEST(a.used == 3, "table add entries");
+	MY_TEST(table_count(&a, "/bin/foo", "open", "/etc/passwd", "r") == 3,
+		"table add count");
+	MY_TEST(table_count(&a, "/bin/foo", "open", NULL, "r") == 1,
+		"table NULL and empty string differ");
+	MY_TEST(table_count(&a, "/bin/foo", "open", "/etc/passwd", "w") == 0,
+		"table missing event");
+	MY_TEST(event_hash("ab", "c", NULL, NULL) !=
+		event_hash("a", "bc", NULL, NULL),
+		"hash of moved characters");
+
+	/* enough to grow the table a few times */
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "/tmp/%d", i);
+		if (table_add(&b, "/bin/foo", "open", name, "r", 1) == -1)
+			break;
+	}
+	MY_TEST(i == 1000 && b.used == 1000, "table grow");
+	MY_TEST(table_add(&b, "/bin/foo", "open", "/etc/passwd", "r", 5) == 0,
+		"table add to merge");
+
+	MY_TEST(table_merge(&a, &b) == 0, "table merge");
+	MY_TEST(a.used == 1003 && b.used == 0 && !b.slots,
+		"table merge entries");
+	MY_TEST(table_count(&a, "/bin/foo", "open", "/etc/passwd", "r") == 8,
+		"table merge count");
+	MY_TEST(table_count(&a, "/bin/foo", "open", "/tmp/999", "r") == 1,
+		"table merge moved entry");
+
+	table_free(&a);
+
+	return rc;
+}
+
+static int test_split_chunks(void)
+{
+	const char buf[] = "aaaa\nbbbb\ncccccccccccccccccccc\nd\ne";
+	struct log_chunk chunks[4];
+	size_t len = sizeof(buf) - 1, total = 0;
+	int i, rc = 0;
+
+	split_chunks(buf, len, chunks, 4);
+	for (i = 0; i < 4; i++) {
+		if (chunks[i].buf != buf + total)
+			break;
+		if (chunks[i].len && i < 3 &&
+		    chunks[i].buf[chunks[i].len - 1] != '\n')
+			break;
+		total += chunks[i].len;
+	}
+	MY_TEST(i == 4 && total == len, "split at line boundaries");
+	MY_TEST(chunks[1].len == 21, "split inside a long line");
+
+	split_chunks(buf, len, chunks, 1);
+	MY_TEST(chunks[0].buf == buf && chunks[0].len == len, "single chunk");
+
+	return rc;
+}
+
+static int test_add_file(int threads)
+{
+	aa_log_aggregate *aggregate;
+	aa_log_event_count *counts = NULL;
+	ssize_t n = 0;
+	FILE *f;
+	int i, rc = 0;
+
+	f = tmpfile();
+	if (!f || aa_log_aggregate_new(&aggregate) == -1)
+		return 1;
+
+	/* large enough to be split between threads */
+	fputs(SYSCALL, f);
+	for (i = 0; i < 12000; i++) {
+		fputs(DENIED("/bin/foo", "/etc/passwd"), f);
+		fputs(SYSCALL, f);
+		if (i % 4 == 0)
+			fputs(DENIED("/bin/bar", "/etc/shadow"), f);
+	}
+	fputs(DENIED("/bin/foo", "/etc/group"), f);
+	fflush(f);
+	rewind(f);
+
+	MY_TEST(aa_log_aggregate_add_file(aggregate, fileno(f), threads) == 0,
+		"aggregate file");
+	n = aa_log_aggregate_get_counts(aggregate, &counts);
+	MY_TEST(n == 3, "aggregate file events");
+	if (n == 3) {
+		MY_TEST(strcmp(counts[0].profile, "/bin/foo") == 0 &&
+			strcmp(counts[0].name, "/etc/passwd") == 0 &&
+			strcmp(counts[0].operation, "open") == 0 &&
+			strcmp(counts[0].requested_mask, "r") == 0 &&
+			counts[0].count == 12000, "aggregate file most frequent");
+		MY_TEST(strcmp(counts[1].profile, "/bin/bar") == 0 &&
+			counts[1].count == 3000, "aggregate file second");
+		MY_TEST(strcmp(counts[2].name, "/etc/group") == 0 &&
+			counts[2].count == 1, "aggregate file last line");
+	}
+	free(counts);
+
+	/* the offset was moved to the end, nothing more to count */
+	MY_TEST(aa_log_aggregate_add_file(aggregate, fileno(f), threads) == 0 &&
+		aa_log_aggregate_get_counts(aggregate, &counts) == 3 &&
+		counts[0].count == 12000, "aggregate file at its end");
+	free(counts);
+
+	aa_log_aggregate_free(aggregate);
+	fclose(f);
+
+	return rc;
+}
+
+int main(void)
+{
+	int retval, rc = 0;
+
+	retval = test_table();
+	if (retval)
+		rc = retval;
+
+	retval = test_split_chunks();
+	if (retval)
+		rc = retval;
+
+	retval = test_add_file(1);
+	if (retval)
+		rc = retval;
+
+	retval = test_add_file(4);
+	if (retval)
+		rc = retval;
+
+	return rc;
+}
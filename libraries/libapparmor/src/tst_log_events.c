@@ -0,0 +1,255 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General
+ * Public License published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log_events.c"
+#include "private.h"
+
+static int nullcmp_and_strcmp(const void *s1, const void *s2)
+{
+	/* Return 0 if both pointers are NULL & non-zero if only one is NULL */
+	if (!s1 || !s2)
+		return s1 != s2;
+
+	return strcmp(s1, s2);
+}
+
+static bool records_equal(const aa_log_record *a, const aa_log_record *b)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_EVENT_FIELDS; i++) {
+		void *x = field_ptr(a, i), *y = field_ptr(b, i);
+
+		if (event_fields[i].type == FIELD_STRING ||
+		    event_fields[i].type == FIELD_ATOM) {
+			if (nullcmp_and_strcmp(*(char **) x, *(char **) y))
+				return false;
+		} else if (memcmp(x, y, field_size(i))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static int test_varint(void)
+{
+	uint64_t values[] = { 0, 1, 127, 128, 300, 0xffffffff, UINT64_MAX };
+	char buf[VARINT_MAX_SIZE];
+	uint64_t value;
+	size_t i, len, pos;
+	int rc = 0;
+
+	for (i = 0; i < sizeof(values) / sizeof(*values); i++) {
+		len = put_varint(buf, values[i]);
+		pos = 0;
+		MY_TEST(get_varint(buf, len, &pos, &value) == 0 &&
+			pos == len && value == values[i], "varint round trip");
+		pos = 0;
+		MY_TEST(get_varint(buf, len - 1, &pos, &value) == -1,
+			"truncated varint");
+	}
+	MY_TEST(put_varint(buf, 127) == 1 && put_varint(buf, 128) == 2,
+		"varint length");
+
+	return rc;
+}
+
+static void fill_records(aa_log_record *records)
+{
+	_init_log_record(&records[0]);
+	records[0].version = AA_RECORD_SYNTAX_V2;
+	records[0].event = AA_RECORD_DENIED;
+	records[0].pid = 12333;
+	records[0].epoch = 1279948288;
+	records[0].audit_sub_id = 39;
+	records[0].audit_id = "1279948288.415:39";
+	records[0].operation = "open";
+	records[0].denied_mask = "r";
+	records[0].requested_mask = "r";
+	records[0].fsuid = 0;
+	records[0].ouid = 1000;
+	records[0].profile = "/usr/sbin/cupsd";
+	records[0].comm = "ls";
+	records[0].name = "/home/user/.ssh/";
+	records[0].parent = 12332;
+
+	/* the same strings again, and signed and large values */
+	records[1] = records[0];
+	records[1].name = "";
+	records[1].error_code = -13;
+	records[1].epoch = -1;
+	records[1].magic_token = ULONG_MAX;
+	records[1].net_family = "inet";
+	records[1].net_local_port = 57634;
+
+	/* nothing but the defaults */
+	_init_log_record(&records[2]);
+}
+
+static int test_round_trip(void)
+{
+	aa_log_record records[3], record;
+	aa_log_writer *writer;
+	aa_log_reader *reader;
+	struct stat st;
+	FILE *f;
+	int i, rc = 0;
+
+	fill_records(records);
+	f = tmpfile();
+	if (!f || aa_log_writer_new(&writer, fileno(f)) == -1)
+		return 1;
+	for (i = 0; i < 3; i++)
+		MY_TEST(aa_log_writer_add(writer, &records[i]) == 0,
+			"writer add");
+	MY_TEST(aa_log_writer_free(writer) == 0, "writer free");
+
+	MY_TEST(fstat(fileno(f), &st) == 0 && st.st_size < 200,
+		"records are compact");
+
+	MY_TEST(aa_log_reader_new(&reader, fileno(f)) == 0, "reader new");
+	if (rc)
+		return rc;
+	for (i = 0; i < 3; i++) {
+		MY_TEST(aa_log_reader_next(reader, &record) == 1,
+			"reader next");
+		MY_TEST(records_equal(&record, &records[i]),
+			"record round trip");
+	}
+	MY_TEST(aa_log_reader_next(reader, &record) == 0, "reader at end");
+	aa_log_reader_free(reader);
+	fclose(f);
+
+	return rc;
+}
+
+static int test_interning(void)
+{
+	aa_log_record records[3];
+	aa_log_writer *writer;
+	struct stat one, two, many;
+	off_t first, repeat;
+	FILE *f;
+	int i, rc = 0;
+
+	fill_records(records);
+	f = tmpfile();
+	if (!f || aa_log_writer_new(&writer, fileno(f)) == -1)
+		return 1;
+	aa_log_writer_add(writer, &records[0]);
+	aa_log_writer_flush(writer);
+	fstat(fileno(f), &one);
+	aa_log_writer_add(writer, &records[0]);
+	aa_log_writer_flush(writer);
+	fstat(fileno(f), &two);
+	for (i = 0; i < 100; i++)
+		aa_log_writer_add(writer, &records[0]);
+	aa_log_writer_free(writer);
+	fstat(fileno(f), &many);
+	fclose(f);
+
+	first = one.st_size - EVENTS_HEADER_SIZE;
+	repeat = two.st_size - one.st_size;
+	MY_TEST(many.st_size - two.st_size == 100 * repeat,
+		"repeated records are the same size");
+	/* the first record also defines "open", "r", "/usr/sbin/cupsd"
+	 * and "ls", each with an entry type, a length and a NUL
+	 */
+	MY_TEST(first - repeat == 4 * 3 + 4 + 1 + 15 + 2,
+		"interned strings are written once");
+
+	return rc;
+}
+
+static int read_bad_file(const char *data, size_t size, int *error)
+{
+	aa_log_reader *reader;
+	aa_log_record record;
+	FILE *f = tmpfile();
+	int rc;
+
+	if (!f)
+		return -2;
+	fwrite(data, 1, size, f);
+	fflush(f);
+
+	rc = aa_log_reader_new(&reader, fileno(f));
+	if (rc == 0) {
+		while ((rc = aa_log_reader_next(reader, &record)) == 1)
+			;
+		aa_log_reader_free(reader);
+	}
+	*error = errno;
+	fclose(f);
+
+	return rc;
+}
+
+static int test_bad_files(void)
+{
+	int error, rc = 0;
+
+	MY_TEST(read_bad_file("AAEV", 4, &error) == -1 && error == EBADMSG,
+		"short file");
+	MY_TEST(read_bad_file("XXEV\1\0\0\0", 8, &error) == -1 &&
+		error == EBADMSG, "bad magic");
+	MY_TEST(read_bad_file("AAEV\2\0\0\0", 8, &error) == -1 &&
+		error == EPROTONOSUPPORT, "newer version");
+	MY_TEST(read_bad_file("AAEV\1\0\0\0", 8, &error) == 0,
+		"no records");
+	MY_TEST(read_bad_file("AAEV\1\0\0\0\3", 9, &error) == -1 &&
+		error == EBADMSG, "unknown entry");
+	MY_TEST(read_bad_file("AAEV\1\0\0\0\1\5ab", 12, &error) == -1 &&
+		error == EBADMSG, "truncated string");
+	MY_TEST(read_bad_file("AAEV\1\0\0\0\1\2abc", 13, &error) == -1 &&
+		error == EBADMSG, "unterminated string");
+	/* profile refers to string 2, only string 1 is defined */
+	MY_TEST(read_bad_file("AAEV\1\0\0\0\1\1a\0\2\x80\x80\2\2", 17,
+			      &error) == -1 && error == EBADMSG,
+		"undefined string");
+	MY_TEST(read_bad_file("AAEV\1\0\0\0\1\1a\0\2\x80\x80\2\1", 17,
+			      &error) == 0, "defined string");
+
+	return rc;
+}
+
+int main(void)
+{
+	int retval, rc = 0;
+
+	retval = test_varint();
+	if (retval)
+		rc = retval;
+
+	retval = test_round_trip();
+	if (retval)
+		rc = retval;
+
+	retval = test_interning();
+	if (retval)
+		rc = retval;
+
+	retval = test_bad_files();
+	if (retval)
+		rc = retval;
+
+	return rc;
+}
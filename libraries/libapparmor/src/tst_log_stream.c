@@ -0,0 +1,249 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General
+ * Public License published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log_stream.c"
+#include "private.h"
+
+#define AVC "type=AVC msg=audit(1279948288.415:39): apparmor=\"DENIED\" operation=\"open\" profile=\"/usr/sbin/cupsd\" name=\"/home/user/.ssh/\" pid=12333 comm=\"ls\" requested_mask=\"r\" denied_mask=\"r\" fsuid=0 ouid=1000"
+#define OLD_STYLE "Oct 29 08:00:01 jory01-ubuntu kernel: type=1502 audit(1225263601.980:37699): operation=\"inode_permission\" requested_mask=\"r::\" denied_mask=\"r::\" name=\"/usr/lib/foo\" pid=2398 profile=\"/usr/sbin/foo\""
+#define SYSCALL "type=SYSCALL msg=audit(1279948288.415:39): arch=c000003e syscall=2 success=no exit=-13 a0=7f3d8c2c7f58 items=0 ppid=12332 pid=12333 comm=\"ls\" exe=\"/bin/ls\""
+#define SELINUX "type=AVC msg=audit(1279948288.415:40): avc:  denied  { read } for  pid=12333 comm=\"ls\" name=\"foo\" scontext=system_u:system_r:foo_t tcontext=system_u:object_r:bar_t tclass=file"
+#define KMSG "5,1234,4584703379,-;audit: type=1400 audit(1459371218.613:110): apparmor=\"ALLOWED\" operation=\"exec\" profile=\"/usr/bin/foo\" name=\"/bin/true\" pid=4815 comm=\"foo\" requested_mask=\"x\" denied_mask=\"x\" fsuid=0 ouid=0"
+
+static int do_test_is_candidate(const char *line, bool expected,
+				const char *error)
+{
+	int rc = 0;
+
+	MY_TEST(is_candidate(line, strlen(line)) == expected, error);
+
+	return rc;
+}
+
+static int test_is_candidate(void)
+{
+	int rc = 0;
+
+	rc |= do_test_is_candidate(AVC, true, "apparmor= record");
+	rc |= do_test_is_candidate(OLD_STYLE, true, "type=1502 record");
+	rc |= do_test_is_candidate("type=APPARMOR msg=audit(1164007073.953:518): LOGPROF-HINT changing_profile pid=29420",
+				   true, "type=APPARMOR record");
+	rc |= do_test_is_candidate(KMSG, true, "kmsg record");
+	rc |= do_test_is_candidate(SYSCALL, false, "SYSCALL record");
+	rc |= do_test_is_candidate(SELINUX, false, "SELinux record");
+	rc |= do_test_is_candidate("type=15", false, "truncated type");
+	rc |= do_test_is_candidate("", false, "empty line");
+
+	return rc;
+}
+
+static int do_test_kmsg_to_dmesg(const char *line, ssize_t expected_len,
+				 const char *expected, const char *error)
+{
+	char buf[256];
+	ssize_t len;
+	int rc = 0;
+
+	len = kmsg_to_dmesg(line, strlen(line), buf, sizeof(buf));
+	MY_TEST(len == expected_len, error);
+	if (expected && len == expected_len)
+		MY_TEST(strcmp(buf, expected) == 0, error);
+
+	return rc;
+}
+
+static int test_kmsg_to_dmesg(void)
+{
+	int rc = 0;
+
+	rc |= do_test_kmsg_to_dmesg("6,1,4584703379,-;audit: type=1400", 31,
+				    "[ 4584.703379] audit: type=1400",
+				    "kmsg record");
+	rc |= do_test_kmsg_to_dmesg("6,1,12;msg", 18, "[    0.000012] msg",
+				    "kmsg record without flags");
+	rc |= do_test_kmsg_to_dmesg("6,1,123456789012,-,caller=T1;m", 17,
+				    "[123456.789012] m",
+				    "kmsg record with more fields");
+	rc |= do_test_kmsg_to_dmesg(AVC, -1, NULL, "audit record");
+	rc |= do_test_kmsg_to_dmesg("6,1,12", -1, NULL, "truncated header");
+	rc |= do_test_kmsg_to_dmesg("6,1,x;msg", -1, NULL, "bad timestamp");
+
+	return rc;
+}
+
+struct stream_result {
+	int batches;
+	int records;
+	int denied;
+	int allowed;
+	bool exec_profile;
+};
+
+static int count_records(aa_log_record *records, size_t count, void *data)
+{
+	struct stream_result *result = data;
+	size_t i;
+
+	result->batches++;
+	for (i = 0; i < count; i++) {
+		result->records++;
+		if (records[i].event == AA_RECORD_DENIED)
+			result->denied++;
+		if (records[i].event == AA_RECORD_ALLOWED) {
+			result->allowed++;
+			if (records[i].profile &&
+			    strcmp(records[i].profile, "/usr/bin/foo") == 0)
+				result->exec_profile = true;
+		}
+	}
+
+	return 0;
+}
+
+/* records whose name is a run of a single letter, its length varying */
+static int check_long_names(aa_log_record *records, size_t count, void *data)
+{
+	struct stream_result *result = data;
+	size_t i, len;
+
+	result->batches++;
+	for (i = 0; i < count; i++) {
+		result->records++;
+		if (!records[i].name || !records[i].profile ||
+		    strcmp(records[i].profile, "/usr/sbin/cupsd") != 0)
+			continue;
+		len = strspn(records[i].name, "x");
+		if (len > 0 && records[i].name[len] == '\0')
+			result->denied++;
+	}
+
+	return 0;
+}
+
+static int stop_parsing(aa_log_record *records, size_t count, void *data)
+{
+	return 42;
+}
+
+/* parse @lines, written to a file, with aa_log_parse_stream() */
+static int parse_lines(const char *lines, aa_log_stream_callback callback,
+		       struct stream_result *result)
+{
+	FILE *f = tmpfile();
+	int rc;
+
+	if (!f)
+		return -1;
+	fputs(lines, f);
+	fflush(f);
+	rewind(f);
+
+	memset(result, 0, sizeof(*result));
+	rc = aa_log_parse_stream(fileno(f), callback, result);
+	fclose(f);
+
+	return rc;
+}
+
+static int test_parse_stream(void)
+{
+	struct stream_result result;
+	char *lines, *name;
+	size_t size;
+	FILE *f;
+	int i, rc = 0;
+
+	MY_TEST(parse_lines(SYSCALL "\n" AVC "\n" SELINUX "\n" OLD_STYLE "\n"
+			    KMSG, count_records, &result) == 0,
+		"parse stream");
+	MY_TEST(result.records == 3, "parse stream records");
+	MY_TEST(result.denied == 1, "parse stream denied record");
+	MY_TEST(result.allowed == 1 && result.exec_profile,
+		"parse stream kmsg record");
+	MY_TEST(result.batches == 1, "parse stream batches");
+
+	MY_TEST(parse_lines(SYSCALL "\n" SELINUX "\n", count_records,
+			    &result) == 0 && result.batches == 0,
+		"parse stream without records");
+
+	MY_TEST(parse_lines(AVC "\n", stop_parsing, &result) == 42,
+		"parse stream stopped by callback");
+
+	/* more records than fit in a batch or in a block */
+	f = open_memstream(&lines, &size);
+	if (!f)
+		return 1;
+	for (i = 0; i < 1000; i++)
+		fputs(AVC "\n" SYSCALL "\n", f);
+	fclose(f);
+	MY_TEST(parse_lines(lines, count_records, &result) == 0,
+		"parse stream many records");
+	MY_TEST(result.records == 1000 && result.denied == 1000,
+		"parse stream many records count");
+	MY_TEST(result.batches == (1000 + LOG_BATCH_SIZE - 1) / LOG_BATCH_SIZE,
+		"parse stream many records batches");
+	free(lines);
+
+	/* records that fill the batch buffer before the batch is full,
+	 * so lines run out of room part way through, and a record larger
+	 * than the whole buffer
+	 */
+	name = malloc(2 * LOG_ARENA_SIZE);
+	f = open_memstream(&lines, &size);
+	if (!name || !f)
+		return 1;
+	memset(name, 'x', 2 * LOG_ARENA_SIZE);
+	for (i = 0; i < 300; i++) {
+		fprintf(f, "type=AVC msg=audit(1279948288.415:%d): apparmor=\"DENIED\" operation=\"open\" profile=\"/usr/sbin/cupsd\" name=\"%.*s\" pid=12333 comm=\"ls\" requested_mask=\"r\" denied_mask=\"r\" fsuid=0 ouid=1000\n",
+			i, i == 150 ? 2 * LOG_ARENA_SIZE : 500 + i * 3, name);
+	}
+	fclose(f);
+	free(name);
+	MY_TEST(parse_lines(lines, check_long_names, &result) == 0,
+		"parse stream long records");
+	MY_TEST(result.records == 300 && result.denied == 300,
+		"parse stream long records intact");
+	MY_TEST(result.batches > 300 / LOG_BATCH_SIZE + 1,
+		"parse stream long records batches");
+	free(lines);
+
+	MY_TEST(aa_log_parse_stream(-1, count_records, &result) == -1 &&
+		errno == EINVAL, "parse stream bad fd");
+
+	return rc;
+}
+
+int main(void)
+{
+	int retval, rc = 0;
+
+	retval = test_is_candidate();
+	if (retval)
+		rc = retval;
+
+	retval = test_kmsg_to_dmesg();
+	if (retval)
+		rc = retval;
+
+	retval = test_parse_stream();
+	if (retval)
+		rc = retval;
+
+	return rc;
+}
@@ -0,0 +1,243 @@
+/*
+ *   Copyright (c) 2026
+ *   Canonical, Ltd. (All rights reserved)
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of version 2 of the GNU General Public
+ *   License published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, contact Novell, Inc. or Canonical
+ *   Ltd.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "private.h"
+
+#include "match.c"
+
+/*
+ * A small dfa matching "ab", built by hand:
+ *   state 0 - nomatch
+ *   state 1 - start, 'a' -> 2
+ *   state 2 - 'b' -> 3
+ *   state 3 - accepting (perms 0x4), out of band transition -> 1
+ */
+#define TEST_STATES	4
+#define TEST_TRANS	(TEST_STATES + 256)
+
+struct test_dfa {
+	uint32_t accept[TEST_STATES];
+	uint32_t accept2[TEST_STATES];
+	uint32_t base[TEST_STATES];
+	uint32_t def[TEST_STATES];
+	uint32_t next[TEST_TRANS];
+	uint32_t check[TEST_TRANS];
+};
+
+static void init_test_dfa(struct test_dfa *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->base[1] = 1;
+	t->next[1 + 'a'] = 2;
+	t->check[1 + 'a'] = 1;
+	t->base[2] = 2;
+	t->next[2 + 'b'] = 3;
+	t->check[2 + 'b'] = 2;
+	t->base[3] = 3 | MATCH_FLAG_OOB_TRANSITION;
+	t->next[3 - 1] = 1;
+	t->check[3 - 1] = 3;
+	t->accept[3] = 0x4;
+	t->accept2[3] = 0x4;
+}
+
+static void put_be(unsigned char *p, uint32_t v, size_t width)
+{
+	size_t i;
+
+	for (i = 0; i < width; i++)
+		p[i] = v >> (8 * (width - 1 - i));
+}
+
+static size_t put_table(unsigned char *p, uint16_t id, size_t width,
+			const uint32_t *data, size_t len)
+{
+	size_t i;
+
+	memset(p, 0, TABLE_HEADER_SIZE);
+	put_be(p, id, 2);
+	put_be(p + 2, width, 2);
+	put_be(p + 8, len, 4);
+	for (i = 0; i < len; i++)
+		put_be(p + TABLE_HEADER_SIZE + i * width, data[i], width);
+
+	return pad64(TABLE_HEADER_SIZE + len * width);
+}
+
+static size_t build_blob(unsigned char *buf, struct test_dfa *t,
+			 size_t width, uint16_t flags)
+{
+	size_t hsize = pad64(TABLE_SET_HEADER_SIZE + 1);
+	size_t pos = hsize;
+
+	memset(buf, 0, hsize);
+	put_be(buf, YYTH_REGEX_MAGIC, 4);
+	put_be(buf + 4, hsize, 4);
+	put_be(buf + 12, flags, 2);
+
+	pos += put_table(buf + pos, YYTD_ID_ACCEPT, 4, t->accept, TEST_STATES);
+	pos += put_table(buf + pos, YYTD_ID_ACCEPT2, 4, t->accept2,
+			 TEST_STATES);
+	pos += put_table(buf + pos, YYTD_ID_BASE, 4, t->base, TEST_STATES);
+	pos += put_table(buf + pos, YYTD_ID_DEF, width, t->def, TEST_STATES);
+	pos += put_table(buf + pos, YYTD_ID_NXT, width, t->next, TEST_TRANS);
+	pos += put_table(buf + pos, YYTD_ID_CHK, width, t->check, TEST_TRANS);
+	put_be(buf + 8, pos, 4);
+
+	return pos;
+}
+
+static int test_match_width(size_t width)
+{
+	unsigned char buf[8192];
+	struct test_dfa t;
+	struct aa_dfa *dfa;
+	size_t size;
+	int rc = 0;
+
+	init_test_dfa(&t);
+	size = build_blob(buf, &t, width, YYTH_FLAG_OOB_TRANS);
+	dfa = aa_dfa_unpack(buf, size);
+	MY_TEST(dfa, "unpack");
+	if (!dfa)
+		return 1;
+
+	MY_TEST(aa_dfa_state_count(dfa) == TEST_STATES, "state count");
+	MY_TEST(aa_dfa_match(dfa, DFA_START, "ab") == 3, "match ab");
+	MY_TEST(aa_dfa_accept(dfa, 3) == 0x4, "accept ab");
+	MY_TEST(aa_dfa_accept2(dfa, 3) == 0x4, "accept2 ab");
+	MY_TEST(aa_dfa_match(dfa, DFA_START, "a") == 2, "match a");
+	MY_TEST(aa_dfa_match(dfa, DFA_START, "abc") == DFA_NOMATCH,
+		"match abc");
+	MY_TEST(aa_dfa_match(dfa, DFA_START, "b") == DFA_NOMATCH, "match b");
+	MY_TEST(aa_dfa_match_len(dfa, DFA_START, "ab\0", 3) == DFA_NOMATCH,
+		"match_len ab\\0");
+	MY_TEST(aa_dfa_next(dfa, 2, 'b') == 3, "next b");
+	MY_TEST(aa_dfa_outofband_transition(dfa, 3) == 1, "oob from accept");
+	MY_TEST(aa_dfa_outofband_transition(dfa, 2) == DFA_NOMATCH,
+		"no oob transition");
+
+	aa_dfa_free(dfa);
+
+	return rc;
+}
+
+static int test_diff_encode(void)
+{
+	unsigned char buf[8192];
+	struct test_dfa t;
+	struct aa_dfa *dfa;
+	size_t size;
+	int rc = 0;
+
+	/* state 2 only has its own 'b' transition, everything else comes
+	 * from the start state it is relative to
+	 */
+	init_test_dfa(&t);
+	t.base[2] |= MATCH_FLAG_DIFF_ENCODE;
+	t.def[2] = 1;
+	size = build_blob(buf, &t, 2,
+			  YYTH_FLAG_OOB_TRANS | YYTH_FLAG_DIFF_ENCODE);
+	dfa = aa_dfa_unpack(buf, size);
+	MY_TEST(dfa, "unpack diff encoded");
+	if (!dfa)
+		return 1;
+	MY_TEST(aa_dfa_match(dfa, DFA_START, "ab") == 3, "diff match ab");
+	MY_TEST(aa_dfa_match(dfa, DFA_START, "aa") == 2, "diff match aa");
+	MY_TEST(aa_dfa_match(dfa, DFA_START, "ac") == DFA_NOMATCH,
+		"diff match ac");
+	aa_dfa_free(dfa);
+
+	/* a state diff encoded against itself must be rejected */
+	t.def[2] = 2;
+	size = build_blob(buf, &t, 2,
+			  YYTH_FLAG_OOB_TRANS | YYTH_FLAG_DIFF_ENCODE);
+	dfa = aa_dfa_unpack(buf, size);
+	MY_TEST(!dfa, "diff encode loop");
+	aa_dfa_free(dfa);
+
+	return rc;
+}
+
+static int test_bad_tables(void)
+{
+	unsigned char buf[8192];
+	struct test_dfa t;
+	struct aa_dfa *dfa;
+	size_t size;
+	int rc = 0;
+
+	init_test_dfa(&t);
+	size = build_blob(buf, &t, 2, YYTH_FLAG_OOB_TRANS);
+	buf[0] ^= 0xff;
+	dfa = aa_dfa_unpack(buf, size);
+	MY_TEST(!dfa, "bad magic");
+	aa_dfa_free(dfa);
+
+	size = build_blob(buf, &t, 2, YYTH_FLAG_OOB_TRANS);
+	dfa = aa_dfa_unpack(buf, size - 1);
+	MY_TEST(!dfa, "truncated");
+	aa_dfa_free(dfa);
+
+	t.next[5] = TEST_STATES;
+	size = build_blob(buf, &t, 2, YYTH_FLAG_OOB_TRANS);
+	dfa = aa_dfa_unpack(buf, size);
+	MY_TEST(!dfa, "next state out of range");
+	aa_dfa_free(dfa);
+
+	init_test_dfa(&t);
+	t.base[1] = TEST_TRANS;
+	size = build_blob(buf, &t, 2, YYTH_FLAG_OOB_TRANS);
+	dfa = aa_dfa_unpack(buf, size);
+	MY_TEST(!dfa, "base out of range");
+	aa_dfa_free(dfa);
+
+	init_test_dfa(&t);
+	size = build_blob(buf, &t, 2, 0);
+	dfa = aa_dfa_unpack(buf, size);
+	MY_TEST(!dfa, "oob transition without header flag");
+	aa_dfa_free(dfa);
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc = 0;
+	int retval;
+
+	retval = test_match_width(YYTD_DATA16);
+	if (retval != 0)
+		rc = retval;
+
+	retval = test_match_width(YYTD_DATA32);
+	if (retval != 0)
+		rc = retval;
+
+	retval = test_diff_encode();
+	if (retval != 0)
+		rc = retval;
+
+	retval = test_bad_tables();
+	if (retval != 0)
+		rc = retval;
+
+	return rc;
+}
@@ -8,6 +8,29 @@
 %}
 
 %include "typemaps.i"
+
+/* parse_record_r() writes into a caller provided buffer,
+ * aa_log_parse_stream() calls back into C, and the aggregate and the
+ * binary event format hand out pointers into their own memory, which do
+ * not map to script languages, they use parse_record()
+ */
+%ignore aa_log_parse_state_new;
+%ignore aa_log_parse_state_free;
+%ignore parse_record_r;
+%ignore aa_log_parse_stream;
+%ignore aa_log_aggregate_new;
+%ignore aa_log_aggregate_free;
+%ignore aa_log_aggregate_add_record;
+%ignore aa_log_aggregate_add_file;
+%ignore aa_log_aggregate_get_counts;
+%ignore aa_log_writer_new;
+%ignore aa_log_writer_add;
+%ignore aa_log_writer_add_log;
+%ignore aa_log_writer_flush;
+%ignore aa_log_writer_free;
+%ignore aa_log_reader_new;
+%ignore aa_log_reader_next;
+%ignore aa_log_reader_free;
 %include <aalogparse.h>
 
 /**
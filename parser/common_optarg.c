@@ -89,6 +89,9 @@ optflag_table_t optflag_table[] = {
 	{ 2, "expr-right-simplify", "right simplification first",
 	  DFA_CONTROL_TREE_LEFT },
 	{ 1, "minimize", "dfa state minimization", DFA_CONTROL_MINIMIZE },
+	{ 1, "minimize-hopcroft",
+	  "use hopcroft partition refinement for dfa minimization",
+	  DFA_CONTROL_MINIMIZE_HOPCROFT },
 	{ 1, "filter-deny", "filter out deny information from final dfa",
 	  DFA_CONTROL_FILTER_DENY },
 	{ 1, "remove-unreachable", "dfa unreachable state removal",
@@ -100,6 +103,10 @@ optflag_table_t optflag_table[] = {
 	  DFA_CONTROL_TRANS_HIGH },
 	{ 1, "diff-encode", "Differentially encode transitions",
 	  DFA_CONTROL_DIFF_ENCODE },
+	{ 1, "parallel-build", "use multiple threads for dfa creation",
+	  DFA_CONTROL_PARALLEL_BUILD },
+	{ 1, "fragment-cache", "cache the dfas of rule sets in the policy cache",
+	  DFA_CONTROL_FRAGMENT_CACHE },
 	{ 0, NULL, NULL, 0 },
 };
 
@@ -18,13 +18,50 @@
 #ifndef __AA_FILE_CACHE_H
 #define __AA_FILE_CACHE_H
 
+#include <map>
 #include <set>
 #include <string>
+#include <vector>
+
+#include <sys/stat.h>
 
 using namespace std;
 
-/* TODO: have includecache be a frontend for file cache, don't just
- * store name.
+/* a policy file as read from disk, directories only keep their stat */
+struct cached_file {
+	struct stat st;
+	string data;
+};
+
+/*
+ * FileCache_t - contents of the policy files read during a parser run
+ *
+ * Most profiles include the same abstractions, so their contents are
+ * kept for the whole run instead of being reread for every profile.
+ * Lookups stat() the file and reread it if it changed since it was
+ * cached.
+ */
+class FileCache_t {
+public:
+	map<string, cached_file *> cache;
+	vector<cached_file *> stale;	/* replaced by a newer version */
+	size_t size;			/* bytes of file contents cached */
+
+	FileCache_t(): cache(), stale(), size(0) { };
+	virtual ~FileCache_t()
+	{
+		for (map<string, cached_file *>::iterator i = cache.begin();
+		     i != cache.end(); i++)
+			delete i->second;
+		for (size_t i = 0; i < stale.size(); i++)
+			delete stale[i];
+	}
+
+	cached_file *get(const char *path);
+};
+
+/* the files included by the profile being compiled, so each is only
+ * included once. Their contents come from the FileCache_t.
  */
 class IncludeCache_t {
 public:
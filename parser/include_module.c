@@ -0,0 +1,310 @@
+/*
+ *   Copyright (c) 2026
+ *   Canonical, Ltd. (All rights reserved)
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of version 2 of the GNU General Public
+ *   License published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, contact Canonical Ltd.
+ */
+
+/*
+ * Precompiled include modules, see include_module.h
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "parser.h"
+#include "parser_version.h"
+#include "profile.h"
+#include "parser_yacc.h"
+#include "include_module.h"
+
+#define MODULE_MAGIC		"AAINCMOD"
+#define MODULE_VERSION		2
+#define MODULE_BYTE_ORDER	0x01020304
+
+/* sanity limit on the size of modules read back */
+#define MODULE_MAX_ITEMS	(1 << 24)
+
+/* like dfa fragments, modules are only read back by the machine that
+ * wrote them, so are stored in host byte order
+ */
+struct module_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t tokens;	/* fingerprint of the parser, token_fingerprint */
+	uint64_t source_len;
+	uint64_t items;
+	uint64_t values_len;
+};
+
+struct module_record {
+	int32_t token;
+	int32_t lineno;
+	uint32_t flags;
+	uint32_t value_len;
+};
+
+/**
+ * module_token_value - find where the lexer returns the value of @token
+ * @token: token returned by the lexer
+ *
+ * Returns: pointer to the member of yylval holding the token's value, or
+ *          NULL if the token has no value
+ */
+char **module_token_value(int token)
+{
+	switch (token) {
+	case TOK_ID:
+	case TOK_CONDID:
+	case TOK_CONDLISTID:
+		return &yylval.id;
+	case TOK_MODE:
+		return &yylval.mode;
+	case TOK_SET_VAR:
+		return &yylval.set_var;
+	case TOK_BOOL_VAR:
+		return &yylval.bool_var;
+	case TOK_VALUE:
+		return &yylval.var_val;
+	}
+
+	return NULL;
+}
+
+void IncludeModule::add_token(int token, int lineno)
+{
+	struct module_item item = { token, lineno, 0, "" };
+	char **value = module_token_value(token);
+
+	if (value && *value)
+		item.value = *value;
+	items.push_back(item);
+}
+
+void IncludeModule::add_include(const char *filename, int search,
+				bool if_exists, int lineno)
+{
+	struct module_item item = { MODULE_INCLUDE, lineno, 0, filename };
+
+	if (search)
+		item.flags |= MODULE_SEARCH;
+	if (if_exists)
+		item.flags |= MODULE_IF_EXISTS;
+	items.push_back(item);
+}
+
+/* FNV-1a hash of @data */
+static uint64_t module_hash(const string &data)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (string::const_iterator i = data.begin(); i != data.end(); i++) {
+		hash ^= (unsigned char) *i;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* fingerprint of what turns a file into tokens and reads them back: the
+ * parser release, the scanner's tables and the grammar's token numbering
+ */
+static uint64_t token_fingerprint(void)
+{
+	static uint64_t fingerprint = module_hash(string(PARSER_VERSION "\n") +
+						  lexer_state_table() +
+						  parser_token_table());
+
+	return fingerprint;
+}
+
+ModuleCache::~ModuleCache()
+{
+	for (map<struct cached_file *, IncludeModule *>::iterator i = modules.begin();
+	     i != modules.end(); i++)
+		delete i->second;
+}
+
+void ModuleCache::set_dir(const char *dir, bool readable, bool writable)
+{
+	this->dir = dir;
+	this->readable = readable;
+	this->writable = writable;
+}
+
+string ModuleCache::path(const string &source)
+{
+	char name[17];
+
+	snprintf(name, sizeof(name), "%016llx",
+		 (unsigned long long) module_hash(source));
+	return dir + "/" + name;
+}
+
+/* read back the module stored for @source, NULL if there is no valid one */
+IncludeModule *ModuleCache::load(const string &source)
+{
+	const struct module_header *h;
+	const struct module_record *rec;
+	IncludeModule *module = NULL;
+	string data;
+	const char *values, *end;
+	struct stat st;
+	size_t size;
+	uint64_t i;
+	int fd;
+
+	fd = open(path(source).c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(*h)) {
+		close(fd);
+		return NULL;
+	}
+	data.resize(st.st_size);
+	size = read(fd, &data[0], data.size());
+	close(fd);
+	if (size != data.size())
+		return NULL;
+
+	h = (const struct module_header *) data.data();
+	if (memcmp(h->magic, MODULE_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->version != MODULE_VERSION ||
+	    h->byte_order != MODULE_BYTE_ORDER ||
+	    h->tokens != token_fingerprint() ||
+	    h->source_len != source.size() ||
+	    h->items > MODULE_MAX_ITEMS ||
+	    data.size() != sizeof(*h) + h->source_len +
+			   h->items * sizeof(*rec) + h->values_len ||
+	    data.compare(sizeof(*h), source.size(), source) != 0)
+		return NULL;
+
+	rec = (const struct module_record *) (data.data() + sizeof(*h) +
+					      source.size());
+	values = (const char *) (rec + h->items);
+	end = data.data() + data.size();
+	module = new IncludeModule;
+	module->items.resize(h->items);
+	for (i = 0; i < h->items; i++, rec++) {
+		struct module_item &item = module->items[i];
+
+		if (rec->value_len > (size_t) (end - values)) {
+			delete module;
+			return NULL;
+		}
+		item.token = rec->token;
+		item.lineno = rec->lineno;
+		item.flags = rec->flags;
+		item.value.assign(values, rec->value_len);
+		values += rec->value_len;
+	}
+
+	return module;
+}
+
+/* store @module for @source, failures just mean it is lexed next time */
+void ModuleCache::store(const string &source, IncludeModule &module)
+{
+	struct module_header h;
+	struct module_record rec;
+	string name, tmpname;
+	size_t i;
+	bool ok;
+	FILE *f;
+	int fd;
+
+	name = path(source);
+	tmpname = name + ".XXXXXX";
+	fd = mkstemp(&tmpname[0]);
+	if (fd == -1)
+		return;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmpname.c_str());
+		return;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MODULE_MAGIC, sizeof(h.magic));
+	h.version = MODULE_VERSION;
+	h.byte_order = MODULE_BYTE_ORDER;
+	h.tokens = token_fingerprint();
+	h.source_len = source.size();
+	h.items = module.items.size();
+	for (i = 0; i < module.items.size(); i++)
+		h.values_len += module.items[i].value.size();
+
+	ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+		fwrite(source.data(), 1, source.size(), f) == source.size();
+	for (i = 0; ok && i < module.items.size(); i++) {
+		rec.token = module.items[i].token;
+		rec.lineno = module.items[i].lineno;
+		rec.flags = module.items[i].flags;
+		rec.value_len = module.items[i].value.size();
+		ok = fwrite(&rec, sizeof(rec), 1, f) == 1;
+	}
+	for (i = 0; ok && i < module.items.size(); i++) {
+		const string &value = module.items[i].value;
+		ok = fwrite(value.data(), 1, value.size(), f) == value.size();
+	}
+	if (fclose(f) != 0)
+		ok = false;
+	if (!ok || rename(tmpname.c_str(), name.c_str()) == -1)
+		unlink(tmpname.c_str());
+}
+
+/**
+ * find - look up the module for the contents of @file
+ *
+ * Returns: the module, owned by the cache, or NULL if the file has to be
+ *          lexed
+ */
+IncludeModule *ModuleCache::find(struct cached_file *file)
+{
+	map<struct cached_file *, IncludeModule *>::iterator i;
+	IncludeModule *module = NULL;
+
+	i = modules.find(file);
+	if (i != modules.end()) {
+		module = i->second;
+	} else {
+		if (readable && !dir.empty())
+			module = load(file->data);
+		/* remember misses too, so the disk is only checked once */
+		modules[file] = module;
+	}
+
+	if (module)
+		hits++;
+	else
+		misses++;
+	return module;
+}
+
+/* add @module lexed from @file, the cache takes ownership of @module */
+void ModuleCache::insert(struct cached_file *file, IncludeModule *module)
+{
+	IncludeModule *&entry = modules[file];
+
+	if (entry == module)
+		return;
+	delete entry;
+	entry = module;
+	if (writable && !dir.empty())
+		store(file->data, *module);
+}
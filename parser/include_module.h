@@ -0,0 +1,94 @@
+/*
+ *   Copyright (c) 2026
+ *   Canonical, Ltd. (All rights reserved)
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of version 2 of the GNU General Public
+ *   License published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, contact Canonical Ltd.
+ */
+
+#ifndef __AA_INCLUDE_MODULE_H
+#define __AA_INCLUDE_MODULE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "file_cache.h"
+
+using namespace std;
+
+/* module_item.token for an include directive in the included file */
+#define MODULE_INCLUDE		(-1)
+
+/* module_item.flags of a MODULE_INCLUDE */
+#define MODULE_SEARCH		0x1	/* include <name> */
+#define MODULE_IF_EXISTS	0x2	/* include if exists */
+
+struct module_item {
+	int token;
+	int lineno;		/* current_lineno when it was lexed */
+	unsigned int flags;
+	string value;		/* token value, or the file to include */
+};
+
+/*
+ * IncludeModule - an included file, precompiled into the tokens the
+ * lexer returned for it
+ *
+ * Replaying the tokens gives the grammar exactly the input that lexing
+ * the file does. Includes in the file are kept as directives, not
+ * expanded, as whether they are skipped as a reinclude depends on the
+ * profile the module is included in.
+ */
+class IncludeModule {
+public:
+	vector<struct module_item> items;
+
+	void add_token(int token, int lineno);
+	void add_include(const char *filename, int search, bool if_exists,
+			 int lineno);
+};
+
+/*
+ * ModuleCache - the IncludeModules of the files included during a run
+ *
+ * Modules are kept in memory for the whole run, and stored in the policy
+ * cache so later runs do not have to lex the file again. Modules are
+ * keyed by the contents of the file, so an edited file simply misses,
+ * and by the parser version, scanner tables and grammar's token
+ * numbering, so a module is never replayed to a different parser.
+ */
+class ModuleCache {
+	string dir;
+	bool readable;
+	bool writable;
+	map<struct cached_file *, IncludeModule *> modules;
+
+	string path(const string &source);
+	IncludeModule *load(const string &source);
+	void store(const string &source, IncludeModule &module);
+public:
+	ModuleCache(): dir(), readable(false), writable(false), modules(),
+		       hits(0), misses(0) { }
+	virtual ~ModuleCache();
+
+	void set_dir(const char *dir, bool readable, bool writable);
+	IncludeModule *find(struct cached_file *file);
+	void insert(struct cached_file *file, IncludeModule *module);
+
+	unsigned long hits;
+	unsigned long misses;
+};
+
+char **module_token_value(int token);
+
+#endif /* __AA_INCLUDE_MODULE_H */
@@ -22,7 +22,8 @@
 #include <ostream>
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <memory>
+#include <algorithm>
 #include <ext/stdio_filebuf.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -32,8 +33,28 @@
 #include "parse.h"
 #include "hfa.h"
 #include "chfa.h"
+#include "fragment_cache.h"
 #include "../immunix.h"
 
+static FragmentCache *fragment_cache = NULL;
+
+/**
+ * aare_set_fragment_cache - set the directory used to cache dfa fragments
+ * @dir: the directory, or NULL to disable the fragment cache
+ * @writable: whether new fragments should be added to @dir
+ *
+ * Must be called before any dfa is created, the cache may then be used by
+ * several threads.  If @writable, the least recently used fragments are
+ * evicted if the directory has grown too big.
+ */
+void aare_set_fragment_cache(const char *dir, bool writable)
+{
+	delete fragment_cache;
+	fragment_cache = dir ? new FragmentCache(dir, writable) : NULL;
+	if (fragment_cache)
+		fragment_cache->prune(FRAGMENT_CACHE_MAX_SIZE);
+}
+
 
 aare_rules::~aare_rules(void)
 {
@@ -75,6 +96,7 @@ bool aare_rules::add_rule_vec(int deny, uint32_t perms, uint32_t audit,
 			      int count, const char **rulev, dfaflags_t flags,
 			      bool oob)
 {
+	ArenaScope scope(arena);
 	Node *tree = NULL, *accept;
 	int exact_match;
 
@@ -154,6 +176,7 @@ err:
 bool aare_rules::append_rule(const char *rule, bool oob, bool with_perm,
 			     dfaflags_t flags)
 {
+	ArenaScope scope(arena);
 	Node *tree = NULL;
 	if (regex_parse(&tree, rule))
 		return false;
@@ -190,6 +213,175 @@ bool aare_rules::append_rule(const char *rule, bool oob, bool with_perm,
 	return true;
 }
 
+/* build the dfa for @tree on its own, accepting with a placeholder node */
+static DFAFragment *build_fragment(Node *tree, dfaflags_t flags)
+{
+	/* the dfa is only needed until it is copied into the fragment, so
+	 * keep it out of the rule set's arena
+	 */
+	Arena arena;
+	ArenaScope scope(arena);
+	MatchFlag accept(1, 0);
+	CatNode *root = new CatNode(tree, &accept);
+	DFAFragment *fragment;
+
+	flags &= DFA_CONTROL_MINIMIZE | DFA_CONTROL_MINIMIZE_HOPCROFT |
+		DFA_CONTROL_PARALLEL_BUILD;
+	{
+		DFA dfa(root, flags, false);
+		if (flags & DFA_CONTROL_MINIMIZE)
+			dfa.minimize(flags);
+		fragment = new DFAFragment(dfa);
+	}
+
+	/* the subtree belongs to the rule set */
+	root->child[0] = root->child[1] = NULL;
+	delete root;
+
+	return fragment;
+}
+
+/*
+ * Rules are split into chunks that are built as separate fragments.  A
+ * chunk ends after a rule whose key hashes to a multiple of
+ * FRAGMENT_CHUNK_RULES, so where chunks end only depends on the rules at
+ * the end of them.  Adding, removing or editing a rule only changes the
+ * chunk it is in, and every other chunk is still found in the fragment
+ * cache.  FRAGMENT_CHUNK_MAX bounds the size of a chunk when no rule
+ * ends one.
+ */
+#define FRAGMENT_CHUNK_RULES	32
+#define FRAGMENT_CHUNK_MAX	256
+
+/* a chunk of the rules for one set of permissions */
+struct FragmentPart {
+	CatNode *node;		/* the chunk's rules, then the accept node */
+	string key;
+
+	FragmentPart(CatNode *node, const string &key): node(node), key(key) { }
+};
+
+/**
+ * split_fragments - split the rules for each set of permissions into chunks
+ * @expr_map: the rules to split, the trees are consumed if successful
+ * @parts: returns the chunks
+ *
+ * Returns: false if the rules can not be built from fragments, in which
+ *          case @expr_map is left unchanged
+ */
+static bool split_fragments(PermExprMap &expr_map, vector<FragmentPart> &parts)
+{
+	vector<vector<Node *> > rules(expr_map.size());
+	vector<vector<string> > keys(expr_map.size());
+	PermExprMap::iterator i;
+	size_t n;
+
+	/* the rules are chained by add_to_rules as ((r1 | r2) | r3) ..., check
+	 * that every one can be a fragment before touching the tree
+	 */
+	for (i = expr_map.begin(), n = 0; i != expr_map.end(); i++, n++) {
+		Node *t;
+		for (t = i->second; t->is_type(NODE_TYPE_ALT); t = t->child[0])
+			rules[n].push_back(t->child[1]);
+		rules[n].push_back(t);
+		std::reverse(rules[n].begin(), rules[n].end());
+
+		keys[n].resize(rules[n].size());
+		for (size_t j = 0; j < rules[n].size(); j++) {
+			if (!fragment_key(rules[n][j], keys[n][j]))
+				return false;
+		}
+	}
+
+	for (i = expr_map.begin(), n = 0; i != expr_map.end(); i++, n++) {
+		Node *t = i->second, *chunk = NULL;
+		string key;
+		size_t count = 0;
+
+		/* drop the chain, the rules are rechained into chunks */
+		while (t->is_type(NODE_TYPE_ALT)) {
+			Node *next = t->child[0];
+			t->child[0] = t->child[1] = NULL;
+			delete t;
+			t = next;
+		}
+		i->second = NULL;
+
+		for (size_t j = 0; j < rules[n].size(); j++) {
+			chunk = chunk ? new AltNode(chunk, rules[n][j]) : rules[n][j];
+			key += keys[n][j];
+			count++;
+			if (j + 1 == rules[n].size() || count == FRAGMENT_CHUNK_MAX ||
+			    fragment_hash(keys[n][j]) % FRAGMENT_CHUNK_RULES == 0) {
+				parts.push_back(FragmentPart(new CatNode(chunk, i->first), key));
+				chunk = NULL;
+				key.clear();
+				count = 0;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * fragment_dfa - build a dfa from the cached dfas of its rule chunks
+ * @parts: the chunks from split_fragments
+ *
+ * Every chunk is looked up in the fragment cache, and only simplified,
+ * built and added to the cache if it is not found, so chunks that are the
+ * same across profiles and compiles are only turned into a dfa once.
+ *
+ * Returns: the dfa
+ */
+static DFA *fragment_dfa(vector<FragmentPart> &parts, dfaflags_t flags,
+			 bool filedfa)
+{
+	vector<DFAFragment *> fragments;
+	vector<Node *> accepts;
+	unsigned long hits = 0;
+	string options;
+	DFA *dfa = NULL;
+
+	fragment_key_flags(flags, options);
+	/* no push_back can fail while a fragment is not yet in @fragments */
+	fragments.reserve(parts.size());
+	try {
+		for (size_t i = 0; i < parts.size(); i++) {
+			CatNode *node = parts[i].node;
+			string key = options + parts[i].key;
+			DFAFragment *fragment = fragment_cache->find(key);
+			if (!fragment) {
+				if (flags & DFA_CONTROL_TREE_SIMPLE)
+					node->child[0] = simplify_tree(node->child[0], flags);
+				fragment = build_fragment(node->child[0], flags);
+				fragments.push_back(fragment);
+				fragment_cache->insert(key, *fragment);
+			} else {
+				hits++;
+				fragments.push_back(fragment);
+			}
+			accepts.push_back(node->child[1]);
+		}
+
+		if (flags & DFA_DUMP_STATS)
+			cerr << "Fragment cache: " << hits << " of "
+			     << parts.size() << " fragments cached\n";
+
+		dfa = new DFA(fragments, accepts, flags, filedfa);
+	}
+	catch(...) {
+		for (size_t i = 0; i < fragments.size(); i++)
+			delete fragments[i];
+		throw;
+	}
+
+	for (size_t i = 0; i < fragments.size(); i++)
+		delete fragments[i];
+
+	return dfa;
+}
+
 /* create a dfa from the ruleset
  * returns: buffer contain dfa tables, @size set to the size of the tables
  *          else NULL on failure, @min_match_len set to the shortest string
@@ -198,24 +390,34 @@ bool aare_rules::append_rule(const char *rule, bool oob, bool with_perm,
 void *aare_rules::create_dfa(size_t *size, int *min_match_len, dfaflags_t flags,
 			     bool filedfa)
 {
-	char *buffer = NULL;
+	ArenaScope scope(arena);
+	vector<FragmentPart> parts;
 
 	/* finish constructing the expr tree from the different permission
 	 * set nodes */
-	PermExprMap::iterator i = expr_map.begin();
-	if (i != expr_map.end()) {
-		if (flags & DFA_CONTROL_TREE_SIMPLE) {
-			Node *tmp = simplify_tree(i->second, flags);
-			root = new CatNode(tmp, i->first);
-		} else
-			root = new CatNode(i->second, i->first);
-		for (i++; i != expr_map.end(); i++) {
-			Node *tmp;
+	if (fragment_cache && (flags & DFA_CONTROL_FRAGMENT_CACHE) &&
+	    !(flags & DFA_DUMP_NODE_TO_DFA) &&
+	    split_fragments(expr_map, parts)) {
+		/* chunks are only simplified if they are not in the cache */
+		root = parts[0].node;
+		for (size_t j = 1; j < parts.size(); j++)
+			root = new AltNode(root, parts[j].node);
+	} else {
+		PermExprMap::iterator i = expr_map.begin();
+		if (i != expr_map.end()) {
 			if (flags & DFA_CONTROL_TREE_SIMPLE) {
-				tmp = simplify_tree(i->second, flags);
+				Node *tmp = simplify_tree(i->second, flags);
+				root = new CatNode(tmp, i->first);
 			} else
-				tmp = i->second;
-			root = new AltNode(root, new CatNode(tmp, i->first));
+				root = new CatNode(i->second, i->first);
+			for (i++; i != expr_map.end(); i++) {
+				Node *tmp;
+				if (flags & DFA_CONTROL_TREE_SIMPLE) {
+					tmp = simplify_tree(i->second, flags);
+				} else
+					tmp = i->second;
+				root = new AltNode(root, new CatNode(tmp, i->first));
+			}
 		}
 	}
 	*min_match_len = root->min_match_len();
@@ -248,9 +450,15 @@ void *aare_rules::create_dfa(size_t *size, int *min_match_len, dfaflags_t flags,
 		}
 	}
 
-	stringstream stream;
+	ByteBuffer tables;
 	try {
-		DFA dfa(root, flags, filedfa);
+		unique_ptr<DFA> dfap;
+		if (!parts.empty())
+			dfap.reset(fragment_dfa(parts, flags, filedfa));
+		else
+			dfap.reset(new DFA(root, flags, filedfa));
+		DFA &dfa = *dfap;
+
 		if (flags & DFA_DUMP_UNIQ_PERMS)
 			dfa.dump_uniq_perms("dfa");
 
@@ -305,24 +513,20 @@ void *aare_rules::create_dfa(size_t *size, int *min_match_len, dfaflags_t flags,
 				dfa.dump_diff_encode(cerr);
 		}
 
+		if (flags & DFA_DUMP_STATS)
+			cerr << "Rule arena: " << arena.size() << " bytes in "
+			     << arena.chunk_count() << " chunks\n";
+
 		CHFA chfa(dfa, eq, flags);
 		if (flags & DFA_DUMP_TRANS_TABLE)
 			chfa.dump(cerr);
-		chfa.flex_table(stream, "");
+		chfa.flex_table(tables, "");
 	}
 	catch(int error) {
 		*size = 0;
 		return NULL;
 	}
 
-	stringbuf *buf = stream.rdbuf();
-
-	buf->pubseekpos(0);
-	*size = buf->in_avail();
-
-	buffer = (char *)malloc(*size);
-	if (!buffer)
-		return NULL;
-	buf->sgetn(buffer, *size);
-	return buffer;
+	*size = tables.size();
+	return tables.release();
 }
@@ -24,6 +24,7 @@
 #include <stdint.h>
 
 #include "apparmor_re.h"
+#include "arena.h"
 #include "expr-tree.h"
 
 class UniquePerm {
@@ -86,9 +87,16 @@ public:
 	}
 };
 
+void aare_set_fragment_cache(const char *dir, bool writable);
+
 typedef std::map<Node *, Node *> PermExprMap;
 
 class aare_rules {
+	/* backs the expr tree and dfa states, must be destroyed last.
+	 * Only the tree built by create_dfa() is released, trees of rules
+	 * that were never compiled still leak what their nodes own.
+	 */
+	Arena arena;
 	Node *root;
 	void add_to_rules(Node *tree, Node *perms);
 	UniquePermsCache unique_perms;
@@ -96,8 +104,8 @@ class aare_rules {
  public:
 	int reverse;
 	int rule_count;
-	aare_rules(void): root(NULL), unique_perms(), expr_map(), reverse(0), rule_count(0) { };
-	aare_rules(int reverse): root(NULL), unique_perms(), expr_map(), reverse(reverse), rule_count(0) { };
+	aare_rules(void): arena(), root(NULL), unique_perms(), expr_map(), reverse(0), rule_count(0) { };
+	aare_rules(int reverse): arena(), root(NULL), unique_perms(), expr_map(), reverse(reverse), rule_count(0) { };
 	~aare_rules();
 
 	bool add_rule(const char *rule, int deny, uint32_t perms,
@@ -19,7 +19,9 @@
 #ifndef APPARMOR_RE_H
 #define APPARMOR_RE_H
 
-typedef int dfaflags_t;
+#include <stdint.h>
+
+typedef uint64_t dfaflags_t;
 
 
 #define DFA_CONTROL_EQUIV 		(1 << 0)
@@ -27,6 +29,7 @@ typedef int dfaflags_t;
 #define DFA_CONTROL_TREE_SIMPLE 	(1 << 2)
 #define DFA_CONTROL_TREE_LEFT 		(1 << 3)
 #define DFA_CONTROL_MINIMIZE 		(1 << 4)
+#define DFA_CONTROL_MINIMIZE_HOPCROFT 	(1 << 5)
 #define DFA_CONTROL_FILTER_DENY 	(1 << 6)
 #define DFA_CONTROL_REMOVE_UNREACHABLE  (1 << 7)
 #define DFA_CONTROL_TRANS_HIGH		(1 << 8)
@@ -53,6 +56,10 @@ typedef int dfaflags_t;
 #define DFA_DUMP_MINIMIZE 		(1 << 28)
 #define DFA_DUMP_UNREACHABLE 		(1 << 29)
 #define DFA_DUMP_RULE_EXPR 		(1 << 30)
-#define DFA_DUMP_NODE_TO_DFA 		(1 << 31)
+#define DFA_DUMP_NODE_TO_DFA 		(1U << 31)
+
+#define DFA_CONTROL_PARALLEL_BUILD	(1ULL << 32)
+#define DFA_CONTROL_STATE32		(1ULL << 33)
+#define DFA_CONTROL_FRAGMENT_CACHE	(1ULL << 34)
 
 #endif /* APPARMOR_RE_H */
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Region allocator for the objects created while compiling a set of rules
+ * into a dfa.
+ */
+
+#include <stdlib.h>
+
+#include <new>
+
+#include "arena.h"
+
+/* Chunks are large enough that malloc hands them out via mmap, so they
+ * go straight back to the system when the arena is destroyed instead of
+ * fragmenting the heap.
+ */
+#define ARENA_CHUNK_SIZE	(256 * 1024)
+/* allocations larger than this get a chunk of their own */
+#define ARENA_LARGE_ALLOC	(ARENA_CHUNK_SIZE / 8)
+#define ARENA_ALIGN		16
+
+/* prefixed to every ArenaObject so delete knows where it came from */
+union ArenaHeader {
+	struct {
+		Arena *arena;
+		size_t size;	/* of the block, including the header */
+	} block;
+	char align[ARENA_ALIGN];
+};
+
+__thread Arena *Arena::current = NULL;
+
+Arena::~Arena()
+{
+	for (vector<char *>::iterator i = chunks.begin(); i != chunks.end(); i++)
+		free(*i);
+}
+
+char *Arena::new_chunk(size_t size)
+{
+	char *chunk = (char *) malloc(size);
+	if (!chunk)
+		throw std::bad_alloc();
+	chunks.push_back(chunk);
+	return chunk;
+}
+
+void *Arena::alloc(size_t size)
+{
+	size_t bucket;
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+	used += size;
+	if (size > ARENA_LARGE_ALLOC)
+		return new_chunk(size);
+
+	/* blocks are recycled by size class, their size in ARENA_ALIGN units */
+	bucket = size / ARENA_ALIGN;
+	if (bucket < free_lists.size() && free_lists[bucket]) {
+		ptr = free_lists[bucket];
+		free_lists[bucket] = *(void **) ptr;
+		return ptr;
+	}
+
+	if ((size_t) (end - pos) < size) {
+		pos = new_chunk(ARENA_CHUNK_SIZE);
+		end = pos + ARENA_CHUNK_SIZE;
+	}
+	ptr = pos;
+	pos += size;
+	return ptr;
+}
+
+/* return a block from alloc(@size) to the arena for reuse */
+void Arena::release(void *ptr, size_t size)
+{
+	size_t bucket;
+
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+	used -= size;
+	/* large blocks have a chunk of their own, hand it straight back */
+	if (size > ARENA_LARGE_ALLOC) {
+		for (vector<char *>::iterator i = chunks.begin(); i != chunks.end(); i++) {
+			if (*i == ptr) {
+				chunks.erase(i);
+				break;
+			}
+		}
+		free(ptr);
+		return;
+	}
+
+	bucket = size / ARENA_ALIGN;
+	if (bucket >= free_lists.size())
+		free_lists.resize(bucket + 1, NULL);
+	*(void **) ptr = free_lists[bucket];
+	free_lists[bucket] = ptr;
+}
+
+void *ArenaObject::operator new(size_t size)
+{
+	Arena *arena = Arena::current;
+	ArenaHeader *header;
+
+	if (arena)
+		header = (ArenaHeader *) arena->alloc(sizeof(*header) + size);
+	else
+		header = (ArenaHeader *) ::operator new(sizeof(*header) + size);
+	header->block.arena = arena;
+	header->block.size = sizeof(*header) + size;
+
+	return header + 1;
+}
+
+void ArenaObject::operator delete(void *ptr)
+{
+	ArenaHeader *header;
+
+	if (!ptr)
+		return;
+	header = (ArenaHeader *) ptr - 1;
+	if (header->block.arena)
+		header->block.arena->release(header, header->block.size);
+	else
+		::operator delete(header);
+}
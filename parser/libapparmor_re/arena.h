@@ -0,0 +1,96 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Region allocator for the objects created while compiling a set of rules
+ * into a dfa.
+ *
+ * Compiling a policy creates and destroys a very large number of small
+ * expression tree nodes and dfa states, all of which die together when
+ * the compile is done.  Carving them out of large chunks that are released
+ * in one go avoids the per object malloc/free cost and the fragmentation
+ * it leaves behind.
+ */
+#ifndef __LIBAA_RE_ARENA_H
+#define __LIBAA_RE_ARENA_H
+
+#include <stddef.h>
+
+#include <vector>
+
+using namespace std;
+
+/*
+ * Arena - bump allocator with bulk release
+ *
+ * Freed blocks are kept on per size free lists and handed out again by
+ * later allocations of the same size, so states and nodes discarded part
+ * way through a compile are recycled instead of growing the arena.  Apart
+ * from large blocks, which have a chunk of their own, memory is only
+ * returned to the system when the Arena is destroyed, so the Arena must
+ * outlive every object allocated from it.  Destructors of the objects
+ * are still run by their owners as before; destroying the Arena does not
+ * run them.  An Arena is not thread safe, it is only used by the thread
+ * that has it in scope (see ArenaScope).
+ */
+class Arena {
+	vector<char *> chunks;
+	/* free_lists[i] chains the freed blocks of size class i */
+	vector<void *> free_lists;
+	char *pos;
+	char *end;
+	size_t used;
+
+	char *new_chunk(size_t size);
+public:
+	Arena(void): chunks(), free_lists(), pos(NULL), end(NULL), used(0) { };
+	~Arena();
+
+	void *alloc(size_t size);
+	void release(void *ptr, size_t size);
+	size_t size(void) const { return used; }
+	size_t chunk_count(void) const { return chunks.size(); }
+
+	/* arena ArenaObjects are allocated from, NULL for the heap */
+	static __thread Arena *current;
+};
+
+/*
+ * ArenaScope - direct ArenaObject allocations made by this thread to
+ * @arena for the lifetime of the scope.  Scopes nest.
+ */
+class ArenaScope {
+	Arena *prev;
+public:
+	ArenaScope(Arena &arena): prev(Arena::current)
+	{
+		Arena::current = &arena;
+	}
+	~ArenaScope() { Arena::current = prev; }
+};
+
+/*
+ * ArenaObject - base for classes that are allocated from the current
+ * Arena.  Objects created when no Arena is in scope (eg. by a worker
+ * thread) come from the heap and are freed normally, so delete works
+ * on either.
+ */
+class ArenaObject {
+public:
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr);
+};
+
+#endif /* __LIBAA_RE_ARENA_H */
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Growable byte buffer used to serialize dfas and policy.
+ *
+ * Serialized policy can be several megabytes, and is handed over to the
+ * kernel and the cache as a single block.  Building it in a stringstream
+ * copies it every time the stream grows and again to get it back out, so
+ * the buffer is a plain malloc()ed block that can be reserved up front
+ * when the size is known and handed over to its user without a copy.
+ */
+#ifndef __LIBAA_RE_BYTE_BUFFER_H
+#define __LIBAA_RE_BYTE_BUFFER_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+class ByteBuffer {
+	char *buf;
+	size_t used;
+	size_t allocated;
+
+	void grow(size_t need)
+	{
+		size_t size = allocated ? allocated : 4096;
+
+		while (size - used < need)
+			size *= 2;
+		reserve(size);
+	}
+
+	ByteBuffer(const ByteBuffer &);
+	ByteBuffer &operator=(const ByteBuffer &);
+public:
+	ByteBuffer(size_t size = 0): buf(NULL), used(0), allocated(0)
+	{
+		reserve(size);
+	}
+	~ByteBuffer() { free(buf); }
+
+	/* make room for @size bytes in total */
+	void reserve(size_t size)
+	{
+		char *tmp;
+
+		if (size <= allocated)
+			return;
+		tmp = (char *) realloc(buf, size);
+		if (!tmp)
+			throw std::bad_alloc();
+		buf = tmp;
+		allocated = size;
+	}
+
+	/* add @size bytes to the end of the buffer, returning where they
+	 * start so the caller can fill them in
+	 */
+	char *append(size_t size)
+	{
+		char *pos;
+
+		if (allocated - used < size)
+			grow(size);
+		pos = buf + used;
+		used += size;
+		return pos;
+	}
+
+	void write(const void *data, size_t size)
+	{
+		memcpy(append(size), data, size);
+	}
+
+	void put(char c) { *append(1) = c; }
+
+	/* add @size zero bytes */
+	void fill(size_t size) { memset(append(size), 0, size); }
+
+	char *data(void) { return buf; }
+	size_t size(void) const { return used; }
+
+	/**
+	 * release - hand the contents over to the caller
+	 *
+	 * Returns: the malloc()ed contents, which the caller must free(), or
+	 *          NULL if no room was ever reserved.  The buffer is left
+	 *          empty.
+	 */
+	char *release(void)
+	{
+		char *tmp = buf;
+
+		buf = NULL;
+		used = allocated = 0;
+		return tmp;
+	}
+};
+
+#endif /* __LIBAA_RE_BYTE_BUFFER_H */
@@ -54,6 +54,7 @@ CHFA::CHFA(DFA &dfa, map<transchar, transchar> &eq, dfaflags_t flags): eq(eq)
 	if (flags & DFA_DUMP_TRANS_PROGRESS)
 		fprintf(stderr, "Compressing HFA:\r");
 
+	state32 = flags & DFA_CONTROL_STATE32;
 	chfaflags = 0;
 	if (dfa.diffcount)
 		chfaflags |= YYTH_FLAG_DIFF_ENCODE;
@@ -195,7 +196,7 @@ void CHFA::insert_state(vector<pair<size_t, size_t> > &free_list,
 	int resize;
 
 	StateTrans &trans = from->trans;
-	ssize_t c = trans.begin()->first.c;
+	ssize_t c = trans.empty() ? 0 : trans.begin()->first.c;
 	ssize_t prev = 0;
 	ssize_t x = first_free;
 
@@ -318,11 +319,10 @@ static inline size_t pad64(size_t i)
 	return (i + (size_t) 7) & ~(size_t) 7;
 }
 
-string fill64(size_t i)
+/* pad @buf to the 64 bit alignment of a table of @i bytes */
+static inline void fill64(ByteBuffer &buf, size_t i)
 {
-	const char zeroes[8] = { };
-	string fill(zeroes, (i & 7) ? 8 - (i & 7) : 0);
-	return fill;
+	buf.fill(pad64(i) - i);
 }
 
 template<class Iter> size_t flex_table_size(Iter pos, Iter end)
@@ -331,55 +331,79 @@ template<class Iter> size_t flex_table_size(Iter pos, Iter end)
 }
 
 template<class Iter>
-    void write_flex_table(ostream &os, int id, Iter pos, Iter end)
+    void write_flex_table(ByteBuffer &buf, int id, Iter pos, Iter end)
 {
 	struct table_header td = { 0, 0, 0, 0 };
 	size_t size = end - pos;
+	char *out;
 
 	td.td_id = htons(id);
 	td.td_flags = htons(sizeof(*pos));
 	td.td_lolen = htonl(size);
-	os.write((char *)&td, sizeof(td));
+	buf.write(&td, sizeof(td));
 
+	out = buf.append(sizeof(*pos) * size);
 	for (; pos != end; ++pos) {
 		switch (sizeof(*pos)) {
 		case 4:
-			os.put((char)(*pos >> 24));
-			os.put((char)(*pos >> 16));
+			*out++ = (char)(*pos >> 24);
+			*out++ = (char)(*pos >> 16);
 			/* Fall through */
 		case 2:
-			os.put((char)(*pos >> 8));
+			*out++ = (char)(*pos >> 8);
 			/* Fall through */
 		case 1:
-			os.put((char)*pos);
+			*out++ = (char)*pos;
 			/* Fall through */
 		}
 	}
 
-	os << fill64(sizeof(td) + sizeof(*pos) * size);
+	fill64(buf, sizeof(td) + sizeof(*pos) * size);
 }
 
-void CHFA::flex_table(ostream &os, const char *name)
+/**
+ * flex_table - write the dfa tables
+ * @buf: buffer to append the tables to
+ * @name: name stored in the table set header
+ *
+ * State numbers are written as 16 bit values, which is what every kernel
+ * understands.  If there are too many states for that and the target
+ * supports it (DFA_CONTROL_STATE32) the default, next and check tables
+ * are written with 32 bit entries instead; the width of each table is
+ * recorded in its header.
+ *
+ * Throws an int if the dfa can not be represented.
+ */
+void CHFA::flex_table(ByteBuffer &buf, const char *name)
+{
+	if (default_base.size() < (uint16_t) - 1) {
+		flex_table_states<uint16_t>(buf, name);
+	} else if (state32) {
+		flex_table_states<uint32_t>(buf, name);
+	} else {
+		cerr << "Too many states (" << default_base.size() << ") for "
+		    "16 bit state tables and 32 bit state tables are not "
+		    "supported by the target\n";
+		throw 1;
+	}
+}
+
+template<class state_t>
+void CHFA::flex_table_states(ByteBuffer &buf, const char *name)
 {
 	const char th_version[] = "notflex";
 	struct table_set_header th = { 0, 0, 0, 0 };
-
-	/**
-	 * Change the following two data types to adjust the maximum flex
-	 * table size.
-	 */
-	typedef uint16_t state_t;
 	typedef uint32_t trans_t;
 
 	if (default_base.size() >= (state_t) - 1) {
 		cerr << "Too many states (" << default_base.size() << ") for "
 		    "type state_t\n";
-		exit(1);
+		throw 1;
 	}
 	if (next_check.size() >= (trans_t) - 1) {
 		cerr << "Too many transitions (" << next_check.size()
 		     << ") for " "type trans_t\n";
-		exit(1);
+		throw 1;
 	}
 
 	/**
@@ -422,17 +446,20 @@ void CHFA::flex_table(ostream &os, const char *name)
 			    flex_table_size(default_vec.begin(), default_vec.end()) +
 			    flex_table_size(next_vec.begin(), next_vec.end()) +
 			    flex_table_size(check_vec.begin(), check_vec.end()));
-	os.write((char *)&th, sizeof(th));
-	os << th_version << (char)0 << name << (char)0;
-	os << fill64(sizeof(th) + sizeof(th_version) + strlen(name) + 1);
-
-	write_flex_table(os, YYTD_ID_ACCEPT, accept.begin(), accept.end());
-	write_flex_table(os, YYTD_ID_ACCEPT2, accept2.begin(), accept2.end());
+	/* the whole table set is written in one go, so never grows */
+	buf.reserve(buf.size() + ntohl(th.th_ssize));
+	buf.write(&th, sizeof(th));
+	buf.write(th_version, sizeof(th_version));
+	buf.write(name, strlen(name) + 1);
+	fill64(buf, sizeof(th) + sizeof(th_version) + strlen(name) + 1);
+
+	write_flex_table(buf, YYTD_ID_ACCEPT, accept.begin(), accept.end());
+	write_flex_table(buf, YYTD_ID_ACCEPT2, accept2.begin(), accept2.end());
 	if (eq.size())
-		write_flex_table(os, YYTD_ID_EC, equiv_vec.begin(),
+		write_flex_table(buf, YYTD_ID_EC, equiv_vec.begin(),
 				 equiv_vec.end());
-	write_flex_table(os, YYTD_ID_BASE, base_vec.begin(), base_vec.end());
-	write_flex_table(os, YYTD_ID_DEF, default_vec.begin(), default_vec.end());
-	write_flex_table(os, YYTD_ID_NXT, next_vec.begin(), next_vec.end());
-	write_flex_table(os, YYTD_ID_CHK, check_vec.begin(), check_vec.end());
+	write_flex_table(buf, YYTD_ID_BASE, base_vec.begin(), base_vec.end());
+	write_flex_table(buf, YYTD_ID_DEF, default_vec.begin(), default_vec.end());
+	write_flex_table(buf, YYTD_ID_NXT, next_vec.begin(), next_vec.end());
+	write_flex_table(buf, YYTD_ID_CHK, check_vec.begin(), check_vec.end());
 }
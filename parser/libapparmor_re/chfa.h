@@ -24,6 +24,7 @@
 #include <map>
 #include <vector>
 
+#include "byte_buffer.h"
 #include "hfa.h"
 
 #define BASE32_FLAGS 0xff000000
@@ -39,7 +40,7 @@ class CHFA {
       public:
 	CHFA(DFA &dfa, map<transchar, transchar> &eq, dfaflags_t flags);
 	void dump(ostream & os);
-	void flex_table(ostream &os, const char *name);
+	void flex_table(ByteBuffer &buf, const char *name);
 	void init_free_list(vector<pair<size_t, size_t> > &free_list,
 			    size_t prev, size_t start);
 	bool fits_in(vector<pair<size_t, size_t> > &free_list, size_t base,
@@ -48,6 +49,9 @@ class CHFA {
 			  State *state, DFA &dfa);
 
       private:
+	template<class state_t>
+	void flex_table_states(ByteBuffer &buf, const char *name);
+
 	vector<uint32_t> accept;
 	vector<uint32_t> accept2;
 	DefaultBase default_base;
@@ -57,6 +61,7 @@ class CHFA {
 	transchar max_eq;
 	ssize_t first_free;
 	unsigned int chfaflags;
+	bool state32;
 };
 
 #endif /* __LIBAA_RE_CHFA_H */
@@ -83,7 +83,7 @@ ostream &operator<<(ostream &os, const NodeSet &state)
 {
 	os << '{';
 	if (!state.empty()) {
-		NodeSet::iterator i = state.begin();
+		NodeSet::const_iterator i = state.begin();
 		for (;;) {
 			os << (*i)->label;
 			if (++i == state.end())
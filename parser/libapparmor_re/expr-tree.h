@@ -34,14 +34,17 @@
 #ifndef __LIBAA_RE_EXPR_H
 #define __LIBAA_RE_EXPR_H
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <stack>
 #include <ostream>
+#include <vector>
 
 #include <stdint.h>
 
 #include "apparmor_re.h"
+#include "arena.h"
 
 using namespace std;
 
@@ -195,7 +198,90 @@ template<class T> set<T> operator+(const set<T> &a, const set<T> &b)
  */
 class Node;
 class ImportantNode;
-typedef set<ImportantNode *> NodeSet;
+
+/*
+ * NodeSet - set of ImportantNodes kept as a sorted vector
+ *
+ * firstpos/lastpos/followpos and the per character follow sets are
+ * built and compared far more often than they are searched, so a flat
+ * vector with linear merges is much cheaper than a tree of individually
+ * allocated nodes.  Iteration order is by node address, the same order
+ * the set used, so dfa construction visits states in the same order.
+ *
+ * append() adds nodes without maintaining order, it is used when
+ * accumulating follow sets, which are then put in order once with
+ * normalize() before they are used as a set.
+ */
+class NodeSet {
+public:
+	typedef vector<ImportantNode *>::iterator iterator;
+	typedef vector<ImportantNode *>::const_iterator const_iterator;
+
+	NodeSet(void): nodes() { }
+
+	iterator begin() { return nodes.begin(); }
+	iterator end() { return nodes.end(); }
+	const_iterator begin() const { return nodes.begin(); }
+	const_iterator end() const { return nodes.end(); }
+
+	size_t size(void) const { return nodes.size(); }
+	bool empty(void) const { return nodes.empty(); }
+	void clear(void) { nodes.clear(); }
+	void swap(NodeSet &rhs) { nodes.swap(rhs.nodes); }
+
+	void insert(ImportantNode *node)
+	{
+		if (nodes.empty() || nodes.back() < node) {
+			nodes.push_back(node);
+			return;
+		}
+		iterator i = std::lower_bound(nodes.begin(), nodes.end(), node);
+		if (*i != node)
+			nodes.insert(i, node);
+	}
+
+	void insert(const NodeSet &rhs)
+	{
+		if (rhs.empty())
+			return;
+		if (nodes.empty()) {
+			nodes = rhs.nodes;
+		} else if (nodes.back() < rhs.nodes.front()) {
+			nodes.insert(nodes.end(), rhs.begin(), rhs.end());
+		} else {
+			vector<ImportantNode *> tmp;
+			tmp.reserve(nodes.size() + rhs.size());
+			set_union(nodes.begin(), nodes.end(), rhs.begin(),
+				  rhs.end(), back_inserter(tmp));
+			nodes.swap(tmp);
+		}
+	}
+
+	void append(const NodeSet &rhs)
+	{
+		nodes.insert(nodes.end(), rhs.begin(), rhs.end());
+	}
+
+	void normalize(void)
+	{
+		sort(nodes.begin(), nodes.end());
+		nodes.erase(unique(nodes.begin(), nodes.end()), nodes.end());
+	}
+
+	bool operator<(const NodeSet &rhs) const { return nodes < rhs.nodes; }
+	bool operator==(const NodeSet &rhs) const { return nodes == rhs.nodes; }
+
+private:
+	vector<ImportantNode *> nodes;
+};
+
+/* Compute the union of two sets. */
+inline NodeSet operator+(const NodeSet &a, const NodeSet &b)
+{
+	NodeSet c(a);
+	c.insert(b);
+	return c;
+}
 
 /**
  * Text-dump a state (for debugging).
@@ -246,7 +332,7 @@ ostream &operator<<(ostream &os, Node &node);
 #define NODE_TYPE_DENYMATCHFLAG		(1 << 20)
 
 /* An abstract node in the syntax tree. */
-class Node {
+class Node: public ArenaObject {
 public:
 	Node(): nullable(false), type_flags(NODE_TYPE_NODE), label(0)
 	{
@@ -448,7 +534,7 @@ public:
 			else
 				*x = new NodeSet;
 		}
-		(*x)->insert(followpos.begin(), followpos.end());
+		(*x)->append(followpos);
 	}
 	int eq(Node *other)
 	{
@@ -497,7 +583,7 @@ public:
 				else
 					*x = new NodeSet;
 			}
-			(*x)->insert(followpos.begin(), followpos.end());
+			(*x)->append(followpos);
 		}
 	}
 	int eq(Node *other)
@@ -564,13 +650,12 @@ public:
 		/* Note: Add to the nonmatching characters after copying away
 		 * the old otherwise state for the matching characters.
 		 */
-		cases.otherwise->insert(followpos.begin(), followpos.end());
+		cases.otherwise->append(followpos);
 		for (Cases::iterator i = cases.begin(); i != cases.end();
 		     i++) {
 			/* does not match oob transition chars */
 			if (i->first.c >=0 && chars.find(i->first) == chars.end())
-				i->second->insert(followpos.begin(),
-						  followpos.end());
+				i->second->append(followpos);
 		}
 	}
 	int eq(Node *other)
@@ -626,12 +711,12 @@ public:
 	{
 		if (!cases.otherwise)
 			cases.otherwise = new NodeSet;
-		cases.otherwise->insert(followpos.begin(), followpos.end());
+		cases.otherwise->append(followpos);
 		for (Cases::iterator i = cases.begin(); i != cases.end();
 		     i++)
 			/* does not match oob transition chars */
 			if (i->first.c >= 0)
-				i->second->insert(followpos.begin(), followpos.end());
+				i->second->append(followpos);
 	}
 	int eq(Node *other)
 	{
@@ -656,7 +741,7 @@ public:
 	{
 		NodeSet from = child[0]->lastpos, to = child[0]->firstpos;
 		for (NodeSet::iterator i = from.begin(); i != from.end(); i++) {
-			(*i)->followpos.insert(to.begin(), to.end());
+			(*i)->followpos.insert(to);
 		}
 	}
 	int eq(Node *other)
@@ -713,7 +798,7 @@ public:
 	{
 		NodeSet from = child[0]->lastpos, to = child[0]->firstpos;
 		for (NodeSet::iterator i = from.begin(); i != from.end(); i++) {
-			(*i)->followpos.insert(to.begin(), to.end());
+			(*i)->followpos.insert(to);
 		}
 	}
 	int eq(Node *other) {
@@ -759,7 +844,7 @@ public:
 	{
 		NodeSet from = child[0]->lastpos, to = child[1]->firstpos;
 		for (NodeSet::iterator i = from.begin(); i != from.end(); i++) {
-			(*i)->followpos.insert(to.begin(), to.end());
+			(*i)->followpos.insert(to);
 		}
 	}
 	int eq(Node *other)
@@ -973,10 +1058,12 @@ public:
 	unsigned long hash;
 	NodeSet *nodes;
 
+	hashedNodeSet(void): hash(0), nodes(NULL) { }
 	hashedNodeSet(NodeSet *n): nodes(n)
 	{
 		hash = hash_NodeSet(n);
 	}
+	hashedNodeSet(NodeSet *n, unsigned long h): hash(h), nodes(n) { }
 
 	bool operator<(hashedNodeSet const &rhs)const
 	{
@@ -1045,6 +1132,105 @@ public:
 		}
 		return hash < rhs.hash;
 	}
+
+	bool same_nodes(NodeSet *n) const
+	{
+		if (len != n->size())
+			return false;
+		return std::equal(n->begin(), n->end(), nodes);
+	}
+};
+
+/*
+ * HashTable - open addressing hash table used by the dfa construction
+ *             caches
+ * @Entry: value stored in the table, a default constructed Entry is an
+ *         empty slot
+ * @Traits: static empty(entry), hash(entry) and equal(entry, hash, key)
+ *
+ * Linear probing over a power of two sized table, kept at most 70% full.
+ * The hashes handed in are cheap and have poor low bits (they are built
+ * from pointers) so they are scrambled before picking a slot.  There is
+ * no removal, caches are only ever cleared as a whole.
+ */
+template<class Entry, class Traits>
+class HashTable {
+	vector<Entry> table;
+	size_t used;
+	unsigned int shift;
+
+	size_t slot(unsigned long hash) const
+	{
+		return ((uint64_t) hash * 0x9e3779b97f4a7c15ULL) >> shift;
+	}
+
+	void grow(void)
+	{
+		vector<Entry> old;
+		size_t size = table.empty() ? 64 : table.size() * 2;
+
+		old.swap(table);
+		table.resize(size);
+		shift = 64;
+		while (size > 1) {
+			size >>= 1;
+			shift--;
+		}
+		for (typename vector<Entry>::iterator i = old.begin();
+		     i != old.end(); i++) {
+			if (Traits::empty(*i))
+				continue;
+			size_t j = slot(Traits::hash(*i));
+			while (!Traits::empty(table[j]))
+				j = (j + 1) & (table.size() - 1);
+			table[j] = *i;
+		}
+	}
+
+public:
+	typedef typename vector<Entry>::iterator iterator;
+
+	HashTable(void): table(), used(0), shift(64) { }
+
+	/* iteration is over all slots, callers skip the empty ones */
+	iterator begin() { return table.begin(); }
+	iterator end() { return table.end(); }
+	size_t size(void) const { return used; }
+
+	void clear(void)
+	{
+		table.clear();
+		used = 0;
+		shift = 64;
+	}
+
+	/**
+	 * find_slot - find the entry matching @key or the slot to insert it in
+	 * @hash: hash of @key, as Traits::hash() would compute for its entry
+	 * @key: what to look for, passed to Traits::equal()
+	 *
+	 * Returns: the matching entry, or an empty slot that can be filled
+	 *          with fill().  The slot is only valid until the next call.
+	 */
+	template<class Key>
+	Entry &find_slot(unsigned long hash, const Key &key)
+	{
+		if ((used + 1) * 10 > table.size() * 7)
+			grow();
+
+		size_t mask = table.size() - 1;
+		for (size_t i = slot(hash); ; i = (i + 1) & mask) {
+			if (Traits::empty(table[i]) ||
+			    Traits::equal(table[i], hash, key))
+				return table[i];
+		}
+	}
+
+	void fill(Entry &slot, const Entry &entry)
+	{
+		slot = entry;
+		used++;
+	}
 };
 
 class CacheStats {
@@ -1057,9 +1243,20 @@ public:
 	virtual unsigned long size(void) const = 0;
 };
 
+struct hashedNodeSetTraits {
+	static bool empty(const hashedNodeSet &e) { return !e.nodes; }
+	static unsigned long hash(const hashedNodeSet &e) { return e.hash; }
+	static bool equal(const hashedNodeSet &e, unsigned long hash,
+			  NodeSet *nodes)
+	{
+		return e.hash == hash && *e.nodes == *nodes;
+	}
+};
+
 class NodeCache: public CacheStats {
 public:
-	set<hashedNodeSet> cache;
+	typedef HashTable<hashedNodeSet, hashedNodeSetTraits> Table;
+	Table cache;
 
 	NodeCache(void): cache() { };
 	~NodeCache() { clear(); };
@@ -1068,8 +1265,7 @@ public:
 
 	void clear()
 	{
-		for (set<hashedNodeSet>::iterator i = cache.begin();
-		     i != cache.end(); i++) {
+		for (Table::iterator i = cache.begin(); i != cache.end(); i++) {
 			delete i->nodes;
 		}
 		cache.clear();
@@ -1080,30 +1276,35 @@ public:
 	{
 		if (!nodes)
 			return NULL;
-		pair<set<hashedNodeSet>::iterator,bool> uniq;
-		uniq = cache.insert(hashedNodeSet(nodes));
-		if (uniq.second == false) {
+		unsigned long hash = hash_NodeSet(nodes);
+		hashedNodeSet &entry = cache.find_slot(hash, nodes);
+		if (entry.nodes) {
 			delete(nodes);
 			dup++;
 		} else {
+			cache.fill(entry, hashedNodeSet(nodes, hash));
 			sum += nodes->size();
 			if (nodes->size() > max)
 				max = nodes->size();
 		}
-		return uniq.first->nodes;
+		return entry.nodes;
 	}
 };
 
-struct deref_less_than {
-       bool operator()(hashedNodeVec * const &lhs, hashedNodeVec * const &rhs)const
-		{
-			return *lhs < *rhs;
-		}
+struct hashedNodeVecTraits {
+	static bool empty(hashedNodeVec * const &e) { return !e; }
+	static unsigned long hash(hashedNodeVec * const &e) { return e->hash; }
+	static bool equal(hashedNodeVec * const &e, unsigned long hash,
+			  NodeSet *nodes)
+	{
+		return e->hash == hash && e->same_nodes(nodes);
+	}
 };
 
 class NodeVecCache: public CacheStats {
 public:
-	set<hashedNodeVec *, deref_less_than> cache;
+	typedef HashTable<hashedNodeVec *, hashedNodeVecTraits> Table;
+	Table cache;
 
 	NodeVecCache(void): cache() { };
 	~NodeVecCache() { clear(); };
@@ -1112,31 +1313,30 @@ public:
 
 	void clear()
 	{
-		for (set<hashedNodeVec *>::iterator i = cache.begin();
-		     i != cache.end(); i++) {
+		for (Table::iterator i = cache.begin(); i != cache.end(); i++) {
 			delete *i;
 		}
 		cache.clear();
 		CacheStats::clear();
 	}
 
+	/* the vec is only built for sets not already in the cache */
 	hashedNodeVec *insert(NodeSet *nodes)
 	{
 		if (!nodes)
 			return NULL;
-		pair<set<hashedNodeVec *>::iterator,bool> uniq;
-		hashedNodeVec *nv = new hashedNodeVec(nodes);
-		uniq = cache.insert(nv);
-		if (uniq.second == false) {
-			delete nv;
+		unsigned long hash = hash_NodeSet(nodes);
+		hashedNodeVec *&entry = cache.find_slot(hash, nodes);
+		if (entry) {
 			dup++;
 		} else {
+			cache.fill(entry, new hashedNodeVec(nodes, hash));
 			sum += nodes->size();
 			if (nodes->size() > max)
 				max = nodes->size();
 		}
 		delete(nodes);
-		return (*uniq.first);
+		return entry;
 	}
 };
 
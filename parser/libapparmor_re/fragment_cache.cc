@@ -0,0 +1,353 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * On disk cache of the dfas built for rule subtrees.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "fragment_cache.h"
+
+#define FRAGMENT_MAGIC		"AAREFRAG"
+#define FRAGMENT_VERSION	2
+#define FRAGMENT_BYTE_ORDER	0x01020304
+/* sanity limit on the size of fragments read back */
+#define FRAGMENT_MAX_ENTRIES	(1 << 28)
+
+/* fragments are only read back by the machine that wrote them, so the
+ * data is stored in host byte order and the header just records which
+ */
+struct fragment_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t key_len;
+	uint32_t states;
+	uint32_t trans;
+	uint32_t start;
+	uint32_t nonmatching;
+};
+
+static void put_char(string &key, transchar c)
+{
+	key += (char) (c.c & 0xff);
+	key += (char) ((c.c >> 8) & 0xff);
+}
+
+static bool put_chars(string &key, Chars &chars)
+{
+	put_char(key, transchar(chars.size(), true));
+	for (Chars::iterator i = chars.begin(); i != chars.end(); i++) {
+		if (i->c < 0)
+			return false;
+		put_char(key, *i);
+	}
+	return true;
+}
+
+/**
+ * fragment_key - encode an expression tree as a fragment cache key
+ * @tree: the tree to encode
+ * @key: string the encoding is appended to
+ *
+ * The encoding is the tree in prefix order, so it is unambiguous and two
+ * trees only get the same key if they are the same expression.
+ *
+ * Returns: false if the tree can not be built as a fragment, because it
+ *          contains accept nodes or out of band transitions
+ */
+bool fragment_key(Node *tree, string &key)
+{
+	vector<Node *> stack(1, tree);
+
+	while (!stack.empty()) {
+		Node *node = stack.back();
+		stack.pop_back();
+
+		if (node->is_type(NODE_TYPE_EPS)) {
+			key += 'e';
+		} else if (node->is_type(NODE_TYPE_CHAR)) {
+			CharNode *c = static_cast<CharNode *>(node);
+			if (c->c.c < 0)
+				return false;
+			key += 'c';
+			put_char(key, c->c);
+		} else if (node->is_type(NODE_TYPE_CHARSET)) {
+			key += 's';
+			if (!put_chars(key, static_cast<CharSetNode *>(node)->chars))
+				return false;
+		} else if (node->is_type(NODE_TYPE_NOTCHARSET)) {
+			key += 'n';
+			if (!put_chars(key, static_cast<NotCharSetNode *>(node)->chars))
+				return false;
+		} else if (node->is_type(NODE_TYPE_ANYCHAR)) {
+			key += 'a';
+		} else if (node->is_type(NODE_TYPE_STAR)) {
+			key += '*';
+			stack.push_back(node->child[0]);
+		} else if (node->is_type(NODE_TYPE_PLUS)) {
+			key += '+';
+			stack.push_back(node->child[0]);
+		} else if (node->is_type(NODE_TYPE_OPTIONAL)) {
+			key += '?';
+			stack.push_back(node->child[0]);
+		} else if (node->is_type(NODE_TYPE_CAT) ||
+			   node->is_type(NODE_TYPE_ALT)) {
+			key += node->is_type(NODE_TYPE_CAT) ? '.' : '|';
+			stack.push_back(node->child[1]);
+			stack.push_back(node->child[0]);
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * fragment_key_flags - encode the build options of a fragment into its key
+ * @flags: the dfaflags the fragment is built with
+ * @key: string the encoding is appended to
+ *
+ * A fragment is only reused by compiles that would build the same one, so
+ * the options that change how it is simplified and minimized are part of
+ * its key.
+ */
+void fragment_key_flags(dfaflags_t flags, string &key)
+{
+	uint64_t f = flags & FRAGMENT_KEY_FLAGS;
+
+	key += 'f';
+	for (int i = 0; i < 8; i++)
+		key += (char) ((f >> (i * 8)) & 0xff);
+}
+
+/* FNV-1a hash of @key */
+uint64_t fragment_hash(const string &key)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (string::const_iterator i = key.begin(); i != key.end(); i++) {
+		hash ^= (unsigned char) *i;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+string FragmentCache::path(const string &key)
+{
+	char name[17];
+
+	snprintf(name, sizeof(name), "%016llx",
+		 (unsigned long long) fragment_hash(key));
+
+	return dir + "/" + name;
+}
+
+template<class T>
+static bool read_vec(FILE *f, vector<T> &v, size_t n)
+{
+	v.resize(n);
+	return !n || fread(&v[0], sizeof(T), n, f) == n;
+}
+
+template<class T>
+static bool write_vec(FILE *f, const vector<T> &v)
+{
+	return v.empty() || fwrite(&v[0], sizeof(T), v.size(), f) == v.size();
+}
+
+static size_t fragment_file_size(const struct fragment_header &h)
+{
+	return sizeof(h) + h.key_len +
+		sizeof(uint32_t) * (2 * (size_t) h.states + 1 + h.trans) +
+		sizeof(uint16_t) * (size_t) h.trans + h.states;
+}
+
+/**
+ * find - look up the fragment for @key
+ *
+ * Returns: a new DFAFragment owned by the caller, or NULL if there is no
+ *          valid fragment for @key
+ */
+DFAFragment *FragmentCache::find(const string &key)
+{
+	struct fragment_header h;
+	struct stat st;
+	DFAFragment *frag = NULL;
+	string stored;
+	FILE *f;
+
+	f = fopen(path(key).c_str(), "r");
+	if (!f)
+		goto miss;
+
+	if (fread(&h, sizeof(h), 1, f) != 1 ||
+	    memcmp(h.magic, FRAGMENT_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.version != FRAGMENT_VERSION ||
+	    h.byte_order != FRAGMENT_BYTE_ORDER ||
+	    h.key_len != key.size() ||
+	    h.states > FRAGMENT_MAX_ENTRIES || h.trans > FRAGMENT_MAX_ENTRIES ||
+	    fstat(fileno(f), &st) == -1 ||
+	    (size_t) st.st_size != fragment_file_size(h))
+		goto miss;
+
+	stored.resize(key.size());
+	if (fread(&stored[0], 1, key.size(), f) != key.size() || stored != key)
+		goto miss;
+
+	frag = new DFAFragment;
+	frag->start = h.start;
+	frag->nonmatching = h.nonmatching;
+	if (!read_vec(f, frag->otherwise, h.states) ||
+	    !read_vec(f, frag->trans_index, h.states + 1) ||
+	    !read_vec(f, frag->trans_next, h.trans) ||
+	    !read_vec(f, frag->trans_chars, h.trans) ||
+	    !read_vec(f, frag->accept, h.states) ||
+	    !frag->valid())
+		goto miss;
+
+	/* keep fragments in use from being pruned */
+	if (writable)
+		futimens(fileno(f), NULL);
+	fclose(f);
+	hits++;
+	return frag;
+
+miss:
+	delete frag;
+	if (f)
+		fclose(f);
+	misses++;
+	return NULL;
+}
+
+/* store @fragment for @key, failures just mean it is rebuilt next time */
+void FragmentCache::insert(const string &key, DFAFragment &fragment)
+{
+	struct fragment_header h;
+	string name, tmpname;
+	bool ok;
+	FILE *f;
+	int fd;
+
+	if (!writable)
+		return;
+
+	name = path(key);
+	tmpname = name + ".XXXXXX";
+	fd = mkstemp(&tmpname[0]);
+	if (fd == -1)
+		return;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmpname.c_str());
+		return;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, FRAGMENT_MAGIC, sizeof(h.magic));
+	h.version = FRAGMENT_VERSION;
+	h.byte_order = FRAGMENT_BYTE_ORDER;
+	h.key_len = key.size();
+	h.states = fragment.size();
+	h.trans = fragment.trans_chars.size();
+	h.start = fragment.start;
+	h.nonmatching = fragment.nonmatching;
+
+	ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+		fwrite(key.data(), 1, key.size(), f) == key.size() &&
+		write_vec(f, fragment.otherwise) &&
+		write_vec(f, fragment.trans_index) &&
+		write_vec(f, fragment.trans_next) &&
+		write_vec(f, fragment.trans_chars) &&
+		write_vec(f, fragment.accept);
+	if (fclose(f) != 0)
+		ok = false;
+
+	if (!ok || rename(tmpname.c_str(), name.c_str()) == -1)
+		unlink(tmpname.c_str());
+}
+
+struct fragment_file {
+	string name;
+	time_t mtime;
+	uint64_t size;
+
+	bool operator<(const fragment_file &rhs) const
+	{
+		return mtime < rhs.mtime;
+	}
+};
+
+/**
+ * prune - evict the least recently used fragments
+ * @max_size: size the fragments in the cache may use
+ *
+ * Once the fragments use more than @max_size, the least recently used
+ * ones are removed until they use three quarters of it, so not every
+ * compile has to prune.  Left over temporary files are counted like
+ * fragments and so are removed as well once they are old enough.
+ */
+void FragmentCache::prune(uint64_t max_size)
+{
+	vector<struct fragment_file> files;
+	struct fragment_file file;
+	struct dirent *ent;
+	struct stat st;
+	uint64_t total = 0;
+	DIR *d;
+
+	if (!writable)
+		return;
+
+	d = opendir(dir.c_str());
+	if (!d)
+		return;
+	while ((ent = readdir(d))) {
+		if (fstatat(dirfd(d), ent->d_name, &st,
+			    AT_SYMLINK_NOFOLLOW) == -1 ||
+		    !S_ISREG(st.st_mode))
+			continue;
+		file.name = ent->d_name;
+		file.mtime = st.st_mtime;
+		file.size = st.st_size;
+		files.push_back(file);
+		total += file.size;
+	}
+	closedir(d);
+
+	if (total <= max_size)
+		return;
+
+	std::sort(files.begin(), files.end());
+	for (size_t i = 0; i < files.size() && total > max_size / 4 * 3; i++) {
+		if (unlink((dir + "/" + files[i].name).c_str()) == 0)
+			total -= files[i].size;
+	}
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2026 Canonical Ltd.
+ *
+ * The libapparmor library is licensed under the terms of the GNU
+ * Lesser General Public License, version 2.1. Please see the file
+ * COPYING.LGPL.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * On disk cache of the dfas built for rule subtrees, so subtrees shared
+ * between profiles (eg. from common abstractions) and compiles are only
+ * determinised and minimized once.
+ */
+#ifndef __LIBAA_RE_FRAGMENT_CACHE_H
+#define __LIBAA_RE_FRAGMENT_CACHE_H
+
+#include <atomic>
+#include <string>
+
+#include "expr-tree.h"
+#include "hfa.h"
+
+using namespace std;
+
+/* the fragments are pruned back once they use more than this */
+#define FRAGMENT_CACHE_MAX_SIZE	(64 << 20)
+
+/* the dfaflags that change the dfa built for a fragment */
+#define FRAGMENT_KEY_FLAGS (DFA_CONTROL_TREE_NORMAL | DFA_CONTROL_TREE_SIMPLE | \
+			    DFA_CONTROL_TREE_LEFT | DFA_CONTROL_MINIMIZE | \
+			    DFA_CONTROL_MINIMIZE_HOPCROFT)
+
+bool fragment_key(Node *tree, string &key);
+void fragment_key_flags(dfaflags_t flags, string &key);
+uint64_t fragment_hash(const string &key);
+
+/*
+ * FragmentCache - directory of DFAFragments keyed by fragment_key()
+ *
+ * Each fragment is stored in a file named by a hash of its key.  The
+ * file also holds the full key, which is compared on lookup, so hash
+ * collisions only cost a cache miss.  Files are written to a temporary
+ * name and renamed into place so concurrent compiles never see a
+ * partial fragment.  The cache is safe to use from several threads.
+ *
+ * When writable, a hit refreshes the file's mtime, and prune() removes
+ * the least recently used fragments once the directory grows too big.
+ */
+class FragmentCache {
+	string dir;
+	bool writable;
+
+	string path(const string &key);
+public:
+	FragmentCache(const char *dir, bool writable):
+		dir(dir), writable(writable), hits(0), misses(0) { }
+
+	DFAFragment *find(const string &key);
+	void insert(const string &key, DFAFragment &fragment);
+	void prune(uint64_t max_size);
+
+	atomic<unsigned long> hits;
+	atomic<unsigned long> misses;
+};
+
+#endif /* __LIBAA_RE_FRAGMENT_CACHE_H */
@@ -30,7 +30,12 @@
 #include <ostream>
 #include <iostream>
 #include <fstream>
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "expr-tree.h"
 #include "hfa.h"
@@ -118,7 +123,7 @@ int State::diff_weight(State *rel, int max_range, int upper_bound)
 	} else if (rel->diff->depth >= this->diff->depth)
 		return 0;
 
-	if (rel->trans.begin()->first.c < first)
+	if (!rel->trans.empty() && rel->trans.begin()->first.c < first)
 		first = rel->trans.begin()->first.c;
 	if (rel->flags & DiffEncodeFlag) {
 		for (int i = first; i < upper_bound; i++) {
@@ -211,7 +216,7 @@ int State::make_relative(State *rel, int upper_bound)
 	if (flags & DiffEncodeFlag)
 		return 0;
 
-	if (rel->trans.begin()->first.c < 0)
+	if (!rel->trans.empty() && rel->trans.begin()->first.c < 0)
 		first = rel->trans.begin()->first.c;
 
 	flags |= DiffEncodeFlag;
@@ -287,16 +292,23 @@ void State::flatten_relative(State *nonmatching, int upper_bound)
 static void split_node_types(NodeSet *nodes, NodeSet **anodes, NodeSet **nnodes
 )
 {
+	NodeSet tmp;
+
 	*anodes = *nnodes = NULL;
-	for (NodeSet::iterator i = nodes->begin(); i != nodes->end(); ) {
+	for (NodeSet::iterator i = nodes->begin(); i != nodes->end(); i++) {
 		if ((*i)->is_accept()) {
 			if (!*anodes)
 				*anodes = new NodeSet;
 			(*anodes)->insert(*i);
-			NodeSet::iterator k = i++;
-			nodes->erase(k);
-		} else
-			i++;
+		}
+	}
+	if (*anodes) {
+		/* nodes is in order so each insert is an append */
+		for (NodeSet::iterator i = nodes->begin(); i != nodes->end(); i++) {
+			if (!(*i)->is_accept())
+				tmp.insert(*i);
+		}
+		nodes->swap(tmp);
 	}
 	*nnodes = nodes;
 }
@@ -309,16 +321,16 @@ State *DFA::add_new_state(NodeSet *anodes, NodeSet *nnodes, State *other)
 
 	ProtoState proto;
 	proto.init(nnodev, anodes);
-	State *state = new State(node_map.size(), proto, other, filedfa);
-	pair<NodeMap::iterator,bool> x = node_map.insert(proto, state);
-	if (x.second == false) {
-		delete state;
-	} else {
-		states.push_back(state);
-		work_queue.push_back(state);
-	}
+	State *state = node_map.find(proto);
+	if (state)
+		return state;
+
+	state = new State(node_map.size(), proto, other, filedfa);
+	node_map.insert(proto, state);
+	states.push_back(state);
+	work_queue.push_back(state);
 
-	return x.first->second;
+	return state;
 }
 
 State *DFA::add_new_state(NodeSet *nodes, State *other)
@@ -334,22 +346,33 @@ State *DFA::add_new_state(NodeSet *nodes, State *other)
 	return state;
 }
 
-void DFA::update_state_transitions(State *state)
+/* Compute possible transitions for state->nodes.  This is done by
+ * iterating over all the nodes in state->nodes and combining the
+ * transitions.
+ *
+ * The resultant transition set is a mapping of characters to
+ * sets of nodes.
+ *
+ * Note: the follow set for accept nodes is always empty so we don't
+ * need to compute follow for the accept nodes in a protostate
+ *
+ * This only reads the expression tree so it can be run concurrently for
+ * different states.
+ */
+static void compute_cases(State *state, Cases &cases)
 {
-	/* Compute possible transitions for state->nodes.  This is done by
-	 * iterating over all the nodes in state->nodes and combining the
-	 * transitions.
-	 *
-	 * The resultant transition set is a mapping of characters to
-	 * sets of nodes.
-	 *
-	 * Note: the follow set for accept nodes is always empty so we don't
-	 * need to compute follow for the accept nodes in a protostate
-	 */
-	Cases cases;
 	for (hashedNodeVec::iterator i = state->proto.nnodes->begin(); i != state->proto.nnodes->end(); i++)
 		(*i)->follow(cases);
 
+	/* follow() accumulates the sets unordered, fix them up once */
+	if (cases.otherwise)
+		cases.otherwise->normalize();
+	for (Cases::iterator j = cases.begin(); j != cases.end(); j++)
+		j->second->normalize();
+}
+
+void DFA::update_state_transitions(State *state, Cases &cases)
+{
 	/* Now for each set of nodes in the computed transitions, make
 	 * sure that there is a state that maps to it, and add the
 	 * matching case to the state.
@@ -362,8 +385,11 @@ void DFA::update_state_transitions(State *state)
 		state->otherwise = nonmatching;
 
 	/* For each transition from *from, check if the set of nodes it
-	 * transitions to already has been mapped to a state
+	 * transitions to already has been mapped to a state. Cases are in
+	 * ascending order, so the transitions are appended to room made for
+	 * all of them up front.
 	 */
+	state->trans.reserve(cases.cases.size());
 	for (Cases::iterator j = cases.begin(); j != cases.end(); j++) {
 		State *target;
 		target = add_new_state(j->second, nonmatching);
@@ -379,6 +405,14 @@ void DFA::update_state_transitions(State *state)
 	}
 }
 
+void DFA::update_state_transitions(State *state)
+{
+	Cases cases;
+
+	compute_cases(state, cases);
+	update_state_transitions(state, cases);
+}
+
 /* WARNING: This routine can only be called from within DFA creation as
  * the nodes value is only valid during dfa construction.
  */
@@ -391,20 +425,25 @@ void DFA::dump_node_to_dfa(void)
 		cerr << "  " << (*i)->label << " <= " << (*i)->proto << "\n";
 }
 
+void DFA::dump_work_progress(const char *header, dfaflags_t flags, int i)
+{
+	if (i % 1000 == 0 && (flags & DFA_DUMP_PROGRESS)) {
+		cerr << "\033[2K" << header << ": queue "
+		     << work_queue.size()
+		     << "\tstates "
+		     << states.size()
+		     << "\teliminated duplicates "
+		     << node_map.dup
+		     << "\r";
+	}
+}
+
 void DFA::process_work_queue(const char *header, dfaflags_t flags)
 {
 	int i = 0;
 
 	while (!work_queue.empty()) {
-		if (i % 1000 == 0 && (flags & DFA_DUMP_PROGRESS)) {
-			cerr << "\033[2K" << header << ": queue "
-			     << work_queue.size()
-			     << "\tstates "
-			     << states.size()
-			     << "\teliminated duplicates "
-			     << node_map.dup
-			     << "\r";
-		}
+		dump_work_progress(header, flags, i);
 		i++;
 
 		State *from = work_queue.front();
@@ -417,6 +456,99 @@ void DFA::process_work_queue(const char *header, dfaflags_t flags)
 	}  /* while (!work_queue.empty()) */
 }
 
+/*
+ * CasesBatch - a batch of states from the front of the work_queue and
+ *              their computed Cases, shared by the build worker threads
+ * @next: index of the next state to be claimed by a worker
+ */
+struct CasesBatch {
+	vector<State *> states;
+	vector<Cases> cases;
+	size_t next;
+};
+
+static void *compute_cases_worker(void *data)
+{
+	CasesBatch *batch = (CasesBatch *) data;
+	size_t i;
+
+	while ((i = __sync_fetch_and_add(&batch->next, 1)) < batch->states.size())
+		compute_cases(batch->states[i], batch->cases[i]);
+
+	return NULL;
+}
+
+/* Don't bother with threads for batches smaller than this, the work
+ * queue will be too short to keep the threads busy.
+ */
+#define MIN_PARALLEL_BATCH	64
+/* Bound the number of Cases held at once to limit peak memory use */
+#define MAX_PARALLEL_BATCH	8192
+#define MAX_BUILD_THREADS	64
+
+/**
+ * process_work_queue_parallel - multi-threaded subset construction
+ * @header: progress header
+ * @flags: flags controlling dfa creation
+ *
+ * The follow() computation, which dominates dfa creation, only reads the
+ * expression tree, so the Cases for all the states currently on the
+ * work_queue are computed concurrently by worker threads. The Cases are
+ * then turned into states in work_queue order by the calling thread,
+ * so states are created and labeled in exactly the same order as
+ * process_work_queue, and the resulting tables are identical.
+ */
+void DFA::process_work_queue_parallel(const char *header, dfaflags_t flags)
+{
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int i = 0;
+
+	if (nthreads > MAX_BUILD_THREADS)
+		nthreads = MAX_BUILD_THREADS;
+	if (nthreads < 2) {
+		process_work_queue(header, flags);
+		return;
+	}
+
+	vector<pthread_t> threads(nthreads - 1);
+	CasesBatch batch;
+	while (!work_queue.empty()) {
+		/* only a prefix of the work_queue is taken, so new states
+		 * are still queued behind the remaining ones
+		 */
+		batch.states.clear();
+		while (!work_queue.empty() &&
+		       batch.states.size() < MAX_PARALLEL_BATCH) {
+			batch.states.push_back(work_queue.front());
+			work_queue.pop_front();
+		}
+		batch.cases.clear();
+		batch.cases.resize(batch.states.size());
+		batch.next = 0;
+
+		long started = 0;
+		if (batch.states.size() >= MIN_PARALLEL_BATCH) {
+			for (; started < nthreads - 1; started++) {
+				if (pthread_create(&threads[started], NULL,
+						   compute_cases_worker, &batch))
+					break;
+			}
+		}
+		/* the calling thread works the batch as well */
+		compute_cases_worker(&batch);
+		for (long t = 0; t < started; t++)
+			pthread_join(threads[t], NULL);
+
+		for (size_t j = 0; j < batch.states.size(); j++) {
+			dump_work_progress(header, flags, i);
+			i++;
+
+			update_state_transitions(batch.states[j],
+						 batch.cases[j]);
+		}
+	}
+}
+
 /**
  * Construct a DFA from a syntax tree.
  */
@@ -457,7 +589,10 @@ DFA::DFA(Node *root, dfaflags_t flags, bool buildfiledfa): root(root), filedfa(b
 	 *       work_queue at any given time, thus reducing peak memory use.
 	 */
 	work_queue.push_back(start);
-	process_work_queue("Creating dfa", flags);
+	if (flags & DFA_CONTROL_PARALLEL_BUILD)
+		process_work_queue_parallel("Creating dfa", flags);
+	else
+		process_work_queue("Creating dfa", flags);
 	max_range += oob_range;
 	/* if oob_range is ever greater than 256 need to move to computing this */
 	if (oob_range)
@@ -494,6 +629,238 @@ DFA::DFA(Node *root, dfaflags_t flags, bool buildfiledfa): root(root), filedfa(b
 	node_map.clear();
 }
 
+struct FragTupleMapTraits {
+	typedef pair<const FragTuple *, State *> Entry;
+
+	static bool empty(const Entry &e) { return !e.second; }
+	static unsigned long hash(const Entry &e) { return hash_tuple(*e.first); }
+	static bool equal(const Entry &e,
+			  unsigned long hash __attribute__((unused)),
+			  const FragTuple &tuple)
+	{
+		return *e.first == tuple;
+	}
+	static unsigned long hash_tuple(const FragTuple &tuple)
+	{
+		unsigned long hash = 5381;
+
+		for (FragTuple::const_iterator i = tuple.begin();
+		     i != tuple.end(); i++)
+			hash = ((hash << 5) + hash) + *i;
+		return hash;
+	}
+};
+
+/*
+ * ProductBuild - working state for building a DFA from fragments
+ * @fragments: the fragments being combined
+ * @accepts: the accept node of each fragment
+ * @tuples: the fragment states of each product state, stable storage
+ *          for the keys of @map
+ * @map: product states by their fragment states
+ * @work: states whose transitions still need to be computed
+ */
+struct ProductBuild {
+	ProductBuild(vector<DFAFragment *> &fragments, vector<Node *> &accepts):
+		fragments(fragments), accepts(accepts), tuples(), map(), work() { }
+
+	vector<DFAFragment *> &fragments;
+	vector<Node *> &accepts;
+	deque<FragTuple> tuples;
+	HashTable<FragTupleMapTraits::Entry, FragTupleMapTraits> map;
+	list<pair<State *, const FragTuple *> > work;
+};
+
+#define TUPLE_FRAG(t)		((t) >> 32)
+#define TUPLE_STATE(t)		((uint32_t) (t))
+#define MAKE_TUPLE(f, s)	(((uint64_t) (f) << 32) | (s))
+
+State *DFA::add_product_state(ProductBuild &build, const FragTuple &tuple)
+{
+	unsigned long hash = FragTupleMapTraits::hash_tuple(tuple);
+	FragTupleMapTraits::Entry &entry = build.map.find_slot(hash, tuple);
+	if (entry.second)
+		return entry.second;
+
+	/* the accept nodes of the accepting fragments are what the
+	 * state would have had if it had been built from the whole tree
+	 */
+	NodeSet *anodes = NULL;
+	for (FragTuple::const_iterator i = tuple.begin(); i != tuple.end(); i++) {
+		DFAFragment *frag = build.fragments[TUPLE_FRAG(*i)];
+		if (!frag->accept[TUPLE_STATE(*i)])
+			continue;
+		if (!anodes)
+			anodes = new NodeSet;
+		anodes->insert(static_cast<ImportantNode *>(build.accepts[TUPLE_FRAG(*i)]));
+	}
+
+	ProtoState proto;
+	proto.init(NULL, anodes_cache.insert(anodes));
+	State *state = new State(states.size(), proto, nonmatching, filedfa);
+
+	build.tuples.push_back(tuple);
+	build.map.fill(entry, make_pair(&build.tuples.back(), state));
+	states.push_back(state);
+	build.work.push_back(make_pair(state, &build.tuples.back()));
+
+	return state;
+}
+
+void DFA::update_product_transitions(ProductBuild &build, State *state,
+				     const FragTuple &from)
+{
+	FragTuple next;
+	vector<uint16_t> chars;
+
+	for (FragTuple::const_iterator i = from.begin(); i != from.end(); i++) {
+		DFAFragment *frag = build.fragments[TUPLE_FRAG(*i)];
+		uint32_t s = TUPLE_STATE(*i);
+		uint32_t o = frag->otherwise[s];
+
+		if (o != frag->nonmatching)
+			next.push_back(MAKE_TUPLE(TUPLE_FRAG(*i), o));
+		chars.insert(chars.end(),
+			     frag->trans_chars.begin() + frag->trans_index[s],
+			     frag->trans_chars.begin() + frag->trans_index[s + 1]);
+	}
+	state->otherwise = add_product_state(build, next);
+
+	sort(chars.begin(), chars.end());
+	chars.erase(unique(chars.begin(), chars.end()), chars.end());
+	state->trans.reserve(chars.size());
+	for (vector<uint16_t>::iterator c = chars.begin(); c != chars.end(); c++) {
+		next.clear();
+		for (FragTuple::const_iterator i = from.begin(); i != from.end(); i++) {
+			DFAFragment *frag = build.fragments[TUPLE_FRAG(*i)];
+			uint32_t n = frag->next(TUPLE_STATE(*i), *c);
+
+			if (n != frag->nonmatching)
+				next.push_back(MAKE_TUPLE(TUPLE_FRAG(*i), n));
+		}
+
+		State *target = add_product_state(build, next);
+		/* chars are ascending so this is an append */
+		if (target != state->otherwise)
+			state->trans.insert(make_pair(transchar((unsigned char) *c),
+						      target));
+	}
+}
+
+/**
+ * Construct a DFA from the product of dfa fragments
+ * @fragments: dfas of the rule subtrees, without out of band transitions
+ * @accepts: the accept node of each fragment's subtree
+ *
+ * Builds the same language and permissions as the DFA of the tree
+ * alternating each subtree catenated with its accept node, by walking
+ * the reachable combinations of fragment states instead of the node sets
+ * of the whole tree.  Fragments that can no longer match are dropped from
+ * the combination, so the result is no larger than the DFA built from the
+ * tree and can be minimized etc. the same way.
+ */
+DFA::DFA(vector<DFAFragment *> &fragments, vector<Node *> &accepts,
+	 dfaflags_t flags, bool buildfiledfa): root(NULL), filedfa(buildfiledfa)
+{
+	ProductBuild build(fragments, accepts);
+	FragTuple tuple;
+
+	diffcount = 0;		/* set by diff_encode */
+	max_range = 256;
+	upper_bound = 256;
+	oob_range = 0;
+	ord_range = 8;
+
+	if (flags & DFA_DUMP_PROGRESS)
+		fprintf(stderr, "Creating dfa from fragments:\r");
+
+	nonmatching = NULL;
+	nonmatching = add_product_state(build, tuple);
+	for (size_t i = 0; i < fragments.size(); i++) {
+		if (fragments[i]->start != fragments[i]->nonmatching)
+			tuple.push_back(MAKE_TUPLE(i, fragments[i]->start));
+	}
+	start = add_product_state(build, tuple);
+
+	int i = 0;
+	while (!build.work.empty()) {
+		if (i++ % 1000 == 0 && (flags & DFA_DUMP_PROGRESS))
+			cerr << "\033[2KCreating dfa from fragments: queue "
+			     << build.work.size() << "\tstates "
+			     << states.size() << "\r";
+
+		pair<State *, const FragTuple *> work = build.work.front();
+		build.work.pop_front();
+		update_product_transitions(build, work.first, *work.second);
+	}
+
+	if (flags & (DFA_DUMP_STATS))
+		cerr << "\033[2KCreated dfa from " << fragments.size()
+		     << " fragments: states " << states.size() << "\n";
+}
+
+DFAFragment::DFAFragment(DFA &dfa): DFAFragment()
+{
+	unordered_map<State *, uint32_t> index;
+	uint32_t n = 0;
+
+	for (Partition::iterator i = dfa.states.begin(); i != dfa.states.end(); i++)
+		index[*i] = n++;
+
+	start = index[dfa.start];
+	nonmatching = index[dfa.nonmatching];
+	otherwise.reserve(n);
+	accept.reserve(n);
+	trans_index.reserve(n + 1);
+	for (Partition::iterator i = dfa.states.begin(); i != dfa.states.end(); i++) {
+		otherwise.push_back(index[(*i)->otherwise]);
+		accept.push_back((*i)->perms.is_accept());
+		trans_index.push_back(trans_chars.size());
+		for (StateTrans::iterator j = (*i)->trans.begin();
+		     j != (*i)->trans.end(); j++) {
+			trans_chars.push_back(j->first.c);
+			trans_next.push_back(index[j->second]);
+		}
+	}
+	trans_index.push_back(trans_chars.size());
+}
+
+/* check a fragment read from disk is consistent before it is used */
+bool DFAFragment::valid(void) const
+{
+	size_t n = size();
+
+	if (!n || start >= n || nonmatching >= n || accept.size() != n ||
+	    trans_index.size() != n + 1 ||
+	    trans_chars.size() != trans_next.size() ||
+	    trans_index[0] != 0 || trans_index[n] != trans_chars.size())
+		return false;
+
+	for (size_t s = 0; s < n; s++) {
+		if (otherwise[s] >= n || trans_index[s] > trans_index[s + 1])
+			return false;
+		for (uint32_t j = trans_index[s]; j < trans_index[s + 1]; j++) {
+			if (trans_next[j] >= n || trans_chars[j] > 255 ||
+			    (j > trans_index[s] &&
+			     trans_chars[j] <= trans_chars[j - 1]))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+uint32_t DFAFragment::next(uint32_t state, uint16_t c) const
+{
+	vector<uint16_t>::const_iterator begin = trans_chars.begin() + trans_index[state];
+	vector<uint16_t>::const_iterator end = trans_chars.begin() + trans_index[state + 1];
+	vector<uint16_t>::const_iterator i = lower_bound(begin, end, c);
+
+	if (i != end && *i == c)
+		return trans_next[i - trans_chars.begin()];
+	return otherwise[state];
+}
+
 DFA::~DFA()
 {
 	anodes_cache.clear();
@@ -644,6 +1011,289 @@ int DFA::apply_and_clear_deny(void)
 	return c;
 }
 
+/*
+ * RefinablePartition - partition of the states by index used by
+ * refine_partitions_hopcroft
+ * @elems: state indexes grouped by block
+ * @loc: position of a state in @elems
+ * @block: block a state belongs to
+ * @first, @mid, @end: block b holds elems[first[b] .. end[b]), with the
+ *                     states marked for splitting at the front upto mid[b]
+ * @pending: whether a block is on the @work list of splitters
+ */
+class RefinablePartition {
+public:
+	vector<size_t> elems, loc, block;
+	vector<size_t> first, mid, end;
+	vector<bool> pending;
+	vector<size_t> touched;
+	list<size_t> work;
+
+	RefinablePartition(size_t n): elems(n), loc(n), block(n) { }
+
+	size_t size(size_t b) const { return end[b] - first[b]; }
+	size_t count(void) const { return first.size(); }
+
+	size_t add_block(void)
+	{
+		size_t b = first.size();
+		first.push_back(b ? end[b - 1] : 0);
+		mid.push_back(first[b]);
+		end.push_back(first[b]);
+		pending.push_back(false);
+		return b;
+	}
+
+	void add_state(size_t b, size_t s)
+	{
+		elems[end[b]] = s;
+		loc[s] = end[b]++;
+		block[s] = b;
+	}
+
+	void queue(size_t b)
+	{
+		pending[b] = true;
+		work.push_back(b);
+	}
+
+	/* mark @s to be split off of its block */
+	void mark(size_t s)
+	{
+		size_t b = block[s];
+		size_t l = loc[s];
+		if (l < mid[b])
+			return;
+		if (mid[b] == first[b])
+			touched.push_back(b);
+		size_t other = elems[mid[b]];
+		elems[l] = other;
+		loc[other] = l;
+		elems[mid[b]] = s;
+		loc[s] = mid[b]++;
+	}
+
+	/* split the marked states of each touched block into a new block
+	 * and update the splitter work list. If the block being split is
+	 * already queued both halves have to be, otherwise only the smaller
+	 * half is needed.
+	 */
+	void split(void)
+	{
+		for (vector<size_t>::iterator i = touched.begin();
+		     i != touched.end(); i++) {
+			size_t b = *i;
+			if (mid[b] == end[b]) {
+				mid[b] = first[b];
+				continue;
+			}
+			size_t nb = first.size();
+			size_t start = first[b], split_at = mid[b];
+			first.push_back(start);
+			mid.push_back(start);
+			end.push_back(split_at);
+			pending.push_back(false);
+			first[b] = split_at;
+			for (size_t j = first[nb]; j < end[nb]; j++)
+				block[elems[j]] = nb;
+			if (pending[b] || size(nb) <= size(b))
+				queue(nb);
+			else
+				queue(b);
+		}
+		touched.clear();
+	}
+};
+
+/**
+ * refine_partitions_hopcroft - worklist based partition refinement
+ * @partitions: initial partitions, replaced by the refined partitions
+ * @flags: flags controlling dfa creation
+ *
+ * Computes the same coarsest stable partitioning as the iterative
+ * same_mappings() pass in minimize, but using Hopcroft's algorithm with
+ * inverse transition indexes so that it does not have to repeatedly sweep
+ * every partition until nothing splits.
+ *
+ * The transition function refined on is the one same_mappings() uses,
+ * ie. for each character in a state's trans it is the listed state, for
+ * every other character it is the state's otherwise. The otherwise
+ * transition is treated as an extra input symbol.
+ *
+ * Instead of expanding the default transitions for every character, a
+ * splitter block B is applied as
+ *   P = states whose otherwise is in B
+ *   split on P
+ *   for each character c
+ *     in  = states with trans[c] in B
+ *     def = states in P that have a transition on c
+ *     split on (in - P) + (def - in)
+ * After the first split P is a union of blocks, so splitting on the last
+ * set gives the same blocks as splitting on the states that reach B on c.
+ *
+ * The refined partitions are ordered by their first state and the states
+ * within a partition keep the order of the states list, so minimize picks
+ * the same representative states as it does with iterative refinement.
+ */
+void DFA::refine_partitions_hopcroft(list<Partition *> &partitions,
+				     dfaflags_t flags)
+{
+	size_t n = states.size();
+	vector<State *> st(n);
+	unordered_map<const State *, size_t> idx;
+	RefinablePartition part(n);
+
+	idx.reserve(n);
+	size_t k = 0;
+	for (Partition::iterator i = states.begin(); i != states.end(); i++, k++) {
+		st[k] = *i;
+		idx[*i] = k;
+	}
+
+	for (list<Partition *>::iterator p = partitions.begin();
+	     p != partitions.end(); p++) {
+		size_t b = part.add_block();
+		for (Partition::iterator i = (*p)->begin(); i != (*p)->end(); i++)
+			part.add_state(b, idx[*i]);
+		delete *p;
+	}
+	partitions.clear();
+
+	/* inverse transitions indexed by destination state */
+	short lo = 0, hi = 0;
+	vector<size_t> in_off(n + 1, 0), other_off(n + 1, 0);
+	for (size_t s = 0; s < n; s++) {
+		for (StateTrans::iterator j = st[s]->trans.begin();
+		     j != st[s]->trans.end(); j++) {
+			in_off[idx[j->second]]++;
+			if (j->first.c < lo)
+				lo = j->first.c;
+			if (j->first.c > hi)
+				hi = j->first.c;
+		}
+		other_off[idx[st[s]->otherwise]]++;
+	}
+	for (size_t s = 0; s < n; s++) {
+		in_off[s + 1] += in_off[s];
+		other_off[s + 1] += other_off[s];
+	}
+	vector<size_t> in_src(in_off[n]), other_src(n);
+	vector<short> in_char(in_off[n]);
+	for (size_t s = n; s-- > 0; ) {
+		for (StateTrans::iterator j = st[s]->trans.begin();
+		     j != st[s]->trans.end(); j++) {
+			size_t t = --in_off[idx[j->second]];
+			in_src[t] = s;
+			in_char[t] = j->first.c;
+		}
+		other_src[--other_off[idx[st[s]->otherwise]]] = s;
+	}
+	idx.clear();
+
+	/* the transition function is total so the largest initial block
+	 * does not need to be used as a splitter
+	 */
+	size_t largest = 0;
+	for (size_t b = 1; b < part.count(); b++) {
+		if (part.size(b) > part.size(largest))
+			largest = b;
+	}
+	for (size_t b = 0; b < part.count(); b++) {
+		if (b != largest)
+			part.queue(b);
+	}
+
+	vector<size_t> splitter, pred;
+	vector<bool> in_pred(n, false);
+	vector<size_t> stamp(n, 0);
+	size_t cur_stamp = 0;
+	vector<vector<size_t> > in_c(hi - lo + 1), def_c(hi - lo + 1);
+	vector<short> chars;
+	int count = 0;
+
+	while (!part.work.empty()) {
+		size_t b = part.work.front();
+		part.work.pop_front();
+		part.pending[b] = false;
+
+		splitter.assign(part.elems.begin() + part.first[b],
+				part.elems.begin() + part.end[b]);
+
+		/* split on the otherwise transition */
+		for (vector<size_t>::iterator i = splitter.begin();
+		     i != splitter.end(); i++) {
+			for (size_t j = other_off[*i]; j < other_off[*i + 1]; j++) {
+				pred.push_back(other_src[j]);
+				in_pred[other_src[j]] = true;
+				part.mark(other_src[j]);
+			}
+		}
+		part.split();
+
+		/* gather the per character sets */
+		for (vector<size_t>::iterator i = splitter.begin();
+		     i != splitter.end(); i++) {
+			for (size_t j = in_off[*i]; j < in_off[*i + 1]; j++) {
+				short c = in_char[j] - lo;
+				if (in_c[c].empty() && def_c[c].empty())
+					chars.push_back(c);
+				in_c[c].push_back(in_src[j]);
+			}
+		}
+		for (vector<size_t>::iterator i = pred.begin(); i != pred.end(); i++) {
+			for (StateTrans::iterator j = st[*i]->trans.begin();
+			     j != st[*i]->trans.end(); j++) {
+				short c = j->first.c - lo;
+				if (in_c[c].empty() && def_c[c].empty())
+					chars.push_back(c);
+				def_c[c].push_back(*i);
+			}
+		}
+
+		/* split on each character */
+		for (vector<short>::iterator c = chars.begin(); c != chars.end(); c++) {
+			vector<size_t> &in = in_c[*c];
+			vector<size_t> &def = def_c[*c];
+
+			cur_stamp++;
+			for (vector<size_t>::iterator i = in.begin(); i != in.end(); i++) {
+				stamp[*i] = cur_stamp;
+				if (!in_pred[*i])
+					part.mark(*i);
+			}
+			for (vector<size_t>::iterator i = def.begin(); i != def.end(); i++) {
+				if (stamp[*i] != cur_stamp)
+					part.mark(*i);
+			}
+			part.split();
+			in.clear();
+			def.clear();
+		}
+		chars.clear();
+
+		for (vector<size_t>::iterator i = pred.begin(); i != pred.end(); i++)
+			in_pred[*i] = false;
+		pred.clear();
+
+		if ((flags & DFA_DUMP_PROGRESS) && (count++ % 1000 == 0))
+			cerr << "\033[2KMinimize dfa: partitions "
+			     << part.count() << "\tsplitters "
+			     << part.work.size() << "\r";
+	}
+
+	/* rebuild the partitions in states order */
+	vector<Partition *> parts(part.count(), NULL);
+	for (size_t s = 0; s < n; s++) {
+		Partition *p = parts[part.block[s]];
+		if (!p) {
+			p = parts[part.block[s]] = new Partition;
+			partitions.push_back(p);
+		}
+		p->push_back(st[s]);
+		st[s]->partition = p;
+	}
+}
+
 /* minimize the number of dfa states */
 void DFA::minimize(dfaflags_t flags)
 {
@@ -704,6 +1354,10 @@ void DFA::minimize(dfaflags_t flags)
 	 */
 	Partition *new_part;
 	int new_part_count;
+	if (flags & DFA_CONTROL_MINIMIZE_HOPCROFT) {
+		refine_partitions_hopcroft(partitions, flags);
+		goto refined;
+	}
 	do {
 		new_part_count = 0;
 		for (list<Partition *>::iterator p = partitions.begin();
@@ -742,6 +1396,7 @@ void DFA::minimize(dfaflags_t flags)
 		}
 	} while (new_part_count);
 
+refined:
 	if (partitions.size() == states.size()) {
 		if (flags & DFA_DUMP_STATS)
 			cerr << "\033[2KDfa minimization no states removed: partitions "
@@ -1190,9 +1845,24 @@ void DFA::dump_dot_graph(ostream & os)
 	os << '}' << "\n";
 }
 
+/* orders states by label, a stand-in for their address that does not
+ * depend on where the states were allocated
+ */
+struct StateLabelLess {
+	bool operator()(const State *a, const State *b) const
+	{
+		if (a->label != b->label)
+			return a->label < b->label;
+		return a < b;
+	}
+};
+
 /**
  * Compute character equivalence classes in the DFA to save space in the
  * transition table.
+ *
+ * Classes are numbered in the order they are found, walking the edges of
+ * each state grouped by next state in label order.
  */
 map<transchar, transchar> DFA::equivalence_classes(dfaflags_t flags)
 {
@@ -1201,13 +1871,13 @@ map<transchar, transchar> DFA::equivalence_classes(dfaflags_t flags)
 
 	for (Partition::iterator i = states.begin(); i != states.end(); i++) {
 		/* Group edges to the same next state together */
-		map<const State *, Chars> node_sets;
+		map<const State *, Chars, StateLabelLess> node_sets;
 		for (StateTrans::iterator j = (*i)->trans.begin(); j != (*i)->trans.end(); j++) {
 			if (j->first.c < 0)
 				continue;
 			node_sets[j->second].insert(j->first);
 		}
-		for (map<const State *, Chars>::iterator j = node_sets.begin();
+		for (map<const State *, Chars, StateLabelLess>::iterator j = node_sets.begin();
 		     j != node_sets.end(); j++) {
 			/* Group edges to the same next state together by class */
 			map<transchar, Chars> node_classes;
@@ -1290,8 +1960,9 @@ void DFA::apply_equivalence_classes(map<transchar, transchar> &eq)
      * contain the original characters.
      */
 	for (Partition::iterator i = states.begin(); i != states.end(); i++) {
-		map<transchar, State *> tmp;
+		StateTrans tmp;
 		tmp.swap((*i)->trans);
+		(*i)->trans.reserve(tmp.size());
 		for (StateTrans::iterator j = tmp.begin(); j != tmp.end(); j++) {
 			if (j->first.c < 0)
 				continue;
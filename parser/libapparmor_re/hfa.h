@@ -37,9 +37,96 @@
 
 class State;
 
-typedef map<transchar, State *> StateTrans;
 typedef list<State *> Partition;
 
+/*
+ * StateTrans - the explicit transitions out of a State
+ *
+ * Kept as a flat vector of (transchar, State *) pairs sorted by transchar
+ * instead of a map.  Most states only have a handful of transitions and
+ * no state has more than 256 + oob, so a binary search over contiguous
+ * memory beats walking a tree, and it avoids a heap allocation per
+ * transition.  The interface mirrors the subset of std::map that the
+ * dfa code uses, iteration is in ascending transchar order.
+ */
+class StateTrans {
+public:
+	typedef pair<transchar, State *> value_type;
+	typedef vector<value_type>::iterator iterator;
+	typedef vector<value_type>::const_iterator const_iterator;
+	typedef vector<value_type>::reverse_iterator reverse_iterator;
+
+	StateTrans(void): trans() { }
+
+	iterator begin() { return trans.begin(); }
+	iterator end() { return trans.end(); }
+	const_iterator begin() const { return trans.begin(); }
+	const_iterator end() const { return trans.end(); }
+	reverse_iterator rbegin() { return trans.rbegin(); }
+	reverse_iterator rend() { return trans.rend(); }
+
+	size_t size(void) const { return trans.size(); }
+	bool empty(void) const { return trans.empty(); }
+	void clear(void) { trans.clear(); }
+	void reserve(size_t n) { trans.reserve(n); }
+	void swap(StateTrans &rhs) { trans.swap(rhs.trans); }
+
+	iterator lower_bound(transchar c)
+	{
+		size_t lo = 0, hi = trans.size();
+
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (trans[mid].first < c)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return trans.begin() + lo;
+	}
+
+	iterator find(transchar c)
+	{
+		iterator i = lower_bound(c);
+		if (i != trans.end() && i->first == c)
+			return i;
+		return trans.end();
+	}
+
+	/* like map::insert, an existing entry for the key is not replaced */
+	pair<iterator, bool> insert(const value_type &v)
+	{
+		iterator i;
+
+		if (trans.empty() || trans.back().first < v.first) {
+			trans.push_back(v);
+			return make_pair(trans.end() - 1, true);
+		}
+		i = lower_bound(v.first);
+		if (i->first == v.first)
+			return make_pair(i, false);
+		return make_pair(trans.insert(i, v), true);
+	}
+
+	State *&operator[](transchar c)
+	{
+		return insert(make_pair(c, (State *) NULL)).first->second;
+	}
+
+	iterator erase(iterator i) { return trans.erase(i); }
+	size_t erase(transchar c)
+	{
+		iterator i = find(c);
+		if (i == trans.end())
+			return 0;
+		trans.erase(i);
+		return 1;
+	}
+
+private:
+	vector<value_type> trans;
+};
+
 #include "../immunix.h"
 
 ostream &operator<<(ostream &os, const State &state);
@@ -159,6 +246,11 @@ public:
 		return nnodes < rhs.nnodes;
 	}
 
+	bool operator==(ProtoState const &rhs)const
+	{
+		return nnodes == rhs.nnodes && anodes == rhs.anodes;
+	}
+
 	unsigned long size(void)
 	{
 		if (anodes)
@@ -195,7 +287,7 @@ struct DiffDag {
  * proto: Is a temporary work variable used during dfa creation.  It can
  *        be replaced by using the nodemap, but that is slower
  */
-class State {
+class State: public ArenaObject {
 public:
 	State(int l, ProtoState &n, State *other, bool filedfa):
 		label(l), flags(0), perms(), trans()
@@ -263,14 +355,29 @@ public:
 	};
 };
 
+struct NodeMapTraits {
+	typedef pair<ProtoState, State *> Entry;
+
+	static bool empty(const Entry &e) { return !e.second; }
+	static unsigned long hash(const Entry &e) { return hash_proto(e.first); }
+	static bool equal(const Entry &e,
+			  unsigned long hash __attribute__((unused)),
+			  const ProtoState &proto)
+	{
+		return e.first == proto;
+	}
+	static unsigned long hash_proto(const ProtoState &proto)
+	{
+		return (unsigned long) proto.nnodes * 33 +
+			(unsigned long) proto.anodes;
+	}
+};
+
 class NodeMap: public CacheStats
 {
 public:
-	typedef map<ProtoState, State *>::iterator iterator;
-	iterator begin() { return cache.begin(); }
-	iterator end() { return cache.end(); }
-
-	map<ProtoState, State *> cache;
+	typedef HashTable<NodeMapTraits::Entry, NodeMapTraits> Table;
+	Table cache;
 
 	NodeMap(void): cache() { };
 	~NodeMap() { clear(); };
@@ -283,29 +390,78 @@ public:
 		CacheStats::clear();
 	}
 
-	pair<iterator,bool> insert(ProtoState &proto, State *state)
+	/* returns the State already created for @proto or NULL */
+	State *find(ProtoState &proto)
 	{
-		pair<iterator,bool> uniq;
-		uniq = cache.insert(make_pair(proto, state));
-		if (uniq.second == false) {
+		NodeMapTraits::Entry &entry =
+			cache.find_slot(NodeMapTraits::hash_proto(proto), proto);
+		if (entry.second)
 			dup++;
-		} else {
-			sum += proto.size();
-			if (proto.size() > max)
-				max = proto.size();
-		}
-		return uniq;
+		return entry.second;
+	}
+
+	/* add @state for @proto, which must not already be in the map */
+	void insert(ProtoState &proto, State *state)
+	{
+		NodeMapTraits::Entry &entry =
+			cache.find_slot(NodeMapTraits::hash_proto(proto), proto);
+		cache.fill(entry, make_pair(proto, state));
+		sum += proto.size();
+		if (proto.size() > max)
+			max = proto.size();
 	}
 };
 
 
 /* Transitions in the DFA. */
+/*
+ * DFAFragment - compact copy of a dfa built for a single rule subtree
+ *
+ * Fragments only record which states accept, the permissions are supplied
+ * by the accept node of the subtree when fragments are combined into a
+ * DFA, so a fragment can be shared by any rules matching the same
+ * expression.  States are numbered from 0, the transitions of state s are
+ * entries trans_index[s] to trans_index[s + 1] of trans_chars/trans_next,
+ * sorted by character.  Out of band transitions are not supported.
+ */
+class DFA;
+
+class DFAFragment {
+public:
+	DFAFragment(void): start(0), nonmatching(0), otherwise(), accept(),
+		trans_index(), trans_chars(), trans_next() { }
+	DFAFragment(DFA &dfa);
+
+	size_t size(void) const { return otherwise.size(); }
+	bool valid(void) const;
+	uint32_t next(uint32_t state, uint16_t c) const;
+
+	uint32_t start;
+	uint32_t nonmatching;
+	vector<uint32_t> otherwise;
+	vector<uint8_t> accept;
+	vector<uint32_t> trans_index;
+	vector<uint16_t> trans_chars;
+	vector<uint32_t> trans_next;
+};
+
+struct ProductBuild;
+typedef vector<uint64_t> FragTuple;
+
 class DFA {
 	void dump_node_to_dfa(void);
 	State *add_new_state(NodeSet *nodes, State *other);
 	State *add_new_state(NodeSet *anodes, NodeSet *nnodes, State *other);
+	void update_state_transitions(State *state, Cases &cases);
 	void update_state_transitions(State *state);
+	State *add_product_state(ProductBuild &build, const FragTuple &tuple);
+	void update_product_transitions(ProductBuild &build, State *state,
+					const FragTuple &from);
+	void dump_work_progress(const char *header, dfaflags_t flags, int i);
 	void process_work_queue(const char *header, dfaflags_t);
+	void process_work_queue_parallel(const char *header, dfaflags_t flags);
+	void refine_partitions_hopcroft(list<Partition *> &partitions,
+					dfaflags_t flags);
 	void dump_diff_chain(ostream &os, map<State *, Partition> &relmap,
 			     Partition &chain, State *state,
 			     unsigned int &count, unsigned int &total,
@@ -319,6 +475,8 @@ class DFA {
 
 public:
 	DFA(Node *root, dfaflags_t flags, bool filedfa);
+	DFA(vector<DFAFragment *> &fragments, vector<Node *> &accepts,
+	    dfaflags_t flags, bool filedfa);
 	virtual ~DFA();
 
 	State *match_len(State *state, const char *str, size_t len);
@@ -0,0 +1,567 @@
+/*
+ *   Copyright (c) 2026
+ *   Canonical, Ltd. (All rights reserved)
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of version 2 of the GNU General Public
+ *   License published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, contact Canonical Ltd.
+ */
+
+/*
+ * Batched loading of compiled policy.
+ *
+ * Normally every job loads the policy it compiles itself, so a mass
+ * reload does a replacement, and the relabeling that goes with it, per
+ * profile. Kernels supporting policy/set_load can take a whole set of
+ * profiles in a single write, so instead jobs append their policy to a
+ * spool shared with the parent, which loads it in a few large writes.
+ *
+ * The spool is a memfd opened in append mode before any job is started,
+ * so all forked jobs share it. Each unit of policy is appended as one
+ * record by a single write, which the kernel does not interleave with
+ * other writes to the file, and the parent only takes
+ * records that have been written completely. The policy of a job is
+ * spooled in the order it was compiled, so hats still follow the profile
+ * they belong to.
+ *
+ * A set load is atomic, one bad profile fails the whole set, so when a
+ * batch fails its records are loaded one at a time, to load the good ones
+ * and report the ones at fault.
+ *
+ * Policy read from the cache is only checked by the kernel once the job
+ * that found it is gone, so its record carries the profile it was built
+ * from. If the kernel rejects it, the profile is handed back to the parent
+ * to be rebuilt from source, as a job would have done without batching.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <vector>
+
+#include "parser.h"
+#include "load_batch.h"
+
+#define LOAD_BATCH_MAGIC	0x41414c42
+
+/* the spool is only read by the process that wrote it, so host order */
+struct batch_record {
+	uint32_t magic;
+	uint32_t name_len;	/* name used to report errors, follows */
+	uint32_t source_len;	/* profile to rebuild from, follows name */
+	uint32_t pad;
+	uint64_t size;		/* policy, follows the source */
+};
+
+struct batch_entry {
+	string name;
+	string source;		/* empty if the policy can't be rebuilt */
+	off_t offset;		/* of the policy in the spool */
+	size_t size;
+};
+
+static aa_kernel_interface *batch_kernel_interface = NULL;
+static int batch_option;
+static size_t batch_size;		/* load once this much is waiting */
+static int batch_fd = -1;		/* the spool */
+static pid_t batch_owner;		/* the process doing the loads */
+static bool batch_broken = false;	/* a record could not be read */
+static off_t batch_loaded = 0;		/* end of the records loaded */
+static off_t batch_scanned = 0;		/* end of the records in entries */
+static vector<struct batch_entry> batch_entries;
+static vector<string> batch_rebuilds;	/* rejected cached policy */
+
+/**
+ * load_batch_init - start collecting policy to load in batches
+ * @kernel_interface: interface to load the policy with
+ * @option: OPTION_ADD or OPTION_REPLACE
+ * @size: amount of policy to collect before loading it
+ *
+ * Must be called before any job is started, and only if the kernel
+ * supports set loads.
+ *
+ * Returns: 0 on success, -1 with errno set if batching is not possible
+ */
+int load_batch_init(aa_kernel_interface *kernel_interface, int option,
+		    long long size)
+{
+	int fd;
+
+	if ((option != OPTION_ADD && option != OPTION_REPLACE) || size <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = memfd_create("apparmor_parser-load", MFD_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fcntl(fd, F_SETFL, O_APPEND) == -1) {
+		int error = errno;
+
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	batch_kernel_interface = kernel_interface;
+	batch_option = option;
+	batch_size = size;
+	batch_fd = fd;
+	batch_owner = getpid();
+
+	return 0;
+}
+
+/* whether policy should be added to the batch instead of being loaded */
+bool load_batch_active(void)
+{
+	return batch_fd != -1;
+}
+
+/**
+ * load_batch_add - queue policy to be loaded with the next batch
+ * @name: name to report errors loading the policy against
+ * @source: profile to rebuild the policy from if rejected, or NULL
+ * @buffer: the policy
+ * @size: size of @buffer
+ *
+ * Safe to call from any job.
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int load_batch_add(const char *name, const char *source, const char *buffer,
+		   size_t size)
+{
+	struct batch_record rec;
+	struct iovec iov[4];
+	ssize_t wsize;
+
+	if (!source)
+		source = "";
+	rec.magic = LOAD_BATCH_MAGIC;
+	rec.name_len = strlen(name);
+	rec.source_len = strlen(source);
+	rec.pad = 0;
+	rec.size = size;
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = (void *) name;
+	iov[1].iov_len = rec.name_len;
+	iov[2].iov_base = (void *) source;
+	iov[2].iov_len = rec.source_len;
+	iov[3].iov_base = (void *) buffer;
+	iov[3].iov_len = size;
+
+	/* must be a single write, so the record is not interleaved with
+	 * the records of other jobs
+	 */
+	wsize = writev(batch_fd, iov, 4);
+	if (wsize == -1)
+		return -1;
+	if ((size_t) wsize != sizeof(rec) + rec.name_len + rec.source_len +
+			      size) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * load_batch_add_file - queue the policy in a file to be loaded
+ * @name: name to report errors loading the policy against
+ * @source: profile to rebuild the policy from if rejected, or NULL
+ * @path: file containing the policy, or NULL to read stdin
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int load_batch_add_file(const char *name, const char *source,
+			const char *path)
+{
+	char chunk[16384];
+	struct stat st;
+	string data;
+	ssize_t rsize;
+	int fd, error;
+
+	fd = path ? open(path, O_RDONLY | O_CLOEXEC) : 0;
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+		data.reserve(st.st_size);
+	while ((rsize = read(fd, chunk, sizeof(chunk))) > 0)
+		data.append(chunk, rsize);
+	error = errno;
+	if (path)
+		close(fd);
+	if (rsize == -1) {
+		errno = error;
+		return -1;
+	}
+
+	return load_batch_add(name, source, data.data(), data.size());
+}
+
+/* move the records written completely since the last scan to entries */
+static int batch_scan(void)
+{
+	struct batch_record rec;
+	struct batch_entry entry;
+	struct stat st;
+	off_t end;
+
+	if (fstat(batch_fd, &st) == -1)
+		return -1;
+	while (batch_scanned + (off_t) sizeof(rec) <= st.st_size) {
+		if (pread(batch_fd, &rec, sizeof(rec), batch_scanned) !=
+		    sizeof(rec) || rec.magic != LOAD_BATCH_MAGIC) {
+			errno = EIO;
+			return -1;
+		}
+		end = batch_scanned + sizeof(rec) + rec.name_len +
+		      rec.source_len + rec.size;
+		if (end > st.st_size)
+			break;		/* still being written */
+
+		entry.name.resize(rec.name_len);
+		if (pread(batch_fd, &entry.name[0], rec.name_len,
+			  batch_scanned + sizeof(rec)) != rec.name_len) {
+			errno = EIO;
+			return -1;
+		}
+		entry.source.resize(rec.source_len);
+		if (pread(batch_fd, &entry.source[0], rec.source_len,
+			  batch_scanned + sizeof(rec) + rec.name_len) !=
+		    rec.source_len) {
+			errno = EIO;
+			return -1;
+		}
+		entry.offset = end - rec.size;
+		entry.size = rec.size;
+		batch_entries.push_back(entry);
+		batch_scanned = end;
+	}
+
+	return 0;
+}
+
+static int batch_write(const char *buffer, size_t size)
+{
+	if (batch_option == OPTION_ADD)
+		return aa_kernel_interface_load_policy(batch_kernel_interface,
+						       buffer, size);
+	return aa_kernel_interface_replace_policy(batch_kernel_interface,
+						  buffer, size);
+}
+
+static void batch_error(const char *name, int error)
+{
+	if (batch_option == OPTION_ADD)
+		PERROR(_("%s: Unable to add \"%s\".  %s\n"), progname, name,
+		       strerror(error));
+	else
+		PERROR(_("%s: Unable to replace \"%s\".  %s\n"), progname,
+		       name, strerror(error));
+}
+
+/* report @entry was rejected, returns the error unless it is rebuilt */
+static int batch_reject(struct batch_entry &entry, int error)
+{
+	batch_error(entry.name.c_str(), error);
+	if (entry.source.empty())
+		return error;
+
+	batch_rebuilds.push_back(entry.source);
+	return 0;
+}
+
+/* load the entries from @first up to, but not including, @last as a set
+ *
+ * Returns: 0 on success, else the error of the first entry that failed
+ * and is not being rebuilt
+ */
+static int batch_load(size_t first, size_t last)
+{
+	size_t i, offset, size = 0;
+	ssize_t rsize;
+	int rc, error = 0;
+
+	for (i = first; i < last; i++)
+		size += batch_entries[i].size;
+	ByteBuffer buf(size);
+	for (i = first; i < last; i++) {
+		struct batch_entry &entry = batch_entries[i];
+
+		rsize = pread(batch_fd, buf.append(entry.size), entry.size,
+			      entry.offset);
+		if (rsize != (ssize_t) entry.size) {
+			error = rsize == -1 ? errno : EIO;
+			PERROR(_("%s: Unable to read batched policy: %s\n"),
+			       progname, strerror(error));
+			return error;
+		}
+	}
+
+	PDEBUG("Loading batch of %zu profiles, %zu bytes\n", last - first,
+	       size);
+	if (batch_write(buf.data(), buf.size()) == 0)
+		return 0;
+	error = errno;
+	if (last - first == 1)
+		return batch_reject(batch_entries[first], error);
+
+	/* nothing in a failed set is loaded, so load what can be */
+	error = 0;
+	for (i = first, offset = 0; i < last; i++) {
+		struct batch_entry &entry = batch_entries[i];
+
+		if (batch_write(buf.data() + offset, entry.size) == -1) {
+			rc = batch_reject(entry, errno);
+			if (rc && !error)
+				error = rc;
+		}
+		offset += entry.size;
+	}
+
+	return error;
+}
+
+/**
+ * load_batch_flush - load the policy queued by jobs that has been written
+ * @all: load everything, even if less than a batch is waiting
+ *
+ * Only does anything in the process that set up batching. Policy is
+ * loaded in sets of at least the batch size, until less than that is
+ * waiting, which is kept for the next flush unless @all is set.
+ *
+ * Profiles of rejected cached policy are kept for load_batch_rebuild().
+ *
+ * Returns: 0 on success, else the error of the first policy that failed
+ */
+int load_batch_flush(bool all)
+{
+	size_t first = 0, i, size = 0;
+	struct stat st;
+	int rc, error = 0;
+
+	if (batch_fd == -1 || getpid() != batch_owner)
+		return 0;
+
+	if (!batch_broken && batch_scan() == -1) {
+		error = errno;
+		PERROR(_("%s: Unable to read batched policy: %s\n"), progname,
+		       strerror(error));
+		/* records after a bad one can not be found */
+		batch_broken = true;
+	}
+
+	for (i = 0; i < batch_entries.size(); i++) {
+		size += batch_entries[i].size;
+		if (size >= batch_size ||
+		    (all && i + 1 == batch_entries.size())) {
+			rc = batch_load(first, i + 1);
+			if (rc && !error)
+				error = rc;
+			first = i + 1;
+			size = 0;
+		}
+	}
+	if (first) {
+		off_t end = batch_entries[first - 1].offset +
+			    batch_entries[first - 1].size;
+
+		/* give back the memory of what has been loaded */
+		fallocate(batch_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			  batch_loaded, end - batch_loaded);
+		batch_loaded = end;
+		batch_entries.erase(batch_entries.begin(),
+				    batch_entries.begin() + first);
+	}
+
+	if (all && !batch_broken && fstat(batch_fd, &st) == 0 &&
+	    st.st_size > batch_scanned) {
+		PERROR(_("%s: Batched policy was not completely written\n"),
+		       progname);
+		if (!error)
+			error = EIO;
+	}
+
+	return error;
+}
+
+/**
+ * load_batch_rebuild - take a profile whose cached policy was rejected
+ *
+ * The profile should be compiled again without reading the cache, which
+ * queues its policy for the next flush.
+ *
+ * Returns: the profile, to be freed by the caller, or NULL if none is left
+ */
+char *load_batch_rebuild(void)
+{
+	char *source;
+
+	if (batch_rebuilds.empty())
+		return NULL;
+	source = strdup(batch_rebuilds.back().c_str());
+	batch_rebuilds.pop_back();
+
+	return source;
+}
+
+/* stop batching, anything not flushed is dropped */
+void load_batch_free(void)
+{
+	if (batch_fd != -1)
+		close(batch_fd);
+	batch_fd = -1;
+	batch_entries.clear();
+	batch_rebuilds.clear();
+}
+
+#ifdef UNIT_TEST
+
+#include "lib.h"
+#include "unit_test.h"
+
+/* a fake apparmorfs, whose .replace is a file that takes any policy or a
+ * directory that rejects all of it
+ */
+static int setup_batch(char *dir, bool reject)
+{
+	aa_kernel_interface *kernel_interface;
+	aa_features *features;
+	autofree char *iface = NULL;
+	const char *set_load = "policy {set_load {yes\n}\n}\n";
+	int rc;
+
+	if (!mkdtemp(dir) || asprintf(&iface, "%s/.replace", dir) == -1)
+		return -1;
+	if (reject)
+		rc = mkdir(iface, 0700);
+	else
+		rc = close(open(iface, O_WRONLY | O_CREAT, 0600));
+	if (rc == -1 ||
+	    aa_features_new_from_string(&features, set_load,
+					strlen(set_load)) == -1)
+		return -1;
+	rc = aa_kernel_interface_new(&kernel_interface, features, dir);
+	aa_features_unref(features);
+	if (rc == -1)
+		return -1;
+
+	return load_batch_init(kernel_interface, OPTION_REPLACE, 16);
+}
+
+static void cleanup_batch(const char *dir)
+{
+	autofree char *iface = NULL;
+
+	load_batch_free();
+	aa_kernel_interface_unref(batch_kernel_interface);
+	batch_kernel_interface = NULL;
+	batch_loaded = batch_scanned = 0;
+	batch_broken = false;
+	if (asprintf(&iface, "%s/.replace", dir) != -1 &&
+	    unlink(iface) == -1)
+		rmdir(iface);
+	rmdir(dir);
+}
+
+static int test_load(void)
+{
+	char dir[] = "/tmp/tst_load_batch-XXXXXX";
+	autofree char *iface = NULL;
+	char buf[64];
+	int rc = 0, fd;
+	ssize_t size;
+
+	MY_TEST(setup_batch(dir, false) == 0, "set up batch");
+	MY_TEST(load_batch_add("a", NULL, "policy-a-", 9) == 0, "add a");
+	MY_TEST(load_batch_flush(false) == 0, "flush partial batch");
+	MY_TEST(batch_entries.size() == 1, "partial batch is kept");
+	MY_TEST(load_batch_add("b", "b.src", "policy-b", 8) == 0, "add b");
+	MY_TEST(load_batch_flush(false) == 0, "flush full batch");
+	MY_TEST(batch_entries.empty(), "full batch is loaded");
+
+	if (asprintf(&iface, "%s/.replace", dir) != -1 &&
+	    (fd = open(iface, O_RDONLY)) != -1) {
+		size = read(fd, buf, sizeof(buf));
+		close(fd);
+		MY_TEST(size == 17 && memcmp(buf, "policy-a-policy-b", 17) == 0,
+			"batch is loaded as one set");
+	} else {
+		MY_TEST(0, "read loaded policy");
+	}
+	MY_TEST(load_batch_rebuild() == NULL, "nothing to rebuild");
+	cleanup_batch(dir);
+
+	return rc;
+}
+
+static int test_rejected(void)
+{
+	char dir[] = "/tmp/tst_load_batch-XXXXXX";
+	char *source;
+	int rc = 0;
+
+	MY_TEST(setup_batch(dir, true) == 0, "set up rejecting batch");
+	MY_TEST(load_batch_add("compiled", NULL, "compiled", 8) == 0,
+		"add compiled policy");
+	MY_TEST(load_batch_add("cached", "profile", "cached", 6) == 0,
+		"add cached policy");
+	MY_TEST(load_batch_flush(true) == EISDIR,
+		"compiled policy reports its error");
+
+	source = load_batch_rebuild();
+	MY_TEST(source && strcmp(source, "profile") == 0,
+		"cached policy is rebuilt");
+	free(source);
+	MY_TEST(load_batch_rebuild() == NULL, "only cached policy is rebuilt");
+
+	MY_TEST(load_batch_add("cached", "profile", "cached", 6) == 0,
+		"add cached policy alone");
+	MY_TEST(load_batch_flush(true) == 0,
+		"rebuilt policy reports no error");
+	source = load_batch_rebuild();
+	MY_TEST(source && strcmp(source, "profile") == 0,
+		"cached policy loaded alone is rebuilt");
+	free(source);
+	cleanup_batch(dir);
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc = 0;
+	int retval;
+
+	retval = test_load();
+	if (retval != 0)
+		rc = retval;
+
+	retval = test_rejected();
+	if (retval != 0)
+		rc = retval;
+
+	return rc;
+}
+#endif /* UNIT_TEST */
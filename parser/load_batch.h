@@ -0,0 +1,34 @@
+/*
+ *   Copyright (c) 2026
+ *   Canonical, Ltd. (All rights reserved)
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of version 2 of the GNU General Public
+ *   License published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, contact Canonical Ltd.
+ */
+
+#ifndef __AA_LOAD_BATCH_H
+#define __AA_LOAD_BATCH_H
+
+#include <sys/apparmor.h>
+
+int load_batch_init(aa_kernel_interface *kernel_interface, int option,
+		    long long size);
+bool load_batch_active(void);
+int load_batch_add(const char *name, const char *source, const char *buffer,
+		   size_t size);
+int load_batch_add_file(const char *name, const char *source,
+			const char *path);
+int load_batch_flush(bool all);
+char *load_batch_rebuild(void);
+void load_batch_free(void);
+
+#endif /* __AA_LOAD_BATCH_H */
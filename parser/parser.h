@@ -36,6 +36,7 @@
 #include "immunix.h"
 #include "libapparmor_re/apparmor_re.h"
 #include "libapparmor_re/aare_rules.h"
+#include "libapparmor_re/byte_buffer.h"
 
 #include <string>
 
@@ -44,6 +45,7 @@ using namespace std;
 #include <set>
 class Profile;
 class rule_t;
+class ModuleCache;
 
 #define MODULE_NAME "apparmor"
 
@@ -342,6 +344,7 @@ extern int features_supports_unix;
 extern int features_supports_stacking;
 extern int features_supports_domain_xattr;
 extern int kernel_supports_oob;
+extern int kernel_supports_state32;
 extern int conf_verbose;
 extern int conf_quiet;
 extern int names_only;
@@ -355,6 +358,8 @@ extern char *current_filename;
 extern FILE *ofile;
 extern int read_implies_exec;
 extern IncludeCache_t *g_includecache;
+extern FileCache_t *g_filecache;
+extern ModuleCache *g_modulecache;
 
 extern void pwarnf(bool werr, const char *fmt, ...) __attribute__((__format__(__printf__, 2, 3)));
 extern void common_warn_once(const char *name, const char *msg, const char **warned_name);
@@ -384,6 +389,10 @@ extern int yyparse(void);
 extern void yyerror(const char *msg, ...);
 extern int yylex(void);
 
+/* parser_yacc.y */
+extern string parser_token_table(void);
+extern string lexer_state_table(void);
+
 /* parser_include.c */
 extern const char *basedir;
 
@@ -476,7 +485,7 @@ extern int profile_merge_rules(Profile *prof);
 /* parser_interface.c */
 extern int load_profile(int option, aa_kernel_interface *kernel_interface,
 			Profile *prof, int cache_fd);
-extern void sd_serialize_profile(std::ostringstream &buf, Profile *prof,
+extern void sd_serialize_profile(ByteBuffer &buf, Profile *prof,
 				int flatten);
 extern int sd_load_buffer(int option, char *buffer, int size);
 extern int cache_fd;
@@ -498,7 +507,7 @@ extern int merge_hat_rules(Profile *prof);
 extern Profile *merge_policy(Profile *a, Profile *b);
 extern int load_policy(int option, aa_kernel_interface *kernel_interface,
 		       int cache_fd);
-extern int load_hats(std::ostringstream &buf, Profile *prof);
+extern int load_hats(ByteBuffer &buf, Profile *prof);
 extern int load_flattened_hats(Profile *prof, int option,
 			       aa_kernel_interface *kernel_interface,
 			       int cache_fd);
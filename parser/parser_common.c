@@ -79,6 +79,7 @@ int features_supports_ptrace = 0;	/* kernel supports ptrace rules */
 int features_supports_stacking = 0;	/* kernel supports stacking */
 int features_supports_domain_xattr = 0;	/* x attachment cond */
 int kernel_supports_oob = 0;		/* out of band transitions */
+int kernel_supports_state32 = 0;	/* 32 bit dfa state tables */
 int conf_verbose = 0;
 int conf_quiet = 0;
 int names_only = 0;
@@ -97,6 +98,8 @@ char *current_filename = NULL;
 FILE *ofile = NULL;
 
 IncludeCache_t *g_includecache;
+FileCache_t *g_filecache = new FileCache_t();
+ModuleCache *g_modulecache = NULL;
 
 #ifdef FORCE_READ_IMPLIES_EXEC
 int read_implies_exec = 1;
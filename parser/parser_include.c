@@ -45,6 +45,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
 
 #include "lib.h"
@@ -151,9 +152,109 @@ void parse_default_paths(void)
 	add_search_dir(basedir);
 }
 
-FILE *search_path(char *filename, char **fullpath, bool *skip)
+/* cache the directories of includes shared by most profiles before jobs
+ * are forked, up to this many bytes
+ */
+#define FILE_CACHE_PREWARM_MAX (16 * 1024 * 1024)
+
+static bool same_file(struct stat *a, struct stat *b)
 {
-	FILE *newf = NULL;
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+		a->st_size == b->st_size &&
+		a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+		a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+		a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+		a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+static int read_cached_file(const char *path, struct cached_file *file)
+{
+	autoclose int fd = open(path, O_RDONLY | O_CLOEXEC);
+	char buffer[16384];
+	ssize_t size;
+
+	if (fd == -1 || fstat(fd, &file->st) == -1)
+		return -1;
+	if (!S_ISREG(file->st.st_mode))
+		return 0;
+
+	file->data.reserve(file->st.st_size);
+	while ((size = read(fd, buffer, sizeof(buffer))) != 0) {
+		if (size == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		file->data.append(buffer, size);
+	}
+
+	return 0;
+}
+
+/**
+ * get - look up the contents of @path, reading it if needed
+ * @path: the file to look up
+ *
+ * Returns: the cached file, or NULL with errno set if it can not be read.
+ *          The entry stays valid for the rest of the run.
+ */
+cached_file *FileCache_t::get(const char *path)
+{
+	map<string, cached_file *>::iterator i;
+	struct cached_file *file;
+	struct stat st;
+	int error;
+
+	if (stat(path, &st) == -1)
+		return NULL;
+	i = cache.find(path);
+	if (i != cache.end()) {
+		if (same_file(&i->second->st, &st))
+			return i->second;
+		/* changed on disk, the old contents may still be being
+		 * lexed so are left to be freed with the cache
+		 */
+		stale.push_back(i->second);
+		size -= i->second->data.size();
+		cache.erase(i);
+	}
+
+	file = new cached_file;
+	if (read_cached_file(path, file) == -1) {
+		error = errno;
+		delete file;
+		errno = error;
+		return NULL;
+	}
+	cache[path] = file;
+	size += file->data.size();
+
+	return file;
+}
+
+/* returns a stream reading the cached contents of @file, or NULL */
+FILE *open_cached_file(struct cached_file *file)
+{
+	/* fmemopen() fails with EINVAL for a size of 0 on older glibc and
+	 * musl, and an empty file reads the same as /dev/null
+	 */
+	if (file->data.empty())
+		return fopen("/dev/null", "r");
+	return fmemopen((void *) file->data.data(), file->data.size(), "r");
+}
+
+/**
+ * search_cached_path - find @filename in the search path
+ * @filename: the name to look for
+ * @fullpath: RETURNS: if not NULL, the path @filename was found at
+ * @skip: RETURNS: true if @filename was already included
+ *
+ * Returns: the cached file, or NULL if it was not found or is skipped
+ */
+struct cached_file *search_cached_path(char *filename, char **fullpath,
+				       bool *skip)
+{
+	struct cached_file *file = NULL;
 	char *buf = NULL;
 	int i;
 	for (i = 0; i < npath; i++) {
@@ -165,11 +266,12 @@ FILE *search_path(char *filename, char **fullpath, bool *skip)
 		if (g_includecache->find(buf)) {
 			/* hit do not want to re-include */
 			*skip = true;
+			free(buf);
 			return NULL;
 		}
 
-		newf = fopen(buf, "r");
-		if (newf) {
+		file = g_filecache->get(buf);
+		if (file) {
 			/* ignore failing to insert into cache */
 			(void) g_includecache->insert(buf);
 			if (fullpath)
@@ -182,9 +284,76 @@ FILE *search_path(char *filename, char **fullpath, bool *skip)
 		buf = NULL;
 	}
 	*skip = false;
+	return file;
+}
+
+FILE *search_path(char *filename, char **fullpath, bool *skip)
+{
+	struct cached_file *file;
+	char *buf = NULL;
+	FILE *newf = NULL;
+
+	/* the file has been read into the cache, don't read it again */
+	file = search_cached_path(filename, &buf, skip);
+	if (file)
+		newf = open_cached_file(file);
+	if (fullpath)
+		*fullpath = buf;
+	else
+		free(buf);
+
 	return newf;
 }
 
+static int prewarm_dir_cb(int dirfd unused, const char *name, struct stat *st,
+			  void *data)
+{
+	const char *dir = (const char *) data;
+	autofree char *path = NULL;
+
+	if (g_filecache->size > FILE_CACHE_PREWARM_MAX)
+		return 0;
+	if (asprintf(&path, "%s/%s", dir, name) < 0) {
+		path = NULL;
+		return 0;
+	}
+	if (is_blacklisted(name, path))
+		return 0;
+	if (S_ISDIR(st->st_mode))
+		(void) dirat_for_each(AT_FDCWD, path, path, prewarm_dir_cb);
+	else if (S_ISREG(st->st_mode))
+		(void) g_filecache->get(path);
+
+	return 0;
+}
+
+/*
+ * Read the abstractions and tunables of the search path into the file
+ * cache, so forked jobs inherit them instead of each reading them again.
+ * Failures are ignored, the files are just read when they are included.
+ */
+void prewarm_file_cache(void)
+{
+	static const char *dirs[] = { "abstractions", "tunables" };
+	int i;
+	size_t j;
+
+	for (i = 0; i < npath; i++) {
+		for (j = 0; j < sizeof(dirs) / sizeof(*dirs); j++) {
+			autofree char *dir = NULL;
+			struct stat st;
+
+			if (asprintf(&dir, "%s/%s", path[i], dirs[j]) < 0) {
+				dir = NULL;
+				continue;
+			}
+			if (stat(dir, &st) == 0 && S_ISDIR(st.st_mode))
+				(void) dirat_for_each(AT_FDCWD, dir, dir,
+						      prewarm_dir_cb);
+		}
+	}
+}
+
 struct include_stack_t {
 	char *filename;
 	int lineno;
@@ -28,6 +28,10 @@ extern void set_base_dir(char *dir);
 extern void parse_default_paths(void);
 extern int do_include_preprocessing(char *profilename);
 FILE *search_path(char *filename, char **fullpath, bool *skip);
+struct cached_file *search_cached_path(char *filename, char **fullpath,
+				       bool *skip);
+FILE *open_cached_file(struct cached_file *file);
+extern void prewarm_file_cache(void);
 
 extern void push_include_stack(char *filename);
 extern void pop_include_stack(void);
@@ -26,12 +26,12 @@
 #include <fcntl.h>
 
 #include <string>
-#include <sstream>
 #include <sys/apparmor.h>
 
 #include "lib.h"
 #include "parser.h"
 #include "profile.h"
+#include "load_batch.h"
 #include "libapparmor_re/apparmor_re.h"
 
 #include <unistd.h>
@@ -191,57 +191,57 @@ const char *sd_code_names[] = {
 };
 
 
-static inline void sd_write8(std::ostringstream &buf, u8 b)
+static inline void sd_write8(ByteBuffer &buf, u8 b)
 {
-	buf.write((const char *) &b, 1);
+	buf.put(b);
 }
 
-static inline void sd_write16(std::ostringstream &buf, u16 b)
+static inline void sd_write16(ByteBuffer &buf, u16 b)
 {
 	u16 tmp;
 	tmp = cpu_to_le16(b);
 	buf.write((const char *) &tmp, 2);
 }
 
-static inline void sd_write32(std::ostringstream &buf, u32 b)
+static inline void sd_write32(ByteBuffer &buf, u32 b)
 {
 	u32 tmp;
 	tmp = cpu_to_le32(b);
 	buf.write((const char *) &tmp, 4);
 }
 
-static inline void sd_write64(std::ostringstream &buf, u64 b)
+static inline void sd_write64(ByteBuffer &buf, u64 b)
 {
 	u64 tmp;
 	tmp = cpu_to_le64(b);
 	buf.write((const char *) &tmp, 8);
 }
 
-static inline void sd_write_uint8(std::ostringstream &buf, u8 b)
+static inline void sd_write_uint8(ByteBuffer &buf, u8 b)
 {
 	sd_write8(buf, SD_U8);
 	sd_write8(buf, b);
 }
 
-static inline void sd_write_uint16(std::ostringstream &buf, u16 b)
+static inline void sd_write_uint16(ByteBuffer &buf, u16 b)
 {
 	sd_write8(buf, SD_U16);
 	sd_write16(buf, b);
 }
 
-static inline void sd_write_uint32(std::ostringstream &buf, u32 b)
+static inline void sd_write_uint32(ByteBuffer &buf, u32 b)
 {
 	sd_write8(buf, SD_U32);
 	sd_write32(buf, b);
 }
 
-static inline void sd_write_uint64(std::ostringstream &buf, u64 b)
+static inline void sd_write_uint64(ByteBuffer &buf, u64 b)
 {
 	sd_write8(buf, SD_U64);
 	sd_write64(buf, b);
 }
 
-static inline void sd_write_name(std::ostringstream &buf, const char *name)
+static inline void sd_write_name(ByteBuffer &buf, const char *name)
 {
 	PDEBUG("Writing name '%s'\n", name);
 	if (name) {
@@ -251,7 +251,7 @@ static inline void sd_write_name(std::ostringstream &buf, const char *name)
 	}
 }
 
-static inline void sd_write_blob(std::ostringstream &buf, void *b, int buf_size, char *name)
+static inline void sd_write_blob(ByteBuffer &buf, void *b, int buf_size, char *name)
 {
 	sd_write_name(buf, name);
 	sd_write8(buf, SD_BLOB);
@@ -260,21 +260,20 @@ static inline void sd_write_blob(std::ostringstream &buf, void *b, int buf_size,
 }
 
 
-static char zeros[64];
 #define align64(X) (((X) + (typeof(X)) 7) & ~((typeof(X)) 7))
-static inline void sd_write_aligned_blob(std::ostringstream &buf, void *b, int b_size,
+static inline void sd_write_aligned_blob(ByteBuffer &buf, void *b, int b_size,
 				 const char *name)
 {
 	sd_write_name(buf, name);
 	/* pad calculation MUST come after name is written */
-	size_t pad = align64(buf.tellp() + ((std::streamoff) 5l)) - (buf.tellp() + ((std::streamoff) 5l));
+	size_t pad = align64(buf.size() + 5) - (buf.size() + 5);
 	sd_write8(buf, SD_BLOB);
 	sd_write32(buf, b_size + pad);
-	buf.write(zeros, pad);
-	buf.write((const char *) b, b_size);
+	buf.fill(pad);
+	buf.write(b, b_size);
 }
 
-static void sd_write_strn(std::ostringstream &buf, char *b, int size, const char *name)
+static void sd_write_strn(ByteBuffer &buf, char *b, int size, const char *name)
 {
 	sd_write_name(buf, name);
 	sd_write8(buf, SD_STRING);
@@ -282,52 +281,52 @@ static void sd_write_strn(std::ostringstream &buf, char *b, int size, const char
 	buf.write(b, size);
 }
 
-static inline void sd_write_string(std::ostringstream &buf, char *b, const char *name)
+static inline void sd_write_string(ByteBuffer &buf, char *b, const char *name)
 {
 	sd_write_strn(buf, b, strlen(b) + 1, name);
 }
 
-static inline void sd_write_struct(std::ostringstream &buf, const char *name)
+static inline void sd_write_struct(ByteBuffer &buf, const char *name)
 {
 	sd_write_name(buf, name);
 	sd_write8(buf, SD_STRUCT);
 }
 
-static inline void sd_write_structend(std::ostringstream &buf)
+static inline void sd_write_structend(ByteBuffer &buf)
 {
 	sd_write8(buf, SD_STRUCTEND);
 }
 
-static inline void sd_write_array(std::ostringstream &buf, const char *name, int size)
+static inline void sd_write_array(ByteBuffer &buf, const char *name, int size)
 {
 	sd_write_name(buf, name);
 	sd_write8(buf, SD_ARRAY);
 	sd_write16(buf, size);
 }
 
-static inline void sd_write_arrayend(std::ostringstream &buf)
+static inline void sd_write_arrayend(ByteBuffer &buf)
 {
 	sd_write8(buf, SD_ARRAYEND);
 }
 
-static inline void sd_write_list(std::ostringstream &buf, const char *name)
+static inline void sd_write_list(ByteBuffer &buf, const char *name)
 {
 	sd_write_name(buf, name);
 	sd_write8(buf, SD_LIST);
 }
 
-static inline void sd_write_listend(std::ostringstream &buf)
+static inline void sd_write_listend(ByteBuffer &buf)
 {
 	sd_write8(buf, SD_LISTEND);
 }
 
-void sd_serialize_dfa(std::ostringstream &buf, void *dfa, size_t size)
+void sd_serialize_dfa(ByteBuffer &buf, void *dfa, size_t size)
 {
 	if (dfa)
 		sd_write_aligned_blob(buf, dfa, size, "aadfa");
 }
 
-void sd_serialize_rlimits(std::ostringstream &buf, struct aa_rlimits *limits)
+void sd_serialize_rlimits(ByteBuffer &buf, struct aa_rlimits *limits)
 {
 	if (!limits->specified)
 		return;
@@ -342,7 +341,7 @@ void sd_serialize_rlimits(std::ostringstream &buf, struct aa_rlimits *limits)
 	sd_write_structend(buf);
 }
 
-void sd_serialize_xtable(std::ostringstream &buf, char **table)
+void sd_serialize_xtable(ByteBuffer &buf, char **table)
 {
 	int count;
 	if (!table[4])
@@ -371,7 +370,7 @@ void sd_serialize_xtable(std::ostringstream &buf, char **table)
 	sd_write_structend(buf);
 }
 
-void sd_serialize_xattrs(std::ostringstream &buf, struct cond_entry_list xattrs)
+void sd_serialize_xattrs(ByteBuffer &buf, struct cond_entry_list xattrs)
 {
 	int count;
 	struct cond_entry *entry;
@@ -393,7 +392,7 @@ void sd_serialize_xattrs(std::ostringstream &buf, struct cond_entry_list xattrs)
 	sd_write_structend(buf);
 }
 
-void sd_serialize_profile(std::ostringstream &buf, Profile *profile,
+void sd_serialize_profile(ByteBuffer &buf, Profile *profile,
 			 int flattened)
 {
 	uint64_t allowed_caps;
@@ -488,7 +487,7 @@ void sd_serialize_profile(std::ostringstream &buf, Profile *profile,
 	sd_write_structend(buf);
 }
 
-void sd_serialize_top_profile(std::ostringstream &buf, Profile *profile)
+void sd_serialize_top_profile(ByteBuffer &buf, Profile *profile)
 {
 	uint32_t version;
 
@@ -510,7 +509,11 @@ int __sd_serialize_profile(int option, aa_kernel_interface *kernel_interface,
 {
 	autoclose int fd = -1;
 	int error, size, wsize;
-	std::ostringstream work_area;
+	/* the dfas are most of the serialized profile, so reserve room for
+	 * them up front and the buffer rarely has to grow
+	 */
+	ByteBuffer work_area(prof->xmatch_size + prof->dfa.size +
+			     prof->policy.size + 4096);
 
 	switch (option) {
 	case OPTION_ADD:
@@ -550,29 +553,31 @@ int __sd_serialize_profile(int option, aa_kernel_interface *kernel_interface,
 				error = -errno;
 		}
 	} else {
-		std::string tmp;
-
 		sd_serialize_top_profile(work_area, prof);
 
-		tmp = work_area.str();
-		size = (long) work_area.tellp();
-		if (kernel_load) {
+		/* the kernel and the cache are given the same buffer */
+		size = work_area.size();
+		if (kernel_load && load_batch_active()) {
+			if (load_batch_add(prof->name, NULL, work_area.data(),
+					   size) == -1)
+				error = -errno;
+		} else if (kernel_load) {
 			if (option == OPTION_ADD &&
 			    aa_kernel_interface_load_policy(kernel_interface,
-							    tmp.c_str(), size) == -1) {
+							    work_area.data(), size) == -1) {
 				error = -errno;
 			} else if (option == OPTION_REPLACE &&
 				   aa_kernel_interface_replace_policy(kernel_interface,
-								      tmp.c_str(), size) == -1) {
+								      work_area.data(), size) == -1) {
 				error = -errno;
 			}
 		} else if ((option == OPTION_STDOUT || option == OPTION_OFILE) &&
-			   aa_kernel_interface_write_policy(fd, tmp.c_str(), size) == -1) {
+			   aa_kernel_interface_write_policy(fd, work_area.data(), size) == -1) {
 			error = -errno;
 		}
 
 		if (cache_fd != -1) {
-			wsize = write(cache_fd, tmp.c_str(), size);
+			wsize = write(cache_fd, work_area.data(), size);
 			if (wsize < 0) {
 				error = -errno;
 			} else if (wsize < size) {
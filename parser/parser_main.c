@@ -38,9 +38,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 
 #include <sys/apparmor.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "capability.h"
 #include "lib.h"
 #include "features.h"
@@ -51,6 +56,8 @@
 #include "policy_cache.h"
 #include "libapparmor_re/apparmor_re.h"
 #include "file_cache.h"
+#include "include_module.h"
+#include "load_batch.h"
 
 #define OLD_MODULE_NAME "subdomain"
 #define PROC_MODULES "/proc/modules"
@@ -91,6 +98,9 @@ int mru_skip_cache = 1;
 #define DEFAULT_JOBS_MAX -8
 #define DEFAULT_ESTIMATED_JOB_SIZE (50 * 1024 * 1024)
 long estimated_job_size = DEFAULT_ESTIMATED_JOB_SIZE;
+#define DEFAULT_MEMORY_WATERMARK (32 * 1024 * 1024)
+long long memory_watermark = DEFAULT_MEMORY_WATERMARK;
+long long load_batch_size = 0;		/* 0: every job loads its own policy */
 long jobs_max = DEFAULT_JOBS_MAX;	/* 8 * cpus */
 long jobs = JOBS_AUTO;			/* default: number of processor cores */
 long njobs = 0;
@@ -134,6 +144,8 @@ static const char *config_file = "/etc/apparmor/parser.conf";
 #define EARLY_ARG_CONFIG_FILE		142
 #define ARG_WERROR			143
 #define ARG_ESTIMATED_COMPILE_SIZE	144
+#define ARG_MEMORY_WATERMARK		145
+#define ARG_LOAD_BATCH			146
 
 /* Make sure to update BOTH the short and long_options */
 static const char *short_options = "ad::f:h::rRVvI:b:BCD:NSm:M:qQn:XKTWkL:O:po:j:";
@@ -189,6 +201,8 @@ struct option long_options[] = {
 	{"override-policy-abi",	1, 0, ARG_OVERRIDE_POLICY_ABI},	/* no short option */
 	{"config-file",		1, 0, EARLY_ARG_CONFIG_FILE},	/* early option, no short option */
 	{"estimated-compile-size", 1, 0, ARG_ESTIMATED_COMPILE_SIZE}, /* no short option, not in help */
+	{"memory-watermark",	1, 0, ARG_MEMORY_WATERMARK}, /* no short option, not in help */
+	{"load-batch",		1, 0, ARG_LOAD_BATCH},	/* no short option */
 
 	{NULL, 0, 0, 0},
 };
@@ -245,6 +259,7 @@ static void display_usage(const char *command)
 	       "-h [cmd], --help[=cmd]  Display this text or info about cmd\n"
 	       "-j n, --jobs n		Set the number of compile threads\n"
 	       "--max-jobs n		Hard cap on --jobs. Default 8*cpus\n"
+	       "--load-batch n		Load policy in atomic sets of n bytes\n"
 	       "--abort-on-error	Abort processing of profiles on first error\n"
 	       "--skip-bad-cache-rebuild Do not try rebuilding the cache if it is rejected by the kernel\n"
 	       "--config-file n		Specify the parser config file location, processed early before other options.\n"
@@ -784,6 +799,36 @@ static int process_arg(int c, char *optarg)
 			estimated_job_size = tmp * mult;
 		}
 		break;
+	case ARG_MEMORY_WATERMARK:
+		/* memory kept free when starting parallel jobs */
+		{
+			char *end;
+			long mult;
+			long long tmp = strtoll(optarg, &end, 0);
+			if (end == optarg || tmp < 0 ||
+			    (errno == ERANGE && tmp == LLONG_MAX) ||
+			    (mult = str_to_size(end)) == -1) {
+				PERROR("%s: --memory-watermark invalid size '%s'", progname, optarg);
+				exit(1);
+			}
+			memory_watermark = tmp * mult;
+		}
+		break;
+	case ARG_LOAD_BATCH:
+		/* policy collected from jobs before loading it as a set */
+		{
+			char *end;
+			long mult;
+			long long tmp = strtoll(optarg, &end, 0);
+			if (end == optarg || tmp < 0 ||
+			    (errno == ERANGE && tmp == LLONG_MAX) ||
+			    (mult = str_to_size(end)) == -1) {
+				PERROR("%s: --load-batch invalid size '%s'", progname, optarg);
+				exit(1);
+			}
+			load_batch_size = tmp * mult;
+		}
+		break;
 	default:
 		/* 'unrecognized option' error message gets printed by getopt_long() */
 		exit(1);
@@ -969,15 +1014,26 @@ static bool do_print_cache_dirs(aa_features *features, const char **cacheloc,
 	return true;
 }
 
+/* @source: profile to rebuild from if a batched load of the policy is
+ * rejected, or NULL
+ */
 int process_binary(int option, aa_kernel_interface *kernel_interface,
-		   const char *profilename)
+		   const char *profilename, const char *source)
 {
 	const char *printed_name;
 	int retval;
 
 	printed_name = profilename ? profilename : "stdin";
 
-	if (kernel_load) {
+	if (kernel_load && load_batch_active()) {
+		if (load_batch_add_file(printed_name, source,
+					profilename) == -1) {
+			retval = errno;
+			PERROR(_("Error: Could not read profile %s: %s\n"),
+			       printed_name, strerror(retval));
+			return retval;
+		}
+	} else if (kernel_load) {
 		if (option == OPTION_ADD) {
 			retval = profilename ?
 				 aa_kernel_interface_load_policy_from_file(kernel_interface, AT_FDCWD, profilename) :
@@ -1029,6 +1085,7 @@ void reset_parser(const char *filename)
 	memset(&mru_policy_tstamp, 0, sizeof(mru_policy_tstamp));
 	memset(&cache_tstamp, 0, sizeof(cache_tstamp));
 	mru_skip_cache = 1;
+	reset_policy_hash();
 	free_aliases();
 	free_symtabs();
 	free_policies();
@@ -1142,8 +1199,13 @@ int process_profile(int option, aa_kernel_interface *kernel_interface,
 	if (cachename) {
 		/* Load a binary cache if it exists and is newest */
 		if (cache_hit(cachename)) {
+			/* a batched load is only checked once this job
+			 * is done, so the parent does the rebuild then
+			 */
 			retval = process_binary(option, kernel_interface,
-						cachename);
+						cachename,
+						skip_bad_cache_rebuild ?
+						NULL : profilename);
 			if (!retval || skip_bad_cache_rebuild)
 				return retval;
 		}
@@ -1212,6 +1274,152 @@ out:
 	return retval;
 }
 
+/* memory a job is expected to use, from the peak RSS of finished jobs */
+static long long job_mem_estimate = -1;
+
+static void update_job_mem_estimate(struct rusage *usage)
+{
+	long long rss = (long long) usage->ru_maxrss * 1024;
+
+	/* follow big jobs straight away, and small ones slowly, so a single
+	 * huge profile is accounted for without throttling the rest of the
+	 * run forever
+	 */
+	if (rss > job_mem_estimate)
+		job_mem_estimate = rss;
+	else
+		job_mem_estimate = (job_mem_estimate * 3 + rss) / 4;
+}
+
+/* returns the value of @key in /proc/meminfo in bytes, or -1 */
+static long long get_meminfo(const char *key)
+{
+	char buf[256];
+	autofclose FILE *f = fopen("/proc/meminfo", "r");
+	size_t len = strlen(key);
+
+	if (!f)
+		return -1;
+	while (fgets(buf, sizeof(buf), f)) {
+		long long value;
+		if (strncmp(buf, key, len) == 0 &&
+		    sscanf(buf + len, "%lld kB", &value) == 1)
+			return value * 1024;
+	}
+
+	return -1;
+}
+
+/* returns the contents of @dir/@name as a number, or -1 for "max" or
+ * if it can not be read
+ */
+static long long read_cgroup_value(const char *dir, const char *name)
+{
+	autofree char *path = NULL;
+	autofclose FILE *f = NULL;
+	long long value;
+
+	if (asprintf(&path, "%s/%s", dir, name) < 0) {
+		path = NULL;
+		return -1;
+	}
+	f = fopen(path, "r");
+	if (!f || fscanf(f, "%lld", &value) != 1)
+		return -1;
+
+	return value;
+}
+
+/* returns the memory left under the tightest cgroup v2 memory.max of the
+ * parser's cgroup and its parents, or -1 if none is limited
+ */
+static long long get_cgroup_mem_available(void)
+{
+	char buf[PATH_MAX], *path;
+	autofclose FILE *f = fopen("/proc/self/cgroup", "r");
+	long long available = -1;
+	size_t len;
+
+	if (!f)
+		return -1;
+	while ((path = fgets(buf, sizeof(buf), f))) {
+		/* the unified hierarchy is the "0::<path>" entry */
+		if (strncmp(buf, "0::", 3) == 0)
+			break;
+	}
+	if (!path)
+		return -1;
+	path = buf + 3;
+	len = strcspn(path, "\n");
+	path[len] = 0;
+
+	for (;;) {
+		autofree char *dir = NULL;
+		long long max, current;
+		char *slash;
+
+		if (asprintf(&dir, "/sys/fs/cgroup%s", path) < 0) {
+			dir = NULL;
+			break;
+		}
+		max = read_cgroup_value(dir, "memory.max");
+		current = read_cgroup_value(dir, "memory.current");
+		if (max >= 0 && current >= 0 &&
+		    (available < 0 || max - current < available))
+			available = max > current ? max - current : 0;
+
+		/* walk up to the parent cgroup */
+		slash = strrchr(path, '/');
+		if (!slash || slash == path)
+			break;
+		*slash = 0;
+	}
+
+	return available;
+}
+
+/* returns the memory available for new jobs, or -1 if it is not known */
+static long long get_mem_available(void)
+{
+	long long available = get_meminfo("MemAvailable:");
+	long long cgroup = get_cgroup_mem_available();
+
+	if (cgroup >= 0 && (available < 0 || cgroup < available))
+		available = cgroup;
+
+	return available;
+}
+
+/*
+ * Returns true if there is memory for another job to run alongside the
+ * running ones without pushing available memory under the watermark.
+ * Checked each time a job is started, so parallelism backs off as big
+ * jobs use memory, instead of being fixed by the estimate made at start
+ * up.
+ *
+ * Jobs that were just started have not allocated their memory yet, so
+ * each running job is charged a whole job's worth of memory on top of
+ * what is already in use. That overestimates jobs well into their
+ * compile, but never lets a burst of starts overshoot the watermark.
+ */
+static bool work_admit(void)
+{
+	long long available, needed;
+
+	if (!memory_watermark)
+		return true;
+	available = get_mem_available();
+	if (available < 0)
+		return true;
+	needed = job_mem_estimate >= 0 ? job_mem_estimate : estimated_job_size;
+	if (available - needed * (njobs + 1) >= memory_watermark)
+		return true;
+
+	if (debug_jobs)
+		fprintf(stderr, "    JOBS ADMIT: waiting (available %lld, job %lld, jobs %ld, watermark %lld) ...\n", available, needed, njobs, memory_watermark);
+	return false;
+}
+
 /* Do not call directly, this is a helper for work_sync, which can handle
  * single worker cases and cases were the work queue is optimized away
  *
@@ -1220,7 +1428,9 @@ out:
 #define work_sync_one(RESULT)						\
 do {									\
 	int status;							\
-	wait(&status);							\
+	struct rusage usage;						\
+	if (wait4(-1, &status, 0, &usage) > 0)				\
+		update_job_mem_estimate(&usage);			\
 	if (WIFEXITED(status))						\
 		RESULT(WEXITSTATUS(status));				\
 	else								\
@@ -1267,6 +1477,8 @@ do {									\
 				fprintf(stderr, "    JOBS SPAWN: waiting (jobs %ld == max %ld) ...\n", njobs, jobs);					\
 			work_sync_one(RESULT);				\
 		}							\
+		while (njobs && !work_admit())				\
+			work_sync_one(RESULT);				\
 									\
 		pid_t child = fork();					\
 		if (child == 0) {					\
@@ -1291,7 +1503,6 @@ do {									\
 	localrc;							\
 })
 
-
 /* sadly C forces us to do this with exit, long_jump or returning error
  * from work_spawn and work_sync. We could throw a C++ exception, is it
  * worth doing it to avoid the exit here.
@@ -1301,6 +1512,11 @@ do {									\
 int last_error = 0;
 void handle_work_result(int retval)
 {
+	/* the policy of a finished job may complete a batch */
+	int error = load_batch_flush(false);
+
+	if (!retval)
+		retval = error;
 	if (retval) {
 		last_error = retval;
 		if (abort_on_error) {
@@ -1309,6 +1525,7 @@ void handle_work_result(int retval)
 			 */
 			abort_on_error = 0;
 			work_sync(handle_work_result);
+			load_batch_flush(true);
 			exit(last_error);
 
 		}
@@ -1482,12 +1699,107 @@ static int binary_dir_cb(int dirfd unused, const char *name, struct stat *st,
 		}
 		rc = work_spawn(process_binary(option,
 					       cb_data->kernel_interface,
-					       path),
+					       path, NULL),
 				handle_work_result);
 	}
 	return rc;
 }
 
+struct dir_entry {
+	string name;
+	struct stat st;
+	double cost;		/* estimated time to process the entry */
+};
+
+static int collect_dir_cb(int dirfd unused, const char *name, struct stat *st,
+			  void *data)
+{
+	vector<struct dir_entry> *entries = (vector<struct dir_entry> *) data;
+	struct dir_entry entry;
+
+	entry.name = name;
+	entry.st = *st;
+	entry.cost = 0;
+	entries->push_back(entry);
+
+	return 0;
+}
+
+static bool dir_entry_cost_cmp(const struct dir_entry &a,
+			       const struct dir_entry &b)
+{
+	return a.cost > b.cost;
+}
+
+/*
+ * Estimate the cost of each profile from the compile time recorded with
+ * its cache by the last run. Profiles without one are estimated from
+ * their size, scaled by the time per byte of the profiles that have one.
+ * Binary policy is just loaded, so its cost is its size.
+ */
+static void estimate_dir_costs(vector<struct dir_entry> &entries,
+			       struct dir_cb_data *cb_data, bool binary)
+{
+	vector<long> times(entries.size(), -1);
+	double timed_usec = 0, timed_size = 0, rate;
+	size_t i;
+
+	if (!binary && cb_data->policy_cache) {
+		for (i = 0; i < entries.size(); i++) {
+			if (S_ISDIR(entries[i].st.st_mode))
+				continue;
+			autofree char *cachename = aa_policy_cache_filename(
+					cb_data->policy_cache,
+					entries[i].name.c_str());
+			if (!cachename)
+				continue;
+			times[i] = cache_compile_time(cachename);
+			if (times[i] >= 0 && entries[i].st.st_size) {
+				timed_usec += times[i];
+				timed_size += entries[i].st.st_size;
+			}
+		}
+	}
+
+	rate = timed_size ? timed_usec / timed_size : 1;
+	for (i = 0; i < entries.size(); i++) {
+		if (times[i] >= 0)
+			entries[i].cost = times[i];
+		else
+			entries[i].cost = entries[i].st.st_size * rate;
+	}
+}
+
+/*
+ * Like dirat_for_each, but calls @cb on the most expensive entries
+ * first, so a big profile is not started last and left as the long
+ * tail of a parallel compile.
+ */
+static int dir_for_each_largest_first(const char *dirname,
+				      struct dir_cb_data *cb_data, bool binary,
+				      int (*cb)(int, const char *,
+						struct stat *, void *))
+{
+	vector<struct dir_entry> entries;
+	int retval;
+
+	retval = dirat_for_each(AT_FDCWD, dirname, &entries, collect_dir_cb);
+	if (retval)
+		return retval;
+
+	estimate_dir_costs(entries, cb_data, binary);
+	stable_sort(entries.begin(), entries.end(), dir_entry_cost_cmp);
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		retval = cb(AT_FDCWD, entries[i].name.c_str(), &entries[i].st,
+			    cb_data);
+		if (retval)
+			return retval;
+	}
+
+	return 0;
+}
+
 static bool get_kernel_features(struct aa_features **features)
 {
 	/* Gracefully handle AppArmor kernel without compatibility patch */
@@ -1510,6 +1822,8 @@ static bool get_kernel_features(struct aa_features **features)
 							   "policy/diff_encode");
 	kernel_supports_oob = aa_features_supports(*features,
 						   "policy/outofband");
+	kernel_supports_state32 = aa_features_supports(*features,
+						       "policy/state32");
 
 	if (aa_features_supports(*features, "policy/versions/v7"))
 		kernel_abi_version = 7;
@@ -1520,6 +1834,10 @@ static bool get_kernel_features(struct aa_features **features)
 		/* clear diff_encode because it is not supported */
 		dfaflags &= ~DFA_CONTROL_DIFF_ENCODE;
 
+	if (kernel_supports_state32)
+		/* allow dfas with more than 64k states */
+		dfaflags |= DFA_CONTROL_STATE32;
+
 	return true;
 }
 
@@ -1527,6 +1845,7 @@ int main(int argc, char *argv[])
 {
 	aa_kernel_interface *kernel_interface = NULL;
 	aa_policy_cache *policy_cache = NULL;
+	bool prewarmed = false;
 	int retval;
 	int i;
 	int optind;
@@ -1543,6 +1862,10 @@ int main(int argc, char *argv[])
 
 	auto_tune_parameters();
 
+	/* preprocessing echoes the text of includes, so they are always lexed */
+	if (!preprocess_only)
+		g_modulecache = new ModuleCache();
+
 	setlocale(LC_MESSAGES, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
 	textdomain(PACKAGE);
@@ -1618,6 +1941,9 @@ int main(int argc, char *argv[])
 		} else {
 			if (show_cache)
 				PERROR("Cache: added primary location '%s'\n", cacheloc[0]);
+			if (dfaflags & DFA_CONTROL_FRAGMENT_CACHE)
+				setup_fragment_cache(policy_cache);
+			setup_module_cache(policy_cache);
 			for (i = 1; i < cacheloc_n; i++) {
 				if (aa_policy_cache_add_ro_dir(policy_cache, AT_FDCWD,
 							       cacheloc[i])) {
@@ -1628,6 +1954,18 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* without set loads the kernel only takes the first profile of a
+	 * write, so only batch if it has them
+	 */
+	if (load_batch_size && kernel_load &&
+	    (option == OPTION_ADD || option == OPTION_REPLACE)) {
+		if (!kernel_supports_setload)
+			pwarn(WARN_CONFIG, "%s: kernel does not support set loads, --load-batch disabled\n", progname);
+		else if (load_batch_init(kernel_interface, option,
+					 load_batch_size) == -1)
+			pwarn(WARN_CONFIG, "%s: --load-batch disabled: %m\n", progname);
+	}
+
 	retval = last_error = 0;
 	for (i = optind; i <= argc; i++) {
 		struct stat stat_file;
@@ -1661,8 +1999,23 @@ int main(int argc, char *argv[])
 			cb_data.policy_cache = policy_cache;
 			cb_data.kernel_interface = kernel_interface;
 			cb = binary_input ? binary_dir_cb : profile_dir_cb;
-			if ((retval = dirat_for_each(AT_FDCWD, profilename,
-						     &cb_data, cb))) {
+			/* forked jobs can only share the includes read
+			 * before they are forked
+			 */
+			if (!binary_input && jobs && !prewarmed) {
+				prewarm_file_cache();
+				prewarmed = true;
+			}
+			/* the order only matters when jobs run in parallel */
+			if (jobs)
+				retval = dir_for_each_largest_first(profilename,
+								    &cb_data,
+								    binary_input,
+								    cb);
+			else
+				retval = dirat_for_each(AT_FDCWD, profilename,
+							&cb_data, cb);
+			if (retval) {
 				last_error = errno;
 				PDEBUG("Failed loading profiles from %s\n",
 				       profilename);
@@ -1672,7 +2025,7 @@ int main(int argc, char *argv[])
 		} else if (binary_input) {
 			/* ignore return as error is handled in work_spawn */
 			work_spawn(process_binary(option, kernel_interface,
-						  profilename),
+						  profilename, NULL),
 				   handle_work_result);
 		} else {
 			/* ignore return as error is handled in work_spawn */
@@ -1687,6 +2040,25 @@ int main(int argc, char *argv[])
 		profilename = NULL;
 	}
 	work_sync(handle_work_result);
+	retval = load_batch_flush(true);
+	if (retval)
+		last_error = retval;
+	/* cached policy the kernel rejected is rebuilt from source */
+	if ((profilename = load_batch_rebuild())) {
+		skip_read_cache = 1;
+		do {
+			/* ignore return as error is handled in work_spawn */
+			work_spawn(process_profile(option, kernel_interface,
+						   profilename, policy_cache),
+				   handle_work_result);
+			free(profilename);
+		} while ((profilename = load_batch_rebuild()));
+		work_sync(handle_work_result);
+		retval = load_batch_flush(true);
+		if (retval)
+			last_error = retval;
+	}
+	load_batch_free();
 
 	if (ofile)
 		fclose(ofile);
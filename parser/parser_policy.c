@@ -278,7 +278,7 @@ int load_policy(int option, aa_kernel_interface *kernel_interface, int cache_fd)
 	return load_policy_list(policy_list, option, kernel_interface, cache_fd);
 }
 
-int load_hats(std::ostringstream &buf, Profile *prof)
+int load_hats(ByteBuffer &buf, Profile *prof)
 {
 	for (ProfileList::iterator i = prof->hat_table.begin(); i != prof->hat_table.end(); i++) {
 		sd_serialize_profile(buf, *i, 0);
@@ -1626,6 +1626,23 @@ caps: { /* nothing */ $$ = 0; }
 %%
 #define MAXBUFSIZE 4096
 
+/* the names and numbers of the tokens, so saved tokens (see
+ * include_module.h) can be checked against the grammar reading them
+ */
+string parser_token_table(void)
+{
+	string table;
+	int i;
+
+	for (i = 258; i <= YYMAXUTOK; i++) {
+		table += to_string(i) + " ";
+		table += yytname[YYTRANSLATE(i)];
+		table += "\n";
+	}
+
+	return table;
+}
+
 void vprintyyerror(const char *msg, va_list argptr)
 {
 	char buf[MAXBUFSIZE];
@@ -1795,6 +1812,18 @@ static int abi_features_base(struct aa_features **features, char *filename, bool
                         fullpath ? fullpath: filename);
 	}
 
+	if (fileno(f) == -1) {
+		/* search_path() streams the contents of the file cache */
+		string data;
+		char buffer[4096];
+		size_t size;
+
+		while ((size = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			data.append(buffer, size);
+		return aa_features_new_from_string(features, data.data(),
+						   data.size());
+	}
+
 	if (fstat(fileno(f), &my_stat))
 		yyerror(_("fstat failed for '%s': %m"), fullpath ? fullpath : filename);
 
@@ -26,10 +26,14 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include "lib.h"
 #include "parser.h"
 #include "policy_cache.h"
+#include "include_module.h"
+#include "PMurHash.h"
+#include "libapparmor_re/aare_rules.h"
 
 #define le16_to_cpu(x) ((uint16_t)(le16toh (*(uint16_t *) x)))
 
@@ -68,6 +72,179 @@ bool valid_cached_file_version(const char *cachename)
 	return true;
 }
 
+/* The content hash covers the name and contents of every policy file read
+ * while parsing a profile, and the flags the profile is compiled with.  It
+ * is recorded next to the cache file and, when present, decides whether
+ * the cache is valid instead of the timestamps, which are not preserved by
+ * everything that copies policy around.  Two 32 bit hashes with different
+ * seeds are combined to make accidental matches unlikely.
+ */
+#define POLICY_HASH_SEED0	0
+#define POLICY_HASH_SEED1	0x5bd1e995
+#define POLICY_HASH_SIZE	(16 + 1) /* 64 bits binary to hex + NUL */
+
+struct policy_hash {
+	MH_UINT32 h[2];
+	MH_UINT32 carry[2];
+	MH_UINT32 len;
+	bool valid;
+};
+
+static struct policy_hash policy_hash;
+/* hash recorded with the cache file being considered, "" if none */
+static char cache_hash[POLICY_HASH_SIZE];
+/* when compiling the current policy started, recorded with its hash */
+static struct timespec compile_start;
+
+static void hash_data(struct policy_hash *ph, const void *data, size_t len)
+{
+	PMurHash32_Process(&ph->h[0], &ph->carry[0], data, len);
+	PMurHash32_Process(&ph->h[1], &ph->carry[1], data, len);
+	ph->len += len;
+}
+
+void reset_policy_hash(void)
+{
+	policy_hash.h[0] = POLICY_HASH_SEED0;
+	policy_hash.h[1] = POLICY_HASH_SEED1;
+	policy_hash.carry[0] = policy_hash.carry[1] = 0;
+	policy_hash.len = 0;
+	policy_hash.valid = true;
+	cache_hash[0] = 0;
+	clock_gettime(CLOCK_MONOTONIC, &compile_start);
+}
+
+static void hash_policy_file(FILE *file, const char *name,
+			     struct stat *stat_file)
+{
+	char buffer[16384];
+	off_t pos = 0;
+	ssize_t size;
+
+	if (!policy_hash.valid)
+		return;
+
+	hash_data(&policy_hash, name, strlen(name) + 1);
+	/* directories contribute their name, the files in them are hashed
+	 * as they are included
+	 */
+	if (!S_ISREG(stat_file->st_mode))
+		return;
+
+	/* pread so the stream being parsed is left alone */
+	while ((size = pread(fileno(file), buffer, sizeof(buffer), pos)) > 0) {
+		hash_data(&policy_hash, buffer, size);
+		pos += size;
+	}
+	if (size == -1) {
+		pwarn(WARN_DEBUG_CACHE, "%s: could not hash '%s': %m\n",
+		      progname, name);
+		policy_hash.valid = false;
+	}
+}
+
+static void policy_hash_string(char *buffer)
+{
+	struct policy_hash ph = policy_hash;
+
+	hash_data(&ph, &dfaflags, sizeof(dfaflags));
+	if (policy_features) {
+		autofree char *id = aa_features_id(policy_features);
+
+		if (id)
+			hash_data(&ph, id, strlen(id) + 1);
+	}
+	snprintf(buffer, POLICY_HASH_SIZE, "%08x%08x",
+		 (uint32_t) PMurHash32_Result(ph.h[0], ph.carry[0], ph.len),
+		 (uint32_t) PMurHash32_Result(ph.h[1], ph.carry[1], ph.len));
+}
+
+/* the hash is stored in a dot file, so it is never loaded as policy */
+static char *hash_filename(const char *cachename)
+{
+	const char *base = strrchr(cachename, '/');
+	char *hashname;
+	int rc;
+
+	if (base)
+		rc = asprintf(&hashname, "%.*s/.%s.hash",
+			      (int) (base - cachename), cachename, base + 1);
+	else
+		rc = asprintf(&hashname, ".%s.hash", cachename);
+
+	return rc < 0 ? NULL : hashname;
+}
+
+static void read_cache_hash(const char *cachename)
+{
+	autofree char *hashname = hash_filename(cachename);
+	autofclose FILE *f = NULL;
+
+	cache_hash[0] = 0;
+	if (!hashname || !(f = fopen(hashname, "r")))
+		return;
+	if (!fgets(cache_hash, sizeof(cache_hash), f) ||
+	    strlen(cache_hash) != POLICY_HASH_SIZE - 1)
+		cache_hash[0] = 0;
+}
+
+/**
+ * cache_compile_time - get how long the policy for a cache file took to compile
+ * @cachename: the cache file
+ *
+ * The time is recorded on the line after the hash, and is used to start
+ * the most expensive compiles first.
+ *
+ * Returns: the compile time in microseconds, or -1 if it is not known
+ */
+long cache_compile_time(const char *cachename)
+{
+	autofree char *hashname = hash_filename(cachename);
+	autofclose FILE *f = NULL;
+	char hash[POLICY_HASH_SIZE + 1];
+	long usec;
+
+	if (!hashname || !(f = fopen(hashname, "r")))
+		return -1;
+	if (!fgets(hash, sizeof(hash), f) || fscanf(f, "%ld", &usec) != 1 ||
+	    usec < 0)
+		return -1;
+
+	return usec;
+}
+
+static void write_cache_hash(const char *hashname)
+{
+	char hash[POLICY_HASH_SIZE];
+	char buffer[POLICY_HASH_SIZE + 32];
+	autofree char *tmpname = NULL;
+	autoclose int fd = -1;
+	struct timespec now;
+	long usec;
+	int len;
+
+	if (!policy_hash.valid)
+		return;
+
+	policy_hash_string(hash);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = (now.tv_sec - compile_start.tv_sec) * 1000000 +
+		(now.tv_nsec - compile_start.tv_nsec) / 1000;
+	len = snprintf(buffer, sizeof(buffer), "%s\n%ld\n", hash, usec);
+
+	if (asprintf(&tmpname, "%s-XXXXXX", hashname) < 0) {
+		tmpname = NULL;
+		return;
+	}
+	fd = mkstemp(tmpname);
+	if (fd == -1)
+		return;
+	if (write(fd, buffer, len) != len ||
+	    rename(tmpname, hashname) < 0) {
+		pwarn(WARN_CACHE, "Failed to write cache hash: %s\n", hashname);
+		unlink(tmpname);
+	}
+}
 
 void set_cache_tstamp(struct timespec t)
 {
@@ -75,22 +252,40 @@ void set_cache_tstamp(struct timespec t)
 	cache_tstamp = t;
 }
 
-void update_mru_tstamp(FILE *file, const char *name)
+static void update_mru_stat(struct stat *stat_file, const char *name)
 {
-	struct stat stat_file;
-	if (fstat(fileno(file), &stat_file))
-		return;
-	if (tstamp_cmp(mru_policy_tstamp, stat_file.st_mtim) < 0)
+	if (tstamp_cmp(mru_policy_tstamp, stat_file->st_mtim) < 0)
 		/* keep track of the most recent policy tstamp */
-		mru_policy_tstamp = stat_file.st_mtim;
+		mru_policy_tstamp = stat_file->st_mtim;
 	if (tstamp_is_null(cache_tstamp))
 		return;
-	if (tstamp_cmp(stat_file.st_mtim, cache_tstamp) > 0) {
+	if (tstamp_cmp(stat_file->st_mtim, cache_tstamp) > 0) {
 		pwarn(WARN_DEBUG_CACHE, "%s: file '%s' is newer than cache file\n", progname, name);
 		mru_skip_cache = 1;
 	}
 }
 
+void update_mru_tstamp(FILE *file, const char *name)
+{
+	struct stat stat_file;
+	if (fstat(fileno(file), &stat_file))
+		return;
+	hash_policy_file(file, name, &stat_file);
+	update_mru_stat(&stat_file, name);
+}
+
+/* like update_mru_tstamp, for a file read through the file cache */
+void update_mru_tstamp_cached(struct cached_file *file, const char *name)
+{
+	if (policy_hash.valid) {
+		hash_data(&policy_hash, name, strlen(name) + 1);
+		if (S_ISREG(file->st.st_mode))
+			hash_data(&policy_hash, file->data.data(),
+				  file->data.size());
+	}
+	update_mru_stat(&file->st, name);
+}
+
 char *cache_filename(aa_policy_cache *pc, int dir, const char *basename)
 {
 	char *cachename;
@@ -113,9 +308,10 @@ void valid_read_cache(const char *cachename)
 	if (!skip_read_cache) {
 		if (stat(cachename, &stat_bin) == 0 &&
 		    stat_bin.st_size > 0) {
-			if (valid_cached_file_version(cachename))
+			if (valid_cached_file_version(cachename)) {
 				set_cache_tstamp(stat_bin.st_mtim);
-			else if (!cond_clear_cache)
+				read_cache_hash(cachename);
+			} else if (!cond_clear_cache)
 				write_cache = 0;
 		} else {
 			if (!cond_clear_cache)
@@ -127,7 +323,19 @@ void valid_read_cache(const char *cachename)
 
 int cache_hit(const char *cachename)
 {
-	if (!mru_skip_cache) {
+	bool hit = !mru_skip_cache;
+
+	/* a recorded content hash takes precedence over the timestamps */
+	if (*cache_hash && policy_hash.valid) {
+		char hash[POLICY_HASH_SIZE];
+
+		policy_hash_string(hash);
+		hit = strcmp(hash, cache_hash) == 0;
+		if (!hit)
+			pwarn(WARN_DEBUG_CACHE, "%s: cache file '%s' does not match the policy content hash\n", progname, cachename);
+	}
+
+	if (hit) {
 		if (show_cache)
 			PERROR("Cache hit: %s\n", cachename);
 		return true;
@@ -163,6 +371,7 @@ void install_cache(const char *cachetmpname, const char *cachename)
 	/* Only install the generate cache file if it parsed correctly
 	   and did not have write/close errors */
 	if (cachetmpname) {
+		autofree char *hashname = hash_filename(cachename);
 		struct timespec times[2];
 
 		/* set the mtime of the cache file to the most newest mtime
@@ -178,12 +387,71 @@ void install_cache(const char *cachetmpname, const char *cachename)
 			return;
 		}
 
+		/* drop the old hash first so a partial update can only fall
+		 * back to the timestamps, never match stale cache contents
+		 */
+		if (hashname)
+			unlink(hashname);
+
 		if (rename(cachetmpname, cachename) < 0) {
 			pwarn(WARN_CACHE, "Failed to write cache: %s\n", cachename);
 			unlink(cachetmpname);
+			return;
 		}
-		else if (show_cache) {
+		if (hashname)
+			write_cache_hash(hashname);
+		if (show_cache) {
 			PERROR("Wrote cache: %s\n", cachename);
 		}
 	}
 }
+
+/* dfa fragments are kept in a dot directory so they are never loaded as
+ * policy, and are removed along with the rest of the cache
+ */
+#define FRAGMENT_CACHE_DIR ".dfa-fragments"
+
+void setup_fragment_cache(aa_policy_cache *pc)
+{
+	autofree char *cachedir = aa_policy_cache_dir_path(pc, 0);
+	autofree char *dir = NULL;
+
+	if (!cachedir ||
+	    asprintf(&dir, "%s/%s", cachedir, FRAGMENT_CACHE_DIR) == -1) {
+		dir = NULL;
+		return;
+	}
+
+	if (write_cache && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		pwarn(WARN_CACHE, "Cannot create dfa fragment cache '%s': %m\n",
+		      dir);
+		return;
+	}
+	if (show_cache)
+		PERROR("Cache: dfa fragments in '%s'\n", dir);
+	aare_set_fragment_cache(dir, write_cache);
+}
+
+/* precompiled includes, see include_module.h */
+#define MODULE_CACHE_DIR ".include-modules"
+
+void setup_module_cache(aa_policy_cache *pc)
+{
+	autofree char *cachedir = aa_policy_cache_dir_path(pc, 0);
+	autofree char *dir = NULL;
+
+	if (!g_modulecache || !cachedir ||
+	    asprintf(&dir, "%s/%s", cachedir, MODULE_CACHE_DIR) == -1) {
+		dir = NULL;
+		return;
+	}
+
+	if (write_cache && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		pwarn(WARN_CACHE, "Cannot create include module cache '%s': %m\n",
+		      dir);
+		return;
+	}
+	if (show_cache)
+		PERROR("Cache: include modules in '%s'\n", dir);
+	g_modulecache->set_dir(dir, !skip_read_cache, write_cache);
+}
@@ -37,13 +37,18 @@ extern int force_clear_cache;		/* force clearing regargless of state */
 extern int create_cache_dir;		/* create the cache dir if missing? */
 extern int mru_skip_cache;
 
+void reset_policy_hash(void);
+void setup_fragment_cache(aa_policy_cache *pc);
+void setup_module_cache(aa_policy_cache *pc);
 void set_cache_tstamp(struct timespec t);
 void update_mru_tstamp(FILE *file, const char *path);
+void update_mru_tstamp_cached(struct cached_file *file, const char *path);
 bool valid_cached_file_version(const char *cachename);
 char *cache_filename(aa_policy_cache *pc, int dir, const char *basename);
 void valid_read_cache(const char *cachename);
 int cache_hit(const char *cachename);
 int setup_cache_tmp(const char **cachetmpname, const char *cachename);
 void install_cache(const char *cachetmpname, const char *cachename);
+long cache_compile_time(const char *cachename);
 
 #endif /* __AA_POLICY_CACHE_H */
@@ -476,6 +476,34 @@ class AAParserCachingTests(AAParserCachingCommon):
         self.assertNotEqual(orig_stat.st_ino, stat.st_ino)
         self._assertTimeStampEquals(abstraction_mtime, stat.st_mtime)
 
+    def test_include_module_replay_matches_lexing(self):
+        '''test a replayed include module compiles like lexing the file'''
+
+        lexed = os.path.join(self.tmp_dir, 'lexed.bin')
+        replayed = os.path.join(self.tmp_dir, 'replayed.bin')
+
+        cmd = list(self.cmd_prefix)
+        cmd.extend(['-q', '--skip-cache', '-o', lexed, self.profile])
+        self.run_cmd_check(cmd)
+
+        # records the module of the abstraction
+        self._generate_cache_file()
+        modules = os.path.join(self.cache_dir, '.include-modules')
+        self.assertTrue(os.listdir(modules), 'no include module was written')
+
+        # force a compile, which replays the abstraction's module
+        os.remove(self.cache_file)
+        cmd = list(self.cmd_prefix)
+        cmd.extend(['--show-cache', '-o', replayed, self.profile])
+        self.run_cmd_check(cmd, expected_string='Include module hit: ')
+
+        with open(lexed, 'rb') as f:
+            lexed_policy = f.read()
+        with open(replayed, 'rb') as f:
+            replayed_policy = f.read()
+        self.assertEqual(lexed_policy, replayed_policy,
+                         'policy compiled from the include module differs')
+
     def test_parser_newer_uses_cache(self):
         '''test cache is not skipped if parser is newer'''
 
@@ -200,3 +200,17 @@ if [ "$(echo "/t { /b px, audit deny /* xr, /a Cx -> foo, }" | ${APPARMOR_PARSER
     exit 1;
 fi
 echo "ok"
+
+# hopcroft minimization must produce the same partitions, and hence the
+# same binary policy, as the default iterative partition refinement
+for prof in "/t { /a r, /b w, /c a, /d l, /e k, /f m, deny /** w, }" \
+	    "/t { /b px, audit /* Pixr, /a Cx -> foo, }" \
+	    "/t { /usr/{lib,lib64}/** mr, /tmp/*/{a,b}* rw, audit deny /tmp/x/** w, }" ; do
+	echo -n "Minimize profiles hopcroft \"${prof}\" "
+	if [ "$(echo "${prof}" | ${APPARMOR_PARSER} -M features_files/features.nopolicydb -QS -O minimize 2>/dev/null | md5sum)" != \
+	     "$(echo "${prof}" | ${APPARMOR_PARSER} -M features_files/features.nopolicydb -QS -O minimize -O minimize-hopcroft 2>/dev/null | md5sum)" ] ; then
+		echo "failed"
+		exit 1;
+	fi
+	echo "ok"
+done